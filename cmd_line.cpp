@@ -2,6 +2,7 @@
 // cmd_line.cpp - Implements a command-line parser
 //==========================================================================================================
 #include "cmd_line.h"
+#include "config_file.h"
 using namespace std;
 
 //==========================================================================================================
@@ -18,6 +19,23 @@ void CCmdLine::declare_switch(string name, clp_t swtype)
 //==========================================================================================================
 
 
+//==========================================================================================================
+// declare_overrides() - Gets called prior to parse() to accept "section::key=value" config-file overrides
+//==========================================================================================================
+void CCmdLine::declare_overrides(string name)
+{
+    // Make sure that switch names begin with a dash
+    if (name[0] != '-') name = '-' + name;
+
+    // This switch always requires a parameter
+    m_valid_switches[name] = CLP_REQUIRED;
+
+    // And remember that this switch is special
+    m_override_switch = name;
+}
+//==========================================================================================================
+
+
 //==========================================================================================================
 // parse() - Parses the command line
 //
@@ -37,6 +55,7 @@ bool CCmdLine::parse(int argc, char** argv, bool throw_on_error)
     // Clear any existing command line data we have
     m_switches.clear();
     m_args.clear();
+    m_overrides.clear();
 
     // Loop through every token on the command line...
     while (argv[++i])
@@ -85,6 +104,18 @@ bool CCmdLine::parse(int argc, char** argv, bool throw_on_error)
             param.value = argv[++i];
         }
 
+        // Config-file overrides can be repeated, so they're kept in a list of their own
+        if (token == m_override_switch)
+        {
+            if (param.value.find('=') == string::npos)
+            {
+                m_error = "switch '" + token + "' requires a parameter of the form section::key=value";
+                if (throw_on_error) throw runtime_error(m_error);
+                return false;
+            }
+            m_overrides.push_back(param.value);
+        }
+
         // Store the switch and its parameter (if any)
         m_switches[token] = param;
     }
@@ -172,6 +203,34 @@ bool CCmdLine::has_switch(string name, double* param)
 //==========================================================================================================
 
 
+//==========================================================================================================
+// apply_overrides() - Layers the overrides from the command line on top of a config file
+//
+// Passed: config         = The config file to override values in
+//         throw_on_error = If this is true, errors will be reported via throwing a runtime exception
+//                          instead of by returning true/false
+//
+// Returns: success status
+//          If return value is false, error string can be retrieved by calling "error()"
+//==========================================================================================================
+bool CCmdLine::apply_overrides(CConfigFile& config, bool throw_on_error)
+{
+    for (auto& assignment : m_overrides)
+    {
+        if (!config.set(assignment))
+        {
+            m_error = "'" + assignment + "' is not a valid config-file override";
+            if (throw_on_error) throw runtime_error(m_error);
+            return false;
+        }
+    }
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
 //==========================================================================================================
 // arg() - Fetches the non-switch argument with the specified index
 //==========================================================================================================
@@ -3,12 +3,19 @@
 //==========================================================================================================
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <stdexcept>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
 
 enum clp_t {CLP_NONE, CLP_REQUIRED, CLP_OPTIONAL};
 
+class CConfigFile;
+
 class CCmdLine
 {
 public:
@@ -16,9 +23,19 @@ public:
     // Prior to calling parse(), declare which switches are valid
     void    declare_switch(std::string name, clp_t swtype);
 
+    // Call this prior to parse() to accept config-file overrides such as "--set section::key=value".
+    // The switch may appear any number of times
+    void    declare_overrides(std::string name = "--set");
+
     // Call this to parse the command line
     bool    parse(int argc, char** argv, bool throw_on_error = false);
 
+    // Returns every "section::key=value" override from the command line, in order
+    std::vector<std::string> overrides() {return m_overrides;}
+
+    // Layers the overrides on top of a config file.  Call this before or after reading the file
+    bool    apply_overrides(CConfigFile& config, bool throw_on_error = false);
+
     // Call one of these to determine whether a given switch was used
     bool    has_switch(std::string name, std::string *param = nullptr);
     bool    has_switch(std::string name, int         *param);
@@ -52,4 +69,328 @@ protected:
 
     // This contains all of the non-switch arguments
     std::vector<std::string> m_args;
+
+    // The name of the override switch, or empty if overrides aren't accepted
+    std::string m_override_switch;
+
+    // The overrides that were on the command line
+    std::vector<std::string> m_overrides;
+};
+
+
+//==========================================================================================================
+// cmd_switch_t - Declares one entry in a compile-time switch table.  The leading dash is optional
+//==========================================================================================================
+struct cmd_switch_t
+{
+    std::string_view name;
+    clp_t            type;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CSwitchTable - A constexpr table of valid switches with a perfect hash.  Build it at compile time:
+//
+//     static constexpr cmd_switch_t switches[] = {{"verbose", CLP_NONE}, {"port", CLP_REQUIRED}};
+//     static constexpr CSwitchTable table(switches);
+//     static constexpr int SW_PORT = table.find("port");
+//
+// The hash seed is searched for by the compiler, so every switch has a slot of its own and find() is a
+// single hash and a single compare.  A duplicate switch name is a compile-time error.
+//==========================================================================================================
+template <size_t N> class CSwitchTable
+{
+public:
+
+    // Builds the table and searches for a hash seed that has no collisions
+    constexpr CSwitchTable(const cmd_switch_t (&switches)[N]) : m_name(), m_type(), m_slot(), m_seed(0)
+    {
+        // Store the switch names without their leading dash
+        for (size_t i = 0; i < N; ++i)
+        {
+            m_name[i] = strip(switches[i].name);
+            m_type[i] = switches[i].type;
+        }
+
+        // Make sure no switch is declared twice
+        for (size_t i = 0; i < N; ++i) for (size_t j = i + 1; j < N; ++j)
+        {
+            if (m_name[i] == m_name[j]) throw std::logic_error("duplicate switch name");
+        }
+
+        // Find a seed that gives every switch a slot of its own
+        while (!try_seed(m_seed))
+        {
+            if (++m_seed == 100000) throw std::logic_error("no perfect hash for switch table");
+        }
+    }
+
+    // Returns the index of the named switch, or -1 if it isn't in the table.  The leading dash is optional
+    constexpr int find(std::string_view name) const
+    {
+        name = strip(name);
+        int index = m_slot[hash(name, m_seed) & (SLOTS - 1)];
+        return (index >= 0 && m_name[index] == name) ? index : -1;
+    }
+
+    // Returns the number of switches in the table
+    constexpr size_t size() const {return N;}
+
+    // Returns the name (without the leading dash) and type of a switch
+    constexpr std::string_view name(int index) const {return m_name[index];}
+    constexpr clp_t            type(int index) const {return m_type[index];}
+
+protected:
+
+    // The hash table is a power of 2, and at least twice the number of switches
+    static constexpr size_t slots_for(size_t n) {size_t s = 2; while (s < 2 * n) s <<= 1; return s;}
+    static constexpr size_t SLOTS = slots_for(N);
+
+    // Removes a single leading dash
+    static constexpr std::string_view strip(std::string_view name)
+    {
+        if (!name.empty() && name[0] == '-') name.remove_prefix(1);
+        return name;
+    }
+
+    // Seeded FNV-1a
+    static constexpr uint32_t hash(std::string_view s, uint32_t seed)
+    {
+        uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+        for (char c : s) {h ^= (uint8_t)c; h *= 16777619u;}
+        return h ^ (h >> 15);
+    }
+
+    // Fills in m_slot using the specified seed.  Returns 'false' if two switches collide
+    constexpr bool try_seed(uint32_t seed)
+    {
+        for (size_t i = 0; i < SLOTS; ++i) m_slot[i] = -1;
+        for (size_t i = 0; i < N; ++i)
+        {
+            size_t slot = hash(m_name[i], seed) & (SLOTS - 1);
+            if (m_slot[slot] >= 0) return false;
+            m_slot[slot] = (int)i;
+        }
+        return true;
+    }
+
+    // The switch names and types
+    std::string_view m_name[N];
+    clp_t            m_type[N];
+
+    // Maps a hash slot to a switch index, or -1
+    int              m_slot[SLOTS];
+
+    // The hash seed that has no collisions
+    uint32_t         m_seed;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CCmdTable - A command-line parser that uses a CSwitchTable.  Same rules as CCmdLine, but parse() doesn't
+//             allocate any memory: switch parameters and non-switch arguments are string_views into argv,
+//             and numeric parameters are decoded once, during parse().
+//
+//     CCmdTable cmd(table);
+//     if (!cmd.parse(argc, argv)) {printf("%s\n", cmd.error()); exit(1);}
+//     if (cmd.has_switch(SW_PORT, &port)) ...
+//
+// Switches can be looked up by name or, faster, by the index that CSwitchTable::find() returned.
+// MAX_ARGS is the most non-switch arguments that can appear on the command line.
+//==========================================================================================================
+template <size_t N, size_t MAX_ARGS = 256> class CCmdTable
+{
+public:
+
+    // Keeps a copy of the switch table.  No switch is present until parse() finds it
+    CCmdTable(const CSwitchTable<N>& table) : m_table(table), m_value(), m_arg_count(0) {m_error[0] = 0;}
+
+    // Call this to parse the command line
+    bool    parse(int argc, char** argv, bool throw_on_error = false);
+
+    // Call one of these to determine whether a given switch was used.  *param is only filled in if the
+    // user supplied a parameter and, for the numeric versions, if that parameter is a valid number
+    bool    has_switch(int index, std::string_view* param = nullptr) const;
+    bool    has_switch(int index, int*              param) const;
+    bool    has_switch(int index, double*           param) const;
+
+    // The same, by switch name
+    template <class T> bool has_switch(std::string_view name, T* param) const
+    {
+        return has_switch(m_table.find(name), param);
+    }
+    bool    has_switch(std::string_view name) const {return has_switch(m_table.find(name));}
+
+    // Returns the count of non-switch command-line arguments
+    int     arg_count() const {return m_arg_count;}
+
+    // Returns the specified non-switch argument
+    std::string_view arg(int index) const
+    {
+        return (index >= 0 && index < m_arg_count) ? m_arg[index] : std::string_view();
+    }
+
+    // After "parse()", this has any error encountered
+    const char* error() const {return m_error;}
+
+protected:
+
+    // Records an error message, and either throws it or returns 'false'
+    bool    fail(bool throw_on_error, const char* fmt, const char* token);
+
+    // What we know about each switch after parse()
+    struct value_t
+    {
+        bool             present;       // The switch was on the command line
+        bool             exists;        // The switch had a parameter
+        bool             int_ok;        // The parameter is a valid int
+        bool             double_ok;     // The parameter is a valid double
+        std::string_view text;
+        int              i;
+        double           d;
+    };
+
+    // The valid switches
+    CSwitchTable<N> m_table;
+
+    // One entry per switch in the table
+    value_t m_value[N];
+
+    // The non-switch arguments
+    std::string_view m_arg[MAX_ARGS];
+    int     m_arg_count;
+
+    // Any error encountered during parse()
+    char    m_error[128];
 };
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse() - Parses the command line without allocating memory
+//
+// Passed: argc           = argc from main()
+//         argv           = argv from main()
+//         throw_on_error = If this is true, errors will be reported via throwing a runtime exception
+//                          instead of by returning true/false
+//
+// Returns: success status
+//          If return value is false, error string can be retrieved by calling "error()"
+//==========================================================================================================
+template <size_t N, size_t MAX_ARGS>
+bool CCmdTable<N, MAX_ARGS>::parse(int argc, char** argv, bool throw_on_error)
+{
+    char* end;
+
+    // Clear any existing command line data we have
+    for (auto& value : m_value) value.present = false;
+    m_arg_count = 0;
+    m_error[0]  = 0;
+
+    // Loop through every token on the command line...
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* token = argv[i];
+
+        // If this token isn't a switch, just append it to the list of non-switch arguments
+        if (token[0] != '-')
+        {
+            if (m_arg_count == (int)MAX_ARGS) return fail(throw_on_error, "too many arguments at '%s'", token);
+            m_arg[m_arg_count++] = token;
+            continue;
+        }
+
+        // Is this switch in our table of valid switches?
+        int index = m_table.find(token + 1);
+
+        // If it's not a valid command-line switch for this program, complain to the user
+        if (index < 0) return fail(throw_on_error, "'%s' is not a valid switch", token);
+
+        // Is the parameter for this switch optional, required, or none?
+        clp_t swtype = m_table.type(index);
+
+        // Find out if the user supplied a switch parameter
+        bool has_param = (i + 1 < argc && argv[i+1][0] != '-');
+
+        // If this switch doesn't have a parameter and it was supposed to, complain to the user
+        if (!has_param && swtype == CLP_REQUIRED)
+        {
+            return fail(throw_on_error, "switch '%s' requires a parameter", token);
+        }
+
+        // Record the switch
+        value_t& value  = m_value[index];
+        value.present   = true;
+        value.exists    = has_param && swtype != CLP_NONE;
+        value.int_ok    = false;
+        value.double_ok = false;
+        value.text      = std::string_view();
+
+        // If there's no parameter, we're done with this switch
+        if (!value.exists) continue;
+
+        // Fetch the parameter
+        const char* param = argv[++i];
+        value.text = param;
+
+        // Decode it as an integer (in any base that strtol() accepts)
+        errno = 0;
+        long n = strtol(param, &end, 0);
+        value.int_ok = (*param && *end == 0 && errno == 0 && n >= INT32_MIN && n <= INT32_MAX);
+        value.i      = (int)n;
+
+        // And as a floating-point value
+        value.d         = strtod(param, &end);
+        value.double_ok = (*param && *end == 0);
+    }
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// fail() - Records an error message, then either throws it or returns 'false'
+//==========================================================================================================
+template <size_t N, size_t MAX_ARGS>
+bool CCmdTable<N, MAX_ARGS>::fail(bool throw_on_error, const char* fmt, const char* token)
+{
+    snprintf(m_error, sizeof m_error, fmt, token);
+    if (throw_on_error) throw std::runtime_error(m_error);
+    return false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// has_switch() - Returns 'true' if the switch with the specified index was on the command line
+//==========================================================================================================
+template <size_t N, size_t MAX_ARGS>
+bool CCmdTable<N, MAX_ARGS>::has_switch(int index, std::string_view* param) const
+{
+    if (index < 0 || !m_value[index].present) return false;
+    if (param && m_value[index].exists) *param = m_value[index].text;
+    return true;
+}
+//==========================================================================================================
+
+template <size_t N, size_t MAX_ARGS>
+bool CCmdTable<N, MAX_ARGS>::has_switch(int index, int* param) const
+{
+    if (index < 0 || !m_value[index].present) return false;
+    if (m_value[index].int_ok) *param = m_value[index].i;
+    return true;
+}
+//==========================================================================================================
+
+template <size_t N, size_t MAX_ARGS>
+bool CCmdTable<N, MAX_ARGS>::has_switch(int index, double* param) const
+{
+    if (index < 0 || !m_value[index].present) return false;
+    if (m_value[index].double_ok) *param = m_value[index].d;
+    return true;
+}
+//==========================================================================================================
@@ -3,7 +3,14 @@
 //==========================================================================================================
 #include <fstream>
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <thread>
+#include <atomic>
+#include <sys/stat.h>
+#include <algorithm>
 #include "config_file.h"
+#include "event.h"
 using namespace std;
 
 
@@ -97,8 +104,8 @@ static string parse_to_delimeter(const char* in, char delimeter)
         // Convert the character to lower-case
         if (c >= 'A' && c <= 'Z') c |= 32;
 
-        // Append the character to the output string
-        *out++ = c;
+        // Append the character to the output string, if there's room
+        if (out < token + sizeof token - 1) *out++ = c;
     }
 
 
@@ -112,15 +119,14 @@ static string parse_to_delimeter(const char* in, char delimeter)
 
 
 //==========================================================================================================
-// parse_tokens() - Parses an input string into a vector of tokens
+// for_each_token() - Parses an input string into tokens, and calls 'handler(text, length)' for each one
 //==========================================================================================================
-static vector<string> parse_tokens(const char* in)
+template <class F> static void for_each_token(const char* in, F handler)
 {
-    vector<string> result;
-    char           token[512];
+    char token[512];
 
-    // If we weren't given an input string, return an empty result;
-    if (in == nullptr) return result;
+    // If we weren't given an input string, there are no tokens
+    if (in == nullptr) return;
 
     // So long as there are input characters still to be processed...
     while (*in)
@@ -157,15 +163,16 @@ static vector<string> parse_tokens(const char* in)
             // Otherwise, we're not parsing a quoted string. A space or comma ends the token
             else if (*in == ' ' || *in == ',') break;
 
-            // Append this character to the token buffer
-            *out++ = *in++;
+            // Append this character to the token buffer, if there's room
+            if (out < token + sizeof token - 1) *out++ = *in;
+            ++in;
         }
 
         // nul-terminate the token string
         *out = 0;
 
-        // Add the token to our result list
-        result.push_back(token);
+        // Hand the token to the caller
+        handler(token, out - token);
 
         // Skip over any trailing spaces in the input
         while (*in == ' ') ++in;
@@ -173,26 +180,463 @@ static vector<string> parse_tokens(const char* in)
         // If there is a trailing comma, throw it away
         if (*in == ',') ++in;
     }
+}
+//==========================================================================================================
+
 
-    // Hand the caller a vector of tokens
+//==========================================================================================================
+// parse_tokens() - Parses an input string into a vector of tokens
+//==========================================================================================================
+static vector<string> parse_tokens(const char* in)
+{
+    vector<string> result;
+    for_each_token(in, [&](const char* token, size_t length) {result.emplace_back(token, length);});
     return result;
 }
 //==========================================================================================================
 
 
+//==========================================================================================================
+// clear() - Discards every spec in the store
+//==========================================================================================================
+void CConfigStore::clear()
+{
+    m_text.clear();
+    m_values.clear();
+    m_specs.clear();
+    m_index.assign(64, -1);
+    m_recording = false;
+    m_text_mark = 0;
+    m_garbage   = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// hash() - FNV-1a hash of a key
+//==========================================================================================================
+uint32_t CConfigStore::hash(const char* key, size_t length)
+{
+    uint32_t h = 2166136261u;
+    while (length--) {h ^= (uint8_t)*key++; h *= 16777619u;}
+    return h;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// store() - Appends text to the arena and returns a view of it
+//==========================================================================================================
+CConfigStore::span_t CConfigStore::store(const char* text, size_t length)
+{
+    span_t span = {(uint32_t)m_text.size(), (uint32_t)length};
+    m_text.insert(m_text.end(), text, text + length);
+    return span;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// slot() - Returns the index slot that holds the specified key, or the empty slot where it belongs
+//==========================================================================================================
+size_t CConfigStore::slot(const char* key, size_t length, uint32_t hash) const
+{
+    size_t mask = m_index.size() - 1;
+
+    // Linear probing: walk forward from the home slot until we find the key or an empty slot
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        int32_t index = m_index[i];
+        if (index < 0) return i;
+        const spec_t& spec = m_specs[index];
+        if (spec.hash == hash && spec.key.length == length
+            && memcmp(m_text.data() + spec.key.offset, key, length) == 0) return i;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// grow_index() - Doubles the size of the hash index and re-inserts every spec
+//==========================================================================================================
+void CConfigStore::grow_index()
+{
+    m_index.assign(m_index.size() * 2, -1);
+    size_t mask = m_index.size() - 1;
+
+    for (size_t n = 0; n < m_specs.size(); ++n)
+    {
+        size_t i = m_specs[n].hash & mask;
+        while (m_index[i] >= 0) i = (i + 1) & mask;
+        m_index[i] = n;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// find() - Returns the index of the spec with the specified key, or -1 if there isn't one
+//==========================================================================================================
+int CConfigStore::find(const char* key, size_t length) const
+{
+    return m_index[slot(key, length, hash(key, length))];
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// begin() - Starts recording a spec
+//==========================================================================================================
+void CConfigStore::begin(const char* key, size_t length)
+{
+    // If a spec was being recorded and never committed, throw it away
+    if (m_recording)
+    {
+        m_values.resize(m_pending.first_value);
+        m_text.resize(m_text_mark);
+    }
+
+    // Remember where this spec starts, so it can be thrown away
+    m_text_mark = m_text.size();
+    m_recording = true;
+
+    // The values will follow any values already stored
+    m_pending.key         = store(key, length);
+    m_pending.hash        = hash(key, length);
+    m_pending.first_value = m_values.size();
+    m_pending.value_count = 0;
+    m_pending.is_stream   = false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// add_value() - Adds a value to the spec being recorded
+//==========================================================================================================
+void CConfigStore::add_value(const char* text, size_t length)
+{
+    m_values.push_back(store(text, length));
+    ++m_pending.value_count;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// commit() - Makes the spec being recorded visible, replacing any existing spec with the same key
+//==========================================================================================================
+void CConfigStore::commit(bool is_stream)
+{
+    if (!m_recording) return;
+    m_recording = false;
+    m_pending.is_stream = is_stream;
+
+    // Is there already a spec with this key?
+    const char* key = m_text.data() + m_pending.key.offset;
+    size_t      i   = slot(key, m_pending.key.length, m_pending.hash);
+    int32_t     index = m_index[i];
+
+    // If there is, the new values replace the old ones, and the old text becomes garbage
+    if (index >= 0)
+    {
+        spec_t& spec = m_specs[index];
+        for (uint32_t n = 0; n < spec.value_count; ++n) m_garbage += m_values[spec.first_value + n].length;
+        m_garbage        += m_pending.key.length;
+        spec.first_value  = m_pending.first_value;
+        spec.value_count  = m_pending.value_count;
+        spec.is_stream    = m_pending.is_stream;
+    }
+
+    // Otherwise, this is a brand new spec
+    else
+    {
+        m_index[i] = m_specs.size();
+        m_specs.push_back(m_pending);
+        if (m_specs.size() * 2 > m_index.size()) grow_index();
+    }
+
+    // If most of the arena is garbage, get rid of it
+    if (m_garbage > 65536 && m_garbage > m_text.size() / 2) compact();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// compact() - Rebuilds the arena without the text of replaced specs
+//==========================================================================================================
+void CConfigStore::compact()
+{
+    CConfigStore fresh;
+    fresh.reserve(m_text.size() - m_garbage);
+    fresh.merge_from(*this);
+    std::swap(*this, fresh);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// put() - Stores a complete spec
+//==========================================================================================================
+void CConfigStore::put(const string& key, const vector<string>& values)
+{
+    begin(key.c_str(), key.size());
+    for (auto& value : values) add_value(value.c_str(), value.size());
+    commit();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// merge_from() - Copies every spec from another store, replacing specs that have the same key
+//==========================================================================================================
+void CConfigStore::merge_from(const CConfigStore& other)
+{
+    const char* text = other.m_text.data();
+
+    // Make room for all of the other store's text in one go
+    reserve(other.m_text.size() - other.m_garbage);
+
+    for (auto& spec : other.m_specs)
+    {
+        begin(text + spec.key.offset, spec.key.length);
+        for (uint32_t n = 0; n < spec.value_count; ++n)
+        {
+            const span_t& value = other.m_values[spec.first_value + n];
+            add_value(text + value.offset, value.length);
+        }
+        commit(spec.is_stream);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// value_hash() - Returns a 64-bit FNV-1a hash of the values of a spec.  Each value's length is hashed
+//                along with its text, so {"a b"} and {"a", "b"} hash differently
+//==========================================================================================================
+uint64_t CConfigStore::value_hash(int index) const
+{
+    uint64_t h = 14695981039346656037ull;
+
+    // A spec that doesn't exist hashes like no spec at all
+    if (index < 0) return 0;
 
+    const spec_t& spec = m_specs[index];
+    for (uint32_t n = 0; n < spec.value_count; ++n)
+    {
+        const span_t&  value = m_values[spec.first_value + n];
+        const uint8_t* p     = (const uint8_t*)m_text.data() + value.offset;
+        for (uint32_t i = 0; i < 4; ++i) {h ^= (value.length >> (i * 8)) & 0xFF; h *= 1099511628211ull;}
+        for (uint32_t i = 0; i < value.length; ++i) {h ^= p[i]; h *= 1099511628211ull;}
+    }
+
+    return h;
+}
 //==========================================================================================================
-// Call this to read the config file.  Returns 'true' on success, 'false' if file not found
+
+
+//==========================================================================================================
+// key() - Returns the key of the spec with the specified index
+//==========================================================================================================
+string CConfigStore::key(int index) const
+{
+    const span_t& key = m_specs[index].key;
+    return string(m_text.data() + key.offset, key.length);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// values() - Fetches the values of the spec with the specified index
+//==========================================================================================================
+void CConfigStore::values(int index, vector<string>* p_values) const
+{
+    const spec_t& spec = m_specs[index];
+    p_values->clear();
+    p_values->reserve(spec.value_count);
+    for (uint32_t n = 0; n < spec.value_count; ++n)
+    {
+        const span_t& value = m_values[spec.first_value + n];
+        p_values->emplace_back(m_text.data() + value.offset, value.length);
+    }
+}
+//==========================================================================================================
+
+
+
+//==========================================================================================================
+// Call this to read the config file.  Returns 'true' on success, 'false' if file not found or a bound
+// struct is missing a required key
 //
 // On Exit: m_specs = a container that maps a key-string to a vector of strings.
 //                    That vector of strings is either individual tokens, or in the case of a script
 //                    spec is a vector of untokenized lines
 //==========================================================================================================
 bool CConfigFile::read(string filename, bool msg_on_fail)
+{
+    // Remember this file for reload()
+    remember_file(filename);
+
+    // Parse the file straight into our specs
+    if (!parse_file(filename, m_specs, m_stream_scripts))
+    {
+        if (msg_on_fail) printf("Failed to open file \"%s\"\n", filename.c_str());
+        return false;
+    }
+
+    // Overrides take precedence over anything in the file
+    for (auto& entry : m_overrides) m_specs.put(entry.first, entry.second);
+
+    // Fill in the bound structs, then tell the subscribers what changed
+    bool bound = run_bindings();
+    notify_changes();
+
+    // Tell the caller whether every bound struct got its required keys
+    return bound;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// read() - Reads many config files in parallel
+//
+// Passed: filenames   = The files to read.  When a key appears in more than one file, the value in the
+//                       file that is later in this list wins, just as if the files were read one by one
+//         msg_on_fail = If true, a message is printed for each file that can't be opened
+//         threads     = The most threads to use.  0 = One per CPU
+//
+// Returns: 'true' if every file was read, 'false' if any of them couldn't be opened or a bound struct
+//          is missing a required key.  Every file that could be opened is merged in regardless
+//==========================================================================================================
+bool CConfigFile::read(const vector<string>& filenames, bool msg_on_fail, int threads)
+{
+    size_t file_count = filenames.size();
+    bool   result = true;
+
+    // Figure out how many threads to use
+    if (threads < 1) threads = thread::hardware_concurrency();
+    if ((size_t)threads > file_count) threads = file_count;
+
+    // Remember these files for reload()
+    for (auto& filename : filenames) remember_file(filename);
+
+    // This records which files could be opened
+    vector<char> file_ok(file_count, 0);
+
+    // With only one thread, merging separate spec stores would be pure overhead
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < file_count; ++i) file_ok[i] = parse_file(filenames[i], m_specs, m_stream_scripts);
+    }
+
+    // Otherwise, parse the files in parallel
+    else
+    {
+        // Each file is parsed into a spec store (and arena) of its own, so the threads never share anything
+        vector<CConfigStore> file_specs(file_count);
+
+        // This is the index of the next file that needs parsing
+        atomic<size_t> next_file(0);
+
+        // Each worker keeps grabbing the next file until they've all been parsed
+        auto worker = [&]()
+        {
+            size_t i;
+            while ((i = next_file.fetch_add(1)) < file_count)
+            {
+                file_ok[i] = parse_file(filenames[i], file_specs[i], m_stream_scripts);
+            }
+        };
+
+        // Start the workers.  The calling thread is one of them
+        vector<thread> pool;
+        for (int i = 1; i < threads; ++i) pool.emplace_back(worker);
+        worker();
+
+        // Wait for all of the workers to finish
+        for (auto& t : pool) t.join();
+
+        // Merge the results in the order the files were listed, so later files win
+        for (auto& specs : file_specs) m_specs.merge_from(specs);
+    }
+
+    // Complain about any files that couldn't be opened
+    for (size_t i = 0; i < file_count; ++i) if (!file_ok[i])
+    {
+        if (msg_on_fail) printf("Failed to open file \"%s\"\n", filenames[i].c_str());
+        result = false;
+    }
+
+    // Overrides take precedence over anything in the files
+    for (auto& entry : m_overrides) m_specs.put(entry.first, entry.second);
+
+    // Fill in the bound structs, then tell the subscribers what changed
+    if (!run_bindings()) result = false;
+    notify_changes();
+
+    // Tell the caller whether every file was read and every bound struct got its required keys
+    return result;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// remember_file() - Records a file for reload().  A file that's read again moves to the end of the list,
+//                   so reload() reads the files in the order they were last read, and the same file wins
+//==========================================================================================================
+void CConfigFile::remember_file(const string& filename)
+{
+    auto it = find(m_files.begin(), m_files.end(), filename);
+    if (it != m_files.end()) m_files.erase(it);
+    m_files.push_back(filename);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// reload() - Discards every spec and reads every file that has been read so far, again
+//
+// Passed: msg_on_fail = If true, a message is printed for each file that can't be opened
+//         threads     = The most threads to use.  0 = One per CPU
+//
+// Returns: 'true' if every file was read and every bound struct got its required keys
+//==========================================================================================================
+bool CConfigFile::reload(bool msg_on_fail, int threads)
+{
+    // A copy, since read() looks at m_files
+    vector<string> files = m_files;
+
+    // Throw away everything we have.  Overrides are re-applied by read()
+    m_specs.clear();
+
+    // And read all of the files again
+    return read(files, msg_on_fail, threads);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse_file() - Parses a config file into a spec store
+//
+// Passed: filename       = The name of the file to parse
+//         specs          = The spec store to add the file's specs to
+//         stream_scripts = If true, script-specs are recorded as a byte range of the file rather than
+//                          as a list of lines
+//
+// Returns: 'true' on success, 'false' if file not found
+//
+// This touches nothing but 'specs', so it's safe to parse several files at once in different threads
+//==========================================================================================================
+bool CConfigFile::parse_file(const string& filename, CConfigStore& specs, bool stream_scripts)
 {
     char     line[1000];
-    strvec_t values;
-    string   base_key_name, scoped_key_name;
+    string   base_key_name, scoped_key_name, full_path;
+    struct   stat info;
+
+    // The file offsets of the current line, the next line, and the first line of the current script
+    uint64_t line_offset = 0, next_offset = 0, script_offset = 0;
+
+    // A hash of the text of the current streamed script, so an edited script counts as a changed value
+    uint64_t script_hash = 0;
     
     // We are not currently parsing a script
     bool in_script = false;
@@ -203,16 +647,36 @@ bool CConfigFile::read(string filename, bool msg_on_fail)
     // Open the input file
     ifstream input_file(filename);
 
-    // If the input file couldn't be opened, complain about it
-    if (!input_file.is_open())
+    // If the input file couldn't be opened, tell the caller
+    if (!input_file.is_open()) return false;
+
+    // The keys and values will take up about as much room as the file does.  When scripts are streamed,
+    // most of the file never goes into the arena, so we let it grow as needed
+    if (!stream_scripts && stat(filename.c_str(), &info) == 0) specs.reserve(info.st_size);
+
+    // Streamed scripts refer back to this file, so they need a name that works from any directory
+    if (stream_scripts)
     {
-        if (msg_on_fail) printf("Failed to open file \"%s\"\n", filename.c_str());
-        return false; 
-    }       
+        char* path = realpath(filename.c_str(), nullptr);
+        full_path  = path ? path : filename;
+        free(path);
+    }
 
     // Loop through every line of the input file...
     while (input_file.getline(line, sizeof line))
     {
+        // Keep track of where we are in the file
+        line_offset  = next_offset;
+        next_offset += input_file.gcount();
+
+        // If we're streaming a script, its text goes into the hash instead of into the arena
+        if (in_script && stream_scripts)
+        {
+            for (const char* c = line; *c; ++c) {script_hash ^= (uint8_t)*c; script_hash *= 1099511628211ull;}
+            script_hash ^= '\n';
+            script_hash *= 1099511628211ull;
+        }
+
         // Convert tabs to spaces and strip out end-of-line characters
         cleanup(line);
 
@@ -233,15 +697,33 @@ bool CConfigFile::read(string filename, bool msg_on_fail)
         // If this is the beginning of a script, we will start recording entire lines
         if (*p == '{')
         {
-            values.clear();
-            in_script = true;
+            if (!scoped_key_name.empty() && !stream_scripts) specs.begin(scoped_key_name.c_str(), scoped_key_name.size());
+            script_offset = next_offset;
+            script_hash   = 14695981039346656037ull;
+            in_script     = true;
             continue;
         }
 
         // If this is the end of a script, save the list of lines into our specs
         if (*p == '}')
         {
-            if (in_script && !scoped_key_name.empty()) m_specs[scoped_key_name] = values;
+            if (in_script && !scoped_key_name.empty())
+            {
+                // A streamed script is just the file, the range of it that the script occupies, and a hash
+                // of its text.  These are never handed out as values; see open_streamed_script()
+                if (stream_scripts)
+                {
+                    string start = to_string(script_offset), end = to_string(line_offset);
+                    string hash  = to_string(script_hash);
+                    specs.begin(scoped_key_name.c_str(), scoped_key_name.size());
+                    specs.add_value(full_path.c_str(), full_path.size());
+                    specs.add_value(start.c_str(), start.size());
+                    specs.add_value(end.c_str(), end.size());
+                    specs.add_value(hash.c_str(), hash.size());
+                    specs.commit(true);
+                }
+                else specs.commit();
+            }
             in_script = false;
             continue;            
         }
@@ -249,7 +731,7 @@ bool CConfigFile::read(string filename, bool msg_on_fail)
         // If we're parsing a script, just save the line
         if (in_script)
         {
-            values.push_back(p);
+            if (!scoped_key_name.empty() && !stream_scripts) specs.add_value(p, strlen(p));
             continue;
         }
 
@@ -257,20 +739,19 @@ bool CConfigFile::read(string filename, bool msg_on_fail)
         base_key_name = parse_to_delimeter(p, '=');
 
         // Create the fully scoped name of this key
-        scoped_key_name = parsing_section + "::" + base_key_name;
+        scoped_key_name.assign(parsing_section).append("::").append(base_key_name);
 
-        // We start out without a list of values for this key
-        values.clear();
+        // Start a spec for this key.  It starts out without any values
+        specs.begin(scoped_key_name.c_str(), scoped_key_name.size());
 
         // Find the equal sign on this line
         p = strchr(p, '=');
 
-        // If it exists, parse the rest of the line after an '=' into a vector of string tokens    
-        if (p) values = parse_tokens(p+1);
+        // If it exists, parse the rest of the line after an '=' into tokens, straight into the arena
+        if (p) for_each_token(p+1, [&](const char* token, size_t length) {specs.add_value(token, length);});
 
         // Add this configuration spec to our master list of config specs
-        m_specs[scoped_key_name] = values;
-       
+        specs.commit();
     }
 
     // Tell the caller that all is well
@@ -279,6 +760,279 @@ bool CConfigFile::read(string filename, bool msg_on_fail)
 //==========================================================================================================
 
 
+//==========================================================================================================
+// set() - Overrides the value of a key without reading or parsing the config file again
+//
+// Passed: assignment = "section::key = values", using the same syntax as a line in the config file.
+//                      If there is no "section::", the key is in the global section
+//
+// Returns: 'false' if there is no '=' or no key name, or if a bound struct is missing a required key,
+//          otherwise 'true'
+//==========================================================================================================
+bool CConfigFile::set(string assignment)
+{
+    string section;
+
+    // Find the equal sign
+    size_t equal_sign = assignment.find('=');
+
+    // If there isn't one, this isn't an assignment
+    if (equal_sign == string::npos) return false;
+
+    // Fetch everything in front of the equal sign
+    string key = assignment.substr(0, equal_sign);
+
+    // If the key is fully scoped, split off the section name
+    size_t colons = key.find("::");
+    if (colons != string::npos)
+    {
+        section = parse_to_delimeter(key.c_str(), ':');
+        key.erase(0, colons + 2);
+    }
+
+    // Fetch the lower-case name of the key
+    key = parse_to_delimeter(key.c_str(), '=');
+
+    // A key has to have a name
+    if (key.empty()) return false;
+
+    // Create the fully scoped name of this key
+    string scoped_key_name = section + "::" + key;
+
+    // Parse the values exactly the way read() would
+    strvec_t values = parse_tokens(assignment.c_str() + equal_sign + 1);
+
+    // Record the override, and apply it to the specs we already have
+    m_overrides[scoped_key_name] = values;
+    m_specs.put(scoped_key_name, values);
+
+    // Fill in the bound structs, then tell the subscribers if this key changed
+    bool bound = run_bindings();
+    notify_changes(&scoped_key_name);
+
+    // Tell the caller whether every bound struct got its required keys
+    return bound;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// run_bindings() - Fills in every struct that was bound with bind()
+//
+// Returns: 'false' if any of the structs is missing a required key.  The others are still filled in
+//==========================================================================================================
+bool CConfigFile::run_bindings()
+{
+    m_bindings_ok = true;
+    for (auto& binding : m_bindings) if (!binding(*this)) m_bindings_ok = false;
+    return m_bindings_ok;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// subscribe() - Subscribes to changes of a single key or of every key in a section
+//
+// Returns: A subscription ID for use with unsubscribe()
+//==========================================================================================================
+int CConfigFile::subscribe(string key, change_cb_t callback)
+{
+    return add_subscription(key, false, callback, nullptr);
+}
+
+int CConfigFile::subscribe(string key, CEvent* p_event)
+{
+    return add_subscription(key, false, nullptr, p_event);
+}
+
+int CConfigFile::subscribe_section(string section, change_cb_t callback)
+{
+    return add_subscription(section, true, callback, nullptr);
+}
+
+int CConfigFile::subscribe_section(string section, CEvent* p_event)
+{
+    return add_subscription(section, true, nullptr, p_event);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// add_subscription() - Records a subscription to a key or to a section
+//
+// Passed: name       = A key name, or a section name
+//         is_section = true if 'name' is a section name
+//         callback   = The callback to call when something changes, or nullptr
+//         p_event    = The event to set when something changes, or nullptr
+//
+// Returns: A subscription ID
+//==========================================================================================================
+int CConfigFile::add_subscription(string name, bool is_section, change_cb_t callback, CEvent* p_event)
+{
+    // Names are stored in lower-case, like the keys they match
+    make_lower(name);
+
+    // A key without a section is in the global section
+    if (!is_section && name.find("::") == string::npos) name = "::" + name;
+
+    // Record the subscription
+    int id = m_next_subscription_id++;
+    m_subscriptions[id] = {name, is_section, callback, p_event};
+
+    // And index it by name
+    if (is_section)
+        m_section_subs.emplace(name, id);
+    else
+        m_key_subs.emplace(name, id);
+
+    // Start keeping track of values, so the first notification only reports real changes
+    if (m_subscriptions.size() == 1) take_snapshot();
+
+    // Hand the caller the subscription ID
+    return id;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// unsubscribe() - Cancels a subscription
+//==========================================================================================================
+void CConfigFile::unsubscribe(int id)
+{
+    // Find the subscription
+    auto it = m_subscriptions.find(id);
+    if (it == m_subscriptions.end()) return;
+
+    // Remove it from the index
+    auto& index = it->second.is_section ? m_section_subs : m_key_subs;
+    auto  range = index.equal_range(it->second.name);
+    for (auto entry = range.first; entry != range.second; ++entry)
+    {
+        if (entry->second == id) {index.erase(entry); break;}
+    }
+
+    // And forget about it
+    m_subscriptions.erase(it);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// take_snapshot() - Records the hash of every key's values, without notifying anyone
+//==========================================================================================================
+void CConfigFile::take_snapshot()
+{
+    m_snapshot.clear();
+    ++m_generation;
+    for (int i = 0; i < m_specs.size(); ++i)
+    {
+        m_snapshot[m_specs.key(i)] = {m_specs.value_hash(i), m_generation};
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// notify_changes() - Compares the hash of each key's values to the last time we looked, and notifies
+//                    the subscribers of every key that changed, appeared, or disappeared
+//
+// Passed: p_only_key = If not null, only this fully scoped key is checked
+//==========================================================================================================
+void CConfigFile::notify_changes(const string* p_only_key)
+{
+    vector<string>  changed;
+    vector<CEvent*> events;
+
+    // If nobody is listening, there's no need to keep track of anything
+    if (m_subscriptions.empty())
+    {
+        m_snapshot.clear();
+        return;
+    }
+
+    // If we're only checking a single key, just compare its hash to the one we saw last
+    if (p_only_key)
+    {
+        uint64_t hash = m_specs.value_hash(m_specs.find(*p_only_key));
+        auto     it   = m_snapshot.find(*p_only_key);
+        if (it == m_snapshot.end() || it->second.hash != hash)
+        {
+            m_snapshot[*p_only_key] = {hash, m_generation};
+            changed.push_back(*p_only_key);
+        }
+    }
+
+    // Otherwise, check every key
+    else
+    {
+        ++m_generation;
+
+        // Find the keys that are new or have new values
+        for (int i = 0; i < m_specs.size(); ++i)
+        {
+            string   key  = m_specs.key(i);
+            uint64_t hash = m_specs.value_hash(i);
+            auto     it   = m_snapshot.find(key);
+            if (it == m_snapshot.end())
+            {
+                m_snapshot[key] = {hash, m_generation};
+                changed.push_back(key);
+            }
+            else
+            {
+                if (it->second.hash != hash) changed.push_back(key);
+                it->second = {hash, m_generation};
+            }
+        }
+
+        // Any key we didn't see this time has disappeared
+        for (auto it = m_snapshot.begin(); it != m_snapshot.end();)
+        {
+            if (it->second.generation == m_generation) {++it; continue;}
+            changed.push_back(it->first);
+            it = m_snapshot.erase(it);
+        }
+    }
+
+    // Notify the subscribers of each key that changed
+    for (auto& key : changed) notify_key(key, events);
+
+    // Each subscribed event is set once, no matter how many of its keys changed
+    sort(events.begin(), events.end());
+    events.erase(unique(events.begin(), events.end()), events.end());
+    for (auto p_event : events) p_event->set();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// notify_key() - Calls the callbacks of everyone who subscribed to a key or its section.  Subscribed
+//                events are added to 'events' so that the caller can set each of them once
+//==========================================================================================================
+void CConfigFile::notify_key(const string& key, vector<CEvent*>& events)
+{
+    vector<int> ids;
+
+    // Find the subscriptions to this key
+    auto range = m_key_subs.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) ids.push_back(it->second);
+
+    // And the subscriptions to its section
+    range = m_section_subs.equal_range(key.substr(0, key.find("::")));
+    for (auto it = range.first; it != range.second; ++it) ids.push_back(it->second);
+
+    // Notify each subscriber.  A callback may unsubscribe, so look each one up as we go
+    for (int id : ids)
+    {
+        auto it = m_subscriptions.find(id);
+        if (it == m_subscriptions.end()) continue;
+        if (it->second.p_event) events.push_back(it->second.p_event);
+        if (it->second.callback) it->second.callback(key);
+    }
+}
+//==========================================================================================================
+
+
 //==========================================================================================================
 // set_current_section() - Sets the section-name to look for keys in
 //==========================================================================================================
@@ -295,14 +1049,25 @@ void  CConfigFile::set_current_section(string section)
 //==========================================================================================================
 void CConfigFile::dump_specs()
 {
-    // Loop through every entry in our map....
-    for (auto& entry : m_specs)
+    strvec_t values;
+
+    // Loop through every entry in our store....
+    for (int i = 0; i < m_specs.size(); ++i)
     {
         // Display this item's key
-        printf("Key \"%s\"\n", entry.first.c_str());
-        
+        printf("Key \"%s\"\n", m_specs.key(i).c_str());
+
+        // A streamed script is displayed as where it lives, rather than reading the whole thing in
+        m_specs.values(i, &values);
+        if (m_specs.is_stream(i))
+        {
+            printf("   <streamed script, bytes %s-%s of \"%s\">\n",
+                   values[1].c_str(), values[2].c_str(), values[0].c_str());
+            continue;
+        }
+
         // Display every value associated with this item
-        for (auto& value  : entry.second) printf("   \"%s\"\n", value.c_str());
+        for (auto& value  : values) printf("   \"%s\"\n", value.c_str());
     }
 }
 //==========================================================================================================
@@ -322,61 +1087,86 @@ void CConfigFile::dump_specs()
 //==========================================================================================================
 bool CConfigFile::lookup(string key, strvec_t *p_result)
 {
-    // An iterator to our specs-map
-    auto it = m_specs.begin();
-
-    // Convert the key to lower-case
-    make_lower(key);
-
     // If the caller gave us a pointer to a result vector, clear it
     if (p_result) p_result->clear();
 
-    // If the caller gave us a fully-scoped name...
-    if (key.find("::") != string::npos)
-    {
-        // Do we have a key by that name?
-        it = m_specs.find(key);
-        
-        // If we have the specified key...
-        if (it != m_specs.end())
-        {
-            // If the caller wants the associate values, hand them to him
-            if (p_result) *p_result = it->second;
-        
-            // Tell the caller that his key existed
-            return true;
-        }
+    // Find the spec.  A missing key is only an error if the caller wants its values
+    int index = find_spec(key, p_result != nullptr);
 
-        // If we get here, the key wasn't found in our map
-        if (p_result && m_throw_on_fail) throw runtime_error("config key '"+key+"' not found");
-        return false;
-    }
+    // If there's no such key, tell the caller
+    if (index < 0) return false;
 
-    // Does the current section have a key by that name?
-    it = m_specs.find(m_current_section + "::" + key);
-        
-    // If that fully-scoped key exists, tell the caller
-    if (it != m_specs.end())
+    // If the caller wants the associated values, hand them over.  A streamed script's values are the
+    // lines of the script, just as if it hadn't been streamed
+    if (p_result && m_specs.is_stream(index))
     {
-        if (p_result) *p_result = it->second;
-        return true;
+        CConfigScript script;
+        string        text;
+        if (!open_streamed_script(index, &script)) return true;
+        while (script.get_next_line(nullptr, &text)) p_result->push_back(text);
     }
+    else if (p_result) m_specs.values(index, p_result);
+
+    // Tell the caller that the key exists
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// open_streamed_script() - Points a script at the file and byte range recorded for a streamed script
+//
+// Passed: index    = The index of a streamed spec in m_specs
+//         p_script = The script to open
+//
+// Returns: 'false' if the file can't be opened
+//==========================================================================================================
+bool CConfigFile::open_streamed_script(int index, CConfigScript* p_script)
+{
+    strvec_t descriptor;
+
+    // The values of a streamed spec are the filename, the start and end offsets, and a hash of the text
+    m_specs.values(index, &descriptor);
+
+    // And open the stream
+    return p_script->open_stream(descriptor[0], stoull(descriptor[1]), stoull(descriptor[2]));
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// find_spec() - Finds the index of a spec in m_specs
+//
+// Passed: key              = Key to look up.   Can optionally be fully scoped
+//         throw_if_missing = If true, and m_throw_on_fail is true, a missing key throws runtime_error
+//
+// Returns: The index of the spec, or -1 if it doesn't exist
+//
+// An unscoped key is looked for in the current section first, then in the global section
+//==========================================================================================================
+int CConfigFile::find_spec(string key, bool throw_if_missing)
+{
+    int index;
+
+    // Convert the key to lower-case
+    make_lower(key);
 
-    // Does the global section have a key by that name?
-    it = m_specs.find("::" + key);
-        
-    // If that globally-scoped key exists, tell the caller
-    if (it != m_specs.end())
+    // If the caller gave us a fully-scoped name, look for exactly that
+    if (key.find("::") != string::npos)
+        index = m_specs.find(key);
+
+    // Otherwise, look in the current section, then in the global section
+    else
     {
-        if (p_result) *p_result = it->second;
-        return true;
+        index = m_specs.find(m_current_section + "::" + key);
+        if (index < 0) index = m_specs.find("::" + key);
     }
 
-    // If we get here, we couldn't find that key in our specs
-    if (p_result && m_throw_on_fail) throw runtime_error("config key '"+key+"' not found");
+    // If we couldn't find that key in our specs, complain if we're supposed to
+    if (index < 0 && throw_if_missing && m_throw_on_fail) throw runtime_error("config key '"+key+"' not found");
 
-    // Tell the caller that we couldn't find that key in our specs
-    return false;
+    // Hand the caller the index of the spec
+    return index;
 }
 //==========================================================================================================
 
@@ -600,11 +1390,18 @@ bool CConfigFile::get(string key, CConfigScript* p_script)
     // Make the caller's script empty for the moment
     p_script->make_empty();
 
-    // Fetch the values assocated with this key
-    if (!lookup(key, &script_lines)) return false;
+    // Find the script
+    int index = find_spec(key, true);
+    if (index < 0) return false;
 
-    // Fill in the caller's script
-    *p_script = script_lines;
+    // A streamed script reads its lines from the file on demand
+    if (m_specs.is_stream(index)) return open_streamed_script(index, p_script);
+
+    // Otherwise, fetch the lines
+    m_specs.values(index, &script_lines);
+
+    // Otherwise, hand the caller's script the lines
+    *p_script = move(script_lines);
 
     // Tell the caller that all is well
     return true;
@@ -620,7 +1417,10 @@ void CConfigScript::make_empty()
 {
     m_script.clear();
     m_tokens.clear();
+    m_stream.reset();
+    m_stream_start = m_stream_end = 0;
     m_line_index = m_token_index = 0;
+    rewind();
 }
 //==========================================================================================================
 
@@ -632,6 +1432,42 @@ void CConfigScript::make_empty()
 //==========================================================================================================
 bool CConfigScript::get_next_line(int *p_token_count, string *p_text)
 {
+    // If we're streaming, fetch the next line from the file
+    if (m_stream)
+    {
+        while (read_stream_line(m_line))
+        {
+            // Convert tabs to spaces and strip out end-of-line characters
+            cleanup(&m_line[0]);
+
+            // Find the first non-space character in the line
+            const char* p = m_line.c_str();
+            while (*p == ' ') ++p;
+
+            // Skip the same lines that read() would have: blanks, comments, and section names
+            if (*p == 0 || *p == '#' || (p[0] == '/' && p[1] == '/') || *p == '[') continue;
+
+            // If the caller wants the script line, fill in the caller's field
+            if (p_text) *p_text = p;
+
+            // Parse this line into tokens
+            m_tokens = parse_tokens(p);
+
+            // If the caller wants to know how many tokens there are, fill in their field
+            if (p_token_count) *p_token_count = m_tokens.size();
+
+            // The next call to "get_next_<token|int|float>" will start at the first token
+            m_token_index = 0;
+
+            // Tell the caller that their script line is available
+            return true;
+        }
+
+        // If we get here, we're out of script lines
+        if (p_text) *p_text = "";
+        return false;
+    }
+
     // If we're out of script lines, tell the caller
     if (m_line_index >= m_script.size())
     {
@@ -657,6 +1493,89 @@ bool CConfigScript::get_next_line(int *p_token_count, string *p_text)
 //==========================================================================================================
 
 
+//==========================================================================================================
+// open_stream() - Makes the script stream its lines from a byte range of a file
+//
+// Passed: filename = The config file that contains the script
+//         start    = The file offset of the first line of the script
+//         end      = The file offset just past the last line of the script
+//
+// Returns: 'true' if the file could be opened
+//==========================================================================================================
+bool CConfigScript::open_stream(const string& filename, uint64_t start, uint64_t end)
+{
+    // Throw away whatever was in the script
+    make_empty();
+
+    // Open the file
+    FILE* fp = fopen(filename.c_str(), "r");
+    if (fp == nullptr) return false;
+
+    // Copies of this script will share the file
+    m_stream = shared_ptr<FILE>(fp, fclose);
+
+    // Record where the script is in the file
+    m_stream_start = start;
+    m_stream_end   = end;
+
+    // A small buffer is all we ever need, no matter how big the script is
+    m_buffer.resize(65536);
+
+    // Start at the top of the script
+    rewind();
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// read_stream_line() - Fetches the next line of a streamed script, without the end-of-line character
+//
+// Returns: 'false' when there are no more lines in the script
+//==========================================================================================================
+bool CConfigScript::read_stream_line(string& line)
+{
+    line.clear();
+
+    // Keep going until we find the end of the line or the end of the script
+    while (m_stream_pos < m_stream_end)
+    {
+        // If we've used up the buffer, refill it.  pread() means copies of this script sharing the file
+        // don't disturb each other
+        if (m_buffer_pos == m_buffer_len)
+        {
+            size_t  want = min((uint64_t)m_buffer.size(), m_stream_end - m_stream_pos);
+            ssize_t got  = pread(fileno(m_stream.get()), m_buffer.data(), want, m_stream_pos);
+            if (got <= 0)
+            {
+                m_stream_pos = m_stream_end;
+                break;
+            }
+            m_buffer_pos = 0;
+            m_buffer_len = got;
+        }
+
+        // Look for the end of the line in what's left of the buffer
+        const char* start = m_buffer.data() + m_buffer_pos;
+        size_t      avail = m_buffer_len - m_buffer_pos;
+        const char* eol   = (const char*)memchr(start, '\n', avail);
+        size_t      used  = eol ? (eol - start) + 1 : avail;
+
+        // Append this piece of the line, and move past it
+        line.append(start, eol ? used - 1 : used);
+        m_buffer_pos += used;
+        m_stream_pos += used;
+
+        // If we found the end of the line, we're done
+        if (eol) return true;
+    }
+
+    // We're at the end of the script.  A final line without a line-feed still counts
+    return !line.empty();
+}
+//==========================================================================================================
+
+
 //==========================================================================================================
 // get_next_token() - Fetches the next token from the current line
 //==========================================================================================================
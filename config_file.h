@@ -6,18 +6,28 @@
 #include <vector>
 #include <stdexcept>
 #include <map>
+#include <memory>
+#include <unordered_map>
+#include <tuple>
+#include <functional>
+#include <cstdint>
+#include <cstdio>
 
 
 
 //----------------------------------------------------------------------------------------------------------
 // CConfigScript() - Provides a convenient interface for parsing script-specs in a config-file
+//
+// A script either holds its lines in memory, or (when CConfigFile::stream_scripts() is on) streams them
+// from its range of the config file through a small buffer, so memory stays flat no matter how long
+// the script is.  The interface is the same either way.
 //----------------------------------------------------------------------------------------------------------
 class CConfigScript
 {
 public:
 
     // After reset "get_next_line()" fetches the first line of the script
-    void        rewind() {m_line_index = 0;}
+    void        rewind() {m_line_index = 0; m_stream_pos = m_stream_start; m_buffer_pos = m_buffer_len = 0;}
 
     // Call this to begin processing the next line of the script
     bool        get_next_line(int *p_token_count = nullptr, std::string *p_text = nullptr);
@@ -30,18 +40,196 @@ public:
     void        make_empty();
 
     // Overloading the '=' operator so we can assign a string vector
-    void        operator=(const std::vector<std::string> rhs) {m_script = rhs; rewind();}
+    void        operator=(std::vector<std::string> rhs) {m_script = std::move(rhs); m_stream.reset(); rewind();}
+
+    // Call this to stream the script from the byte range [start, end) of a file instead of from memory
+    bool        open_stream(const std::string& filename, uint64_t start, uint64_t end);
 
 protected:
 
+    // Fetches the next raw line from the stream.  Returns 'false' at the end of the script
+    bool        read_stream_line(std::string& line);
+
     // This is index of the next line to be fetched via "get_next_line()"
-    int         m_line_index;
+    int         m_line_index = 0;
 
     // This is the index of the next token to be fetched
-    int         m_token_index;
+    int         m_token_index = 0;
 
     // These are the lines of the script
     std::vector<std::string> m_script, m_tokens;
+
+    // When streaming, this is the file.  Copies of the script share it, but each has its own position
+    std::shared_ptr<FILE> m_stream;
+
+    // The byte range of the script within the file, and the offset of the next unread byte
+    uint64_t    m_stream_start = 0, m_stream_end = 0, m_stream_pos = 0;
+
+    // The read buffer, and the next unread byte and number of valid bytes in it
+    std::vector<char> m_buffer;
+    size_t      m_buffer_pos = 0, m_buffer_len = 0;
+
+    // The line being streamed
+    std::string m_line;
+};
+//----------------------------------------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------------------------------------
+// CConfigStore - Holds the parsed specs of a config file.  Every key, value-token and script line is kept
+//                in a single growable text arena and is referred to by offset, so loading a config file
+//                costs a handful of allocations no matter how big it is, and destroying one is O(1).
+//                Keys are found via an open-addressing hash index.
+//----------------------------------------------------------------------------------------------------------
+class CConfigStore
+{
+public:
+
+    CConfigStore() {clear();}
+
+    // Call this to discard every spec
+    void        clear();
+
+    // Call this to pre-size the text arena, i.e. to the size of the file about to be parsed
+    void        reserve(size_t text_bytes) {m_text.reserve(m_text.size() + text_bytes);}
+
+    // Starts recording a spec.  Values added with add_value() belong to it until commit() makes it
+    // visible, replacing any existing spec with the same key.  Calling begin() again abandons a spec
+    // that wasn't committed.  A streamed script's values are its filename, byte range and text hash
+    void        begin(const char* key, size_t length);
+    void        add_value(const char* text, size_t length);
+    void        commit(bool is_stream = false);
+
+    // Stores a complete spec
+    void        put(const std::string& key, const std::vector<std::string>& values);
+
+    // Copies every spec from another store, replacing specs that have the same key
+    void        merge_from(const CConfigStore& other);
+
+    // Returns the index of the spec with the specified key, or -1 if there isn't one
+    int         find(const char* key, size_t length) const;
+    int         find(const std::string& key) const {return find(key.c_str(), key.size());}
+
+    // Returns the number of specs.  Specs are indexed 0 thru size()-1 in the order they were first stored
+    int         size() const {return m_specs.size();}
+
+    // Fetch the key and values of a spec
+    std::string key(int index) const;
+    int         value_count(int index) const {return m_specs[index].value_count;}
+    bool        is_stream(int index) const {return m_specs[index].is_stream;}
+    void        values(int index, std::vector<std::string>* p_values) const;
+
+    // Returns a hash of the values of a spec.  Two specs with the same values have the same hash
+    uint64_t    value_hash(int index) const;
+
+    // Returns the number of bytes in the text arena
+    size_t      text_size() const {return m_text.size();}
+
+protected:
+
+    // An offset/length view into the text arena
+    struct span_t {uint32_t offset, length;};
+
+    // A spec is a key and a run of consecutive entries in m_values
+    struct spec_t {span_t key; uint32_t hash, first_value, value_count; bool is_stream;};
+
+    // Appends text to the arena
+    span_t      store(const char* text, size_t length);
+
+    // Hashes a key
+    static uint32_t hash(const char* key, size_t length);
+
+    // Finds the index slot for a key: either the one that holds it, or the empty one where it goes
+    size_t      slot(const char* key, size_t length, uint32_t hash) const;
+
+    // Doubles the size of the hash index
+    void        grow_index();
+
+    // Rebuilds the arena without the text of specs that have been replaced
+    void        compact();
+
+    // The text arena
+    std::vector<char>    m_text;
+
+    // The values of every spec, as views into the arena
+    std::vector<span_t>  m_values;
+
+    // The specs
+    std::vector<spec_t>  m_specs;
+
+    // The hash index.  Each entry is an index into m_specs or -1.  The size is a power of 2
+    std::vector<int32_t> m_index;
+
+    // The spec that's being recorded between begin() and commit()
+    spec_t      m_pending;
+    bool        m_recording;
+    size_t      m_text_mark;
+
+    // The number of arena bytes that belong to specs that have been replaced
+    size_t      m_garbage;
+};
+//----------------------------------------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------------------------------------
+// config_field_t - Describes one field of a config struct: the config key it comes from, and where in the
+//                  struct it goes.  Build them with config_field()
+//----------------------------------------------------------------------------------------------------------
+template <class S, class T> struct config_field_t
+{
+    const char* key;
+    T S::*      member;
+    bool        required;
+};
+
+template <class S, class T>
+constexpr config_field_t<S, T> config_field(const char* key, T S::* member, bool required = false)
+{
+    return {key, member, required};
+}
+//----------------------------------------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------------------------------------
+// CConfigSchema - Declares, once, how a struct is filled in from a config file:
+//
+//     struct pid_cfg_t {double kp, ki; int32_t rate; std::vector<double> limits;};
+//
+//     static constexpr CConfigSchema pid_schema
+//     (
+//         config_field("pid::kp",     &pid_cfg_t::kp, true),
+//         config_field("pid::ki",     &pid_cfg_t::ki),
+//         config_field("pid::rate",   &pid_cfg_t::rate),
+//         config_field("pid::limits", &pid_cfg_t::limits)
+//     );
+//
+//     config.bind(pid_schema, &pid_cfg);
+//
+// Each field's type picks the matching CConfigFile::get() at compile time, so there are no format strings
+// or void pointers.  Fields that aren't required keep their existing value when the key is missing.
+//----------------------------------------------------------------------------------------------------------
+class CConfigFile;
+class CEvent;
+
+template <class S, class... T> class CConfigSchema
+{
+public:
+
+    constexpr CConfigSchema(config_field_t<S, T>... fields) : m_fields(fields...) {}
+
+    // Fills in a struct from a config file.  Returns 'false' if a required key is missing
+    bool    apply(CConfigFile& config, S* p_struct) const;
+
+protected:
+
+    // Fills in a single field
+    template <class F> static bool apply_field(CConfigFile& config, S* p_struct, const config_field_t<S, F>& field);
+
+    // The field descriptors
+    std::tuple<config_field_t<S, T>...> m_fields;
 };
 //----------------------------------------------------------------------------------------------------------
 
@@ -55,12 +243,36 @@ class CConfigFile
 
 public:
 
-    // Call this to read the config file.  Returns 'true' on success, 'false' if file not found
+    // Call this to read the config file.  Returns 'true' on success, 'false' if file not found or a
+    // struct bound with bind() is missing a required key
     bool    read(std::string filename, bool msg_on_fail = true);
 
+    // Call this to read many config files in parallel.  When a key is in more than one file, the file
+    // later in the list wins.  Returns 'false' if any file couldn't be opened or a struct bound with
+    // bind() is missing a required key.  threads = 0 means one per CPU
+    bool    read(const std::vector<std::string>& filenames, bool msg_on_fail = true, int threads = 0);
+
+    // Call this to discard every spec and read all of the files that have been read so far, again.
+    // Subscribers are notified of every key that changed, appeared or disappeared.  Returns the same
+    // as read()
+    bool    reload(bool msg_on_fail = true, int threads = 0);
+
+    // Call this to override the value of a key, i.e. "section::key = value1, value2".  A key without a
+    // section is in the global section.  Overrides survive later calls to read().  Returns 'false'
+    // if the assignment is malformed or a struct bound with bind() is missing a required key
+    bool    set(std::string assignment);
+
+    // Call this to forget every override.  Keys that were overridden keep their values until the next read()
+    void    clear_overrides() {m_overrides.clear();}
+
     // Call this to set the name of section to use for name scoping
     void    set_current_section(std::string section);
 
+    // Call this before read() to have script-specs streamed from the file by CConfigScript rather than
+    // held in memory.  The file must still be there when the script is read.  Fetching a streamed script
+    // into a vector reads all of its lines from the file
+    void    stream_scripts(bool flag = true) {m_stream_scripts = flag;}
+
     // Call this to determine whether an exception is thrown when trying to fetch an unknown key
     void    throw_on_fail(bool flag = true) {m_throw_on_fail = flag;}
 
@@ -111,25 +323,158 @@ public:
     // Dumps out the m_specs in a human-readable form.  This is strictly for testing
     void    dump_specs();
 
+    // Binds a struct to this config via a schema.  The struct is filled in now (if anything has been
+    // read yet), and again every time read(), set() or reload() changes the config, so the rest of the
+    // program just reads plain struct fields.  The struct must outlive the binding.
+    //
+    // Returns 'false' if a required key is missing.  If nothing has been read yet, there's nothing to
+    // check, so this returns 'true' and the check is made (and reported) by the next read().
+    //
+    // Bound structs are rewritten in place, without any locking, on every read(), set() and reload().
+    // If another thread reads a bound struct, it must not do so while those are running
+    template <class S, class... T> bool bind(const CConfigSchema<S, T...>& schema, S* p_struct)
+    {
+        m_bindings.push_back([schema, p_struct](CConfigFile& config) {return schema.apply(config, p_struct);});
+        if (m_specs.size() == 0) return true;
+        bool ok = schema.apply(*this, p_struct);
+        if (!ok) m_bindings_ok = false;
+        return ok;
+    }
+
+    // Returns 'false' if, the last time the bound structs were filled in, one was missing a required key
+    bool    bindings_ok() {return m_bindings_ok;}
+
+    // Removes every binding
+    void    unbind_all() {m_bindings.clear(); m_bindings_ok = true;}
+
+    // Called with the fully scoped name of a key whose values changed
+    typedef std::function<void(const std::string& key)> change_cb_t;
+
+    // Subscribes to changes of a single key ("section::key", or just "key" for the global section).
+    // After each read(), reload() or set(), the callback is called (or the event is set) if the key's
+    // values changed, including when it first appears or disappears.  Returns a subscription ID
+    int     subscribe(std::string key, change_cb_t callback);
+    int     subscribe(std::string key, CEvent* p_event);
+
+    // Subscribes to changes of any key in a section.  The callback is called once per changed key, the
+    // event is set once per load
+    int     subscribe_section(std::string section, change_cb_t callback);
+    int     subscribe_section(std::string section, CEvent* p_event);
+
+    // Cancels a subscription
+    void    unsubscribe(int id);
+
 protected:
 
     // If this is true, fetching the value of an unknown spec will throw 
     bool    m_throw_on_fail = true;
 
+    // If this is true, script-specs are recorded as file ranges and streamed
+    bool    m_stream_scripts = false;
+
     // A strvec_t is a vector of strings
     typedef std::vector< std::string > strvec_t;
 
+    // A specmap_t maps a fully scoped key-name to its values
+    typedef std::map<std::string, strvec_t> specmap_t;
+
+    // Parses a single file into a spec store.  Thread-safe
+    static bool parse_file(const std::string& filename, CConfigStore& specs, bool stream_scripts);
+
     // Call this to fetch the values-vector associated with a key
     bool    lookup(std::string key, strvec_t *p_result);
 
+    // Returns the index of a spec in m_specs, or -1
+    int     find_spec(std::string key, bool throw_if_missing);
+
+    // Opens a script on the file and byte range of a streamed spec
+    bool    open_streamed_script(int index, CConfigScript* p_script);
+
+    // Records a file for reload(), at the end of the list
+    void    remember_file(const std::string& filename);
+
+    // Fills in every bound struct.  Returns 'false' if any of them is missing a required key
+    bool    run_bindings();
+
+    // Records the hash of every key's values without notifying anyone
+    void    take_snapshot();
+
+    // Compares the values of every key (or just one) to the last time we looked, and notifies
+    // subscribers of the ones that changed
+    void    notify_changes(const std::string* p_only_key = nullptr);
+
+    // Adds a subscription
+    int     add_subscription(std::string name, bool is_section, change_cb_t callback, CEvent* p_event);
+
+    // Notifies the subscribers of one changed key.  Events are collected in 'events'
+    void    notify_key(const std::string& key, std::vector<CEvent*>& events);
+
     // The section name to look for specs in
     std::string m_current_section;
 
-    // Our configuration specs are a vector of spec_t objects
-    std::map<std::string, strvec_t> m_specs;
+    // Our configuration specs, keyed by fully scoped name
+    CConfigStore m_specs;
+
+    // Values set via set().  These are layered on top of m_specs every time a file is read
+    specmap_t m_overrides;
+
+    // The structs that are bound via bind(), and whether they were all filled in the last time
+    std::vector<std::function<bool(CConfigFile&)>> m_bindings;
+    bool    m_bindings_ok = true;
+
+    // Every file that's been read, in the order each was last read.  reload() reads these again
+    std::vector<std::string> m_files;
+
+    // A subscription to a key or to a section
+    struct subscription_t
+    {
+        std::string name;
+        bool        is_section;
+        change_cb_t callback;
+        CEvent*     p_event;
+    };
+
+    // The subscriptions by ID, and the IDs of the subscriptions to each key and to each section
+    std::map<int, subscription_t> m_subscriptions;
+    std::unordered_multimap<std::string, int> m_key_subs, m_section_subs;
+    int     m_next_subscription_id = 1;
+
+    // The hash of every key's values the last time we looked, and when we last saw the key
+    struct snapshot_t {uint64_t hash; uint32_t generation;};
+    std::unordered_map<std::string, snapshot_t> m_snapshot;
+    uint32_t m_generation = 0;
 };
 //----------------------------------------------------------------------------------------------------------
 
 
 
+//----------------------------------------------------------------------------------------------------------
+// CConfigSchema::apply() - Fills in every field of a struct.  Every field is attempted, even if an
+//                          earlier one fails
+//----------------------------------------------------------------------------------------------------------
+template <class S, class... T> bool CConfigSchema<S, T...>::apply(CConfigFile& config, S* p_struct) const
+{
+    return std::apply([&](const auto&... field)
+    {
+        bool ok = true;
+        ((ok &= apply_field(config, p_struct, field)), ...);
+        return ok;
+    }, m_fields);
+}
+//----------------------------------------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------------------------------------
+// CConfigSchema::apply_field() - Fills in one field.  A missing key that isn't required isn't an error
+//----------------------------------------------------------------------------------------------------------
+template <class S, class... T> template <class F>
+bool CConfigSchema<S, T...>::apply_field(CConfigFile& config, S* p_struct, const config_field_t<S, F>& field)
+{
+    if (!field.required && !config.exists(field.key)) return true;
+    return config.get(field.key, &(p_struct->*field.member));
+}
+//----------------------------------------------------------------------------------------------------------
+
+
+
 
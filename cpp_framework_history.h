@@ -7,8 +7,33 @@
    Date    Ver   Who  What
 ------------------------------------------------------------------------------------------------------------
 21-Jun-22  1000  DWW  Initial
+18-Oct-26  1001  DWW  Added CShmChannel, a memfd-backed SPSC ring with a NetSock-style API
+18-Oct-26  1002  DWW  Added NetSockPool, NetSock::set_keepalive(), NetSock::is_alive() and connect() by address
+18-Oct-26  1003  DWW  Added TlsSock/TlsContext (OpenSSL) with session resumption and kTLS, NetSock::send_file()
+18-Oct-26  1004  DWW  Added NetSock deadline variants receive_for()/getline_for()/send_for(), set_blocking(), set_timeouts()
+18-Oct-26  1005  DWW  Added NetSockTuning profiles (latency/throughput/custom) and NetSock::set_tuning()
+18-Oct-26  1006  DWW  Added CSerialReader and CSerialPort::enable_async_reader() with timestamped reads
+18-Oct-26  1007  DWW  Added CPacketFramer (COBS, SLIP, length+CRC16/CRC32) and CSerialPort::get_packet()/put_packet()
+18-Oct-26  1008  DWW  Added CSerialWriter and CSerialPort::enable_async_writer()/flush() with back-pressure callbacks
+18-Oct-26  1009  DWW  Added serial_config_t, custom baud-rates (termios2), parity, flow control to CSerialPort
+18-Oct-26  1010  DWW  Added CSerialHub, an epoll-based multiplexer for many serial ports
+18-Oct-26  1011  DWW  Added CSerialCapture (binary traffic log) and CSerialReplay (pty-backed playback)
+18-Oct-26  1012  DWW  Added CSerialTransactor, pipelined command/response transactions for CSerialPort
+18-Oct-26  1013  DWW  CThread: typed arguments (CTypedThread), stop token, affinity/priority/name/NUMA options
+18-Oct-26  1014  DWW  CThread: atomic counters, live-thread registry with CPU stats, join_all()/wait_for_quiescence()
+18-Oct-26  1015  DWW  Added CTimerService, a timerfd-based hierarchical timer wheel
+18-Oct-26  1016  DWW  Added CFastEvent, a futex-based in-process event
+18-Oct-26  1017  DWW  Added CCoalescedEvent: producers set bits/counts, eventfd written only on 0->1
+18-Oct-26  1018  DWW  CEvent, CCoalescedEvent and CShmChannel can be passed to other processes over Unix sockets
+18-Oct-26  1019  DWW  Added CSwitchTable/CCmdTable, a constexpr perfect-hash switch table and allocation-free parser
+18-Oct-26  1020  DWW  CCmdLine accepts --set section::key=value overrides, layered onto CConfigFile via set()
+18-Oct-26  1021  DWW  CConfigFile::read() accepts a list of files and parses them in parallel
+18-Oct-26  1022  DWW  CConfigFile specs live in CConfigStore: one text arena, offset views, open-addressing index
+18-Oct-26  1023  DWW  Added CConfigSchema/config_field(): typed structs bound to CConfigFile, refilled on every read()/set()
+18-Oct-26  1024  DWW  CConfigFile: reload(), per-key and per-section change subscriptions (callbacks or CEvent) via hashed value diffs
+18-Oct-26  1025  DWW  CConfigFile::stream_scripts(): script-specs recorded as file ranges, streamed by CConfigScript
 
 
 /*
 //==========================================================================================================
-#define VERSION 1000
\ No newline at end of file
+#define VERSION 1025
\ No newline at end of file
@@ -4,20 +4,50 @@
 #include "cthread.h"
 #include <thread>
 #include <mutex>
+#include <set>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 using namespace std;
 
 //==========================================================================================================
 // This is a count of how many threads are still running
 //==========================================================================================================
-int CThread::m_running_threads = 0;
+atomic<int> CThread::m_running_threads(0);
 //==========================================================================================================
 
 
 //==========================================================================================================
 // This is a count of how many threads have been constructed
 //==========================================================================================================
-int CThread::m_constructed_threads = 0;
+atomic<int> CThread::m_constructed_threads(0);
+//==========================================================================================================
+
+
+//==========================================================================================================
+// The registry of running threads.  It's only touched when a thread starts or stops, and when someone asks
+// for statistics, so a plain mutex is fine here.  The condition variable is signalled whenever a thread
+// leaves the registry
+//==========================================================================================================
+static mutex              registry_mutex;
+static set<CThread*>      registry;
+static condition_variable registry_changed;
+//==========================================================================================================
+
+
+//==========================================================================================================
+// The CThread whose main() is running on this thread, or nullptr if this thread isn't a CThread
+//==========================================================================================================
+static thread_local CThread* current_thread = nullptr;
 //==========================================================================================================
 
 
@@ -26,7 +56,163 @@ int CThread::m_constructed_threads = 0;
 //==========================================================================================================
 CThread::CThread()
 {
-    m_thread_index = ++m_constructed_threads;
+    m_thread_index   = m_constructed_threads.fetch_add(1) + 1;
+    m_stop_requested = false;
+    m_tid            = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Destructor() - Like std::jthread, asks a thread that is still running to stop, and waits for it.
+//
+// Note that by the time we get here, the derived class has already been destroyed, so a derived class
+// whose main() uses its own members must stop the thread in its own destructor
+//==========================================================================================================
+CThread::~CThread()
+{
+    // If the thread was never spawned or has already been joined, there's nothing to do
+    if (!m_thread.joinable()) return;
+
+    // Ask the thread to stop
+    request_stop();
+
+    // A thread can't wait for itself to finish
+    if (m_thread.get_id() == this_thread::get_id())
+        m_thread.detach();
+    else
+        m_thread.join();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// request_stop() - Sets the stop token and triggers the stop event
+//==========================================================================================================
+void CThread::request_stop()
+{
+    if (!m_stop_requested.exchange(true)) m_stop_event.set();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_options_error() - Fetches a description of the thread options that couldn't be applied
+//
+// Returns: 'true' if some options couldn't be applied, 'false' if they all were
+//==========================================================================================================
+bool CThread::get_options_error(string* p_error)
+{
+    if (p_error) *p_error = m_options_error;
+    return !m_options_error.empty();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// numa_node_cpus() - Reads the list of CPUs that belong to a NUMA node from sysfs
+//
+// Passed:  node   = The NUMA node number
+//          p_cpus = Receives the CPU numbers
+//
+// Returns: 'true' on success, 'false' if there is no such node
+//==========================================================================================================
+bool CThread::numa_node_cpus(int node, vector<int>* p_cpus)
+{
+    char filename[100], line[1024];
+
+    p_cpus->clear();
+
+    // The CPU list looks like "0-3,8-11"
+    sprintf(filename, "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* ifile = fopen(filename, "r");
+    if (ifile == nullptr) return false;
+    bool ok = fgets(line, sizeof line, ifile) != nullptr;
+    fclose(ifile);
+    if (!ok) return false;
+
+    // Parse each comma-separated range
+    char* saveptr;
+    for (char* token = strtok_r(line, ",\n", &saveptr); token; token = strtok_r(nullptr, ",\n", &saveptr))
+    {
+        int first, last;
+        int count = sscanf(token, "%d-%d", &first, &last);
+        if (count < 1) continue;
+        if (count == 1) last = first;
+        for (int cpu = first; cpu <= last; ++cpu) p_cpus->push_back(cpu);
+    }
+
+    // Tell the caller whether this node has any CPUs
+    return !p_cpus->empty();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// apply_options() - Applies CPU affinity, NUMA placement, scheduling policy and name to the calling thread
+//
+// Passed:  options = Describes where and how the thread should run
+//          p_error = If not null, receives a description of anything that went wrong
+//
+// Returns: 'true' if every option was applied, otherwise 'false'
+//
+// Note: Real-time scheduling policies require CAP_SYS_NICE (or a suitable RLIMIT_RTPRIO)
+//==========================================================================================================
+bool CThread::apply_options(const thread_options_t& options, string* p_error)
+{
+    string    error;
+    vector<int> cpus = options.cpus;
+    pthread_t self = pthread_self();
+
+    // If we're supposed to run on a NUMA node, find out which CPUs it has
+    if (cpus.empty() && options.numa_node >= 0)
+    {
+        if (!numa_node_cpus(options.numa_node, &cpus)) error += "no such NUMA node; ";
+
+        // Allocate memory from that node whenever we can
+        if (options.numa_node < 64)
+        {
+            unsigned long nodemask = 1UL << options.numa_node;
+            if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask, 64) < 0)
+            {
+                error += string("set_mempolicy: ") + strerror(errno) + "; ";
+            }
+        }
+    }
+
+    // Pin the thread to the requested CPUs
+    if (!cpus.empty())
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (int cpu : cpus) if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &cpuset);
+        int rc = pthread_setaffinity_np(self, sizeof cpuset, &cpuset);
+        if (rc) error += string("affinity: ") + strerror(rc) + "; ";
+    }
+
+    // Set the scheduling policy and priority
+    if (options.policy != SCHED_OTHER || options.priority != 0)
+    {
+        sched_param param = {};
+        param.sched_priority = options.priority;
+        int rc = pthread_setschedparam(self, options.policy, &param);
+        if (rc) error += string("scheduling: ") + strerror(rc) + "; ";
+    }
+
+    // Name the thread.  The kernel only keeps the first 15 characters
+    if (!options.name.empty())
+    {
+        string name = options.name.substr(0, 15);
+        int rc = pthread_setname_np(self, name.c_str());
+        if (rc) error += string("name: ") + strerror(rc) + "; ";
+    }
+
+    // Strip off the trailing separator
+    if (!error.empty()) error.resize(error.size() - 2);
+
+    // Tell the caller what went wrong, if anything
+    if (p_error) *p_error = error;
+    return error.empty();
 }
 //==========================================================================================================
 
@@ -34,39 +220,200 @@ CThread::CThread()
 //==========================================================================================================
 // entry_point() - This is the entry point when a thread is spawned
 //==========================================================================================================
-void CThread::entry_point()
+void CThread::entry_point(promise<bool>* p_started)
 {
-    static mutex mtx;
-    
-    // We now have one more thread running
-    mtx.lock();
+    // Find out what the kernel calls us
+    m_tid     = syscall(SYS_gettid);
+    m_pthread = pthread_self();
+
+    // Put ourselves where we're supposed to run before doing any real work
+    bool ok = apply_options(m_options, &m_options_error);
+
+    // We now have one more thread running.  This happens before spawn() returns, so that a
+    // wait_for_quiescence() that immediately follows a spawn() waits for this thread
     ++m_running_threads;
-    mtx.unlock();
+    registry_mutex.lock();
+    registry.insert(this);
+    registry_mutex.unlock();
+
+    // Let spawn() know that we're off and running.  After this, p_started no longer exists
+    p_started->set_value(ok);
+
+    // Remember which CThread this is, so that wait_for_quiescence() doesn't wait for itself
+    current_thread = this;
 
     // Start main() in the dervied class
     main();
-    
-    // We now have one fewer threads running
-    mtx.lock();
+
+    // We now have one fewer threads running.  Wake up anyone waiting for threads to finish
     --m_running_threads;
-    mtx.unlock();
+    lock_guard<mutex> lock(registry_mutex);
+    registry.erase(this);
+    registry_changed.notify_all();
 }
 //==========================================================================================================
 
 
 //==========================================================================================================
-// spawn() - Spawns the thread
+// spawn() - Spawns the thread, and waits for it to apply its thread options
 //==========================================================================================================
-void CThread::spawn(const void* p1, const void* p2, const void* p3, const void* p4)
+bool CThread::spawn(const void* p1, const void* p2, const void* p3, const void* p4)
 {
+    promise<bool> started;
+
     // Fill in the startup parameters
     m_p1 = (void*)p1;
     m_p2 = (void*)p2;
     m_p3 = (void*)p3;
     m_p4 = (void*)p4;
 
-    // Spin up "entry_point" 
-    m_thread = std::thread(&CThread::entry_point, this);
+    // The thread starts out with no stop requested
+    m_stop_requested = false;
+    m_stop_event.reset();
+
+    // Spin up "entry_point"
+    m_thread = std::thread(&CThread::entry_point, this, &started);
+
+    // Wait for the thread to apply its options, and tell the caller if it could
+    return started.get_future().get();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// read_stats() - Fills in a snapshot of this thread's CPU usage.  Call with registry_mutex held, which
+//                guarantees that the thread is still running
+//==========================================================================================================
+bool CThread::read_stats(thread_stats_t* p_stats)
+{
+    char       filename[100], line[200], name[16] = "";
+    clockid_t  clock_id;
+    timespec   ts;
+
+    // Fill in who this is
+    p_stats->index = m_thread_index;
+    p_stats->tid   = m_tid;
+    pthread_getname_np(m_pthread, name, sizeof name);
+    p_stats->name  = name;
+
+    // Fetch the CPU time from the thread's own CPU-time clock
+    p_stats->cpu_time_ns = 0;
+    if (pthread_getcpuclockid(m_pthread, &clock_id) == 0 && clock_gettime(clock_id, &ts) == 0)
+    {
+        p_stats->cpu_time_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    // The context switch counts only live in /proc
+    p_stats->voluntary_switches   = 0;
+    p_stats->involuntary_switches = 0;
+    sprintf(filename, "/proc/self/task/%d/status", (int)m_tid);
+    FILE* ifile = fopen(filename, "r");
+    if (ifile == nullptr) return true;
+    while (fgets(line, sizeof line, ifile))
+    {
+        unsigned long value;
+        if (sscanf(line, "voluntary_ctxt_switches: %lu", &value) == 1)
+            p_stats->voluntary_switches = value;
+        else if (sscanf(line, "nonvoluntary_ctxt_switches: %lu", &value) == 1)
+            p_stats->involuntary_switches = value;
+    }
+    fclose(ifile);
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_stats() - Fetches a snapshot of this thread's CPU usage
+//
+// Returns: 'true' on success, 'false' if the thread isn't running
+//==========================================================================================================
+bool CThread::get_stats(thread_stats_t* p_stats)
+{
+    lock_guard<mutex> lock(registry_mutex);
+    if (registry.count(this) == 0) return false;
+    return read_stats(p_stats);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// live_threads() - Fetches a snapshot of every running CThread, in index order
+//==========================================================================================================
+vector<thread_stats_t> CThread::live_threads()
+{
+    vector<thread_stats_t> result;
+    thread_stats_t         stats;
+
+    lock_guard<mutex> lock(registry_mutex);
+    for (CThread* p_thread : registry)
+    {
+        if (p_thread->read_stats(&stats)) result.push_back(stats);
+    }
+
+    // Sort them by thread index
+    sort(result.begin(), result.end(), [](const thread_stats_t& a, const thread_stats_t& b)
+    {
+        return a.index < b.index;
+    });
+
+    return result;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wait_for_quiescence() - Waits for every running CThread to return from main()
+//
+// Passed:  timeout_ms = The maximum time to wait.  -1 = wait forever
+//
+// Returns: 'true' if no threads are running, 'false' on timeout
+//
+// When called from inside a CThread's main(), that thread can't finish while it's waiting here, so it
+// isn't waited for
+//==========================================================================================================
+bool CThread::wait_for_quiescence(int timeout_ms)
+{
+    CThread* self = current_thread;
+
+    // We're done when the only thread left (if any) is the one that's waiting
+    auto quiet = [self]{return registry.size() == registry.count(self);};
+
+    unique_lock<mutex> lock(registry_mutex);
+
+    // If we're willing to wait forever, do so
+    if (timeout_ms < 0)
+    {
+        registry_changed.wait(lock, quiet);
+        return true;
+    }
+
+    // Otherwise, wait as long as we're allowed
+    return registry_changed.wait_for(lock, chrono::milliseconds(timeout_ms), quiet);
 }
 //==========================================================================================================
 
+
+//==========================================================================================================
+// join_all() - Requests a stop on every running CThread, then waits for them all to finish
+//
+// Passed:  timeout_ms = The maximum time to wait.  -1 = wait forever
+//
+// Returns: 'true' if no threads are running, 'false' on timeout
+//
+// Note: Only threads whose main() watches stop_requested() or stop_fd() will respond to this.  When called
+//       from inside a CThread's main(), that thread is neither asked to stop nor waited for
+//==========================================================================================================
+bool CThread::join_all(int timeout_ms)
+{
+    // Ask every running thread other than ourselves to stop
+    registry_mutex.lock();
+    for (CThread* p_thread : registry) if (p_thread != current_thread) p_thread->request_stop();
+    registry_mutex.unlock();
+
+    // And wait for them to do so
+    return wait_for_quiescence(timeout_ms);
+}
+//==========================================================================================================
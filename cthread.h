@@ -3,6 +3,63 @@
 //==========================================================================================================
 #pragma once
 #include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <future>
+#include <cstdint>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "event.h"
+
+
+//==========================================================================================================
+// thread_options_t - Describes where and how a thread should run.  Anything left at its default is left
+//                    up to the operating system
+//==========================================================================================================
+struct thread_options_t
+{
+    // The CPUs the thread may run on.  Empty means "any CPU"
+    std::vector<int> cpus;
+
+    // If 'cpus' is empty and this is >= 0, the thread runs on the CPUs of this NUMA node, and its
+    // memory is allocated from this node when possible
+    int         numa_node = -1;
+
+    // SCHED_OTHER, SCHED_FIFO or SCHED_RR.  Real-time priorities are 1 (low) thru 99 (high)
+    int         policy    = SCHED_OTHER;
+    int         priority  = 0;
+
+    // The name that shows up in "top -H", "ps -L" and debuggers.  At most 15 characters are used
+    std::string name;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// thread_stats_t - A snapshot of a running thread
+//==========================================================================================================
+struct thread_stats_t
+{
+    // The CThread index and the kernel thread ID (as shown by "top -H")
+    int         index;
+    pid_t       tid;
+
+    // The thread name
+    std::string name;
+
+    // CPU time consumed so far, in nanoseconds
+    uint64_t    cpu_time_ns;
+
+    // The number of times the thread gave up the CPU by blocking, and the number of times it was
+    // preempted
+    uint64_t    voluntary_switches;
+    uint64_t    involuntary_switches;
+};
+//==========================================================================================================
+
 
 class CThread
 {
@@ -11,11 +68,43 @@ public:
     // Default constructor
     CThread();
 
-    // Call this to spawn the thread
-    void    spawn(const void* p1=0, const void* p2=0, const void* p3=0, const void* p4=0);
+    // Requests a stop and waits for the thread to finish, if it's still running
+    virtual ~CThread();
+
+    // Call this before spawn() to control where and how the thread runs
+    void    set_options(const thread_options_t& options) {m_options = options;}
+
+    // Call this to spawn the thread.  Returns 'false' if the thread options couldn't all be applied,
+    // in which case the thread still runs, and get_options_error() says what went wrong
+    bool    spawn(const void* p1=0, const void* p2=0, const void* p3=0, const void* p4=0);
+
+    // Call this to join (i.e., wait for the completion of) this thread.  Safe to call if the thread
+    // isn't running
+    void    join() {if (m_thread.joinable()) m_thread.join();}
+
+    // Returns 'true' if the thread has been spawned and not yet joined
+    bool    joinable() {return m_thread.joinable();}
+
+    // Asks the thread to stop.  main() should check stop_requested(), or wait on stop_fd()
+    void    request_stop();
+
+    // Returns 'true' once request_stop() has been called
+    bool    stop_requested() {return m_stop_requested.load(std::memory_order_relaxed);}
+
+    // Returns a file descriptor that becomes readable when a stop is requested, for use with select()
+    int     stop_fd() {return m_stop_event.fd();}
+
+    // Fetches a description of the thread options that couldn't be applied.  Returns 'false' if
+    // they were all applied
+    bool    get_options_error(std::string* p_error);
 
-    // Call this to join (i.e., wait for the completion of) this thread
-    void    join() {m_thread.join();}
+    // Applies thread options to the calling thread.  Returns 'false' if any of them couldn't be
+    // applied, and describes what went wrong in *p_error
+    static bool apply_options(const thread_options_t& options, std::string* p_error = nullptr);
+
+    // Fetches the list of CPUs that belong to the specified NUMA node.  Returns 'false' if there
+    // is no such node
+    static bool numa_node_cpus(int node, std::vector<int>* p_cpus);
 
     // Call this to fetch the unique index of this thread
     int     get_index() {return m_thread_index;}
@@ -26,6 +115,21 @@ public:
     // Call this to fetch the number of currently running threads
     int     running_threads() {return m_running_threads;}
 
+    // Fetches a snapshot of this thread's CPU usage.  Returns 'false' if it isn't running
+    bool    get_stats(thread_stats_t* p_stats);
+
+    // Fetches a snapshot of every CThread that is currently running
+    static std::vector<thread_stats_t> live_threads();
+
+    // Waits for every CThread to finish.  -1 = wait forever.  Returns 'false' on timeout.  Called
+    // from a CThread's main(), it doesn't wait for the calling thread
+    static bool wait_for_quiescence(int timeout_ms = -1);
+
+    // Requests a stop on every running CThread, then waits for them all to finish.  Their thread
+    // handles are still reclaimed by join() or the destructor, which then return immediately.
+    // Called from a CThread's main(), the calling thread is left alone.  Returns 'false' on timeout
+    static bool join_all(int timeout_ms = -1);
+
 
 protected:
 
@@ -41,14 +145,65 @@ protected:
 private:
 
     // This is a count of running threads
-    static int m_running_threads;
+    static std::atomic<int> m_running_threads;
 
     // This is a count of the number of threads that have been constructed
-    static int m_constructed_threads;
+    static std::atomic<int> m_constructed_threads;
+
+    // The kernel thread ID and the pthread handle, once the thread is running
+    pid_t     m_tid;
+    pthread_t m_pthread;
+
+    // Fills in a thread_stats_t.  Call with the registry locked
+    bool    read_stats(thread_stats_t* p_stats);
 
     // This is the actual thread object
     std::thread m_thread;
 
+    // Where and how the thread should run
+    thread_options_t m_options;
+
+    // If the thread options couldn't be applied, this says why
+    std::string m_options_error;
+
+    // The stop token, and an event that becomes triggered along with it
+    std::atomic<bool> m_stop_requested;
+    CEvent  m_stop_event;
+
     // This is the entry point for the new thread
-    void entry_point();
+    void entry_point(std::promise<bool>* p_started);
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CTypedThread - A CThread whose entry point takes typed arguments instead of void pointers.  Derive from
+//                CTypedThread<int, std::string> (for example), over-ride run(int, std::string), and start
+//                the thread with spawn(42, "hello").  The arguments are copied into the thread object, so
+//                they remain valid for the life of the thread
+//==========================================================================================================
+template <class... Args> class CTypedThread : public CThread
+{
+public:
+
+    // Call this to spawn the thread with the specified arguments
+    bool    spawn(Args... args)
+    {
+        m_args = std::tuple<Args...>(args...);
+        return CThread::spawn();
+    }
+
+protected:
+
+    // Over-ride this with the entry-point to your thread
+    virtual void run(Args... args) = 0;
+
+private:
+
+    // Unpacks the arguments and calls run()
+    void    main() override {std::apply([this](Args&... args) {run(args...);}, m_args);}
+
+    // The arguments passed to spawn()
+    std::tuple<Args...> m_args;
 };
+//==========================================================================================================
@@ -5,6 +5,11 @@
 #include <unistd.h>
 #include <sys/eventfd.h>
 #include <sys/select.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 
 
 //============================================================================
@@ -116,3 +121,365 @@ uint64_t CEvent::wait(uint32_t milliseconds)
     return event_value;
 }
 //============================================================================
+
+
+//============================================================================
+// adopt() - Closes our eventfd and takes ownership of another one
+//============================================================================
+void CEvent::adopt(int fd)
+{
+    if (m_fd >= 0 && m_fd != fd) close(m_fd);
+    m_fd = fd;
+}
+//============================================================================
+
+
+//============================================================================
+// set_inheritable() - Controls whether the eventfd survives an exec()
+//
+// Passed:  flag = true if the eventfd should be inherited across exec()
+//
+// Returns: 'true' on success
+//============================================================================
+bool CEvent::set_inheritable(bool flag)
+{
+    int flags = fcntl(m_fd, F_GETFD);
+    if (flags < 0) return false;
+    flags = flag ? (flags & ~FD_CLOEXEC) : (flags | FD_CLOEXEC);
+    return fcntl(m_fd, F_SETFD, flags) == 0;
+}
+//============================================================================
+
+
+//============================================================================
+// send_fds() - Sends file descriptors over a Unix-domain socket with an
+//              SCM_RIGHTS control message
+//
+// Passed:  socket_fd = A connected AF_UNIX socket
+//          fds       = The file descriptors to send
+//          count     = How many there are (at most 16)
+//
+// Returns: 'true' on success
+//============================================================================
+bool CEvent::send_fds(int socket_fd, const int* fds, int count)
+{
+    char    payload = 0;
+    char    control[CMSG_SPACE(16 * sizeof(int))];
+    iovec   iov = {&payload, 1};
+    msghdr  msg = {};
+
+    if (count < 1 || count > 16) return false;
+
+    // A message has to carry at least one byte of real data
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+    // The file descriptors go in the control message
+    memset(control, 0, sizeof control);
+    cmsghdr* cmsg    = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+
+    return sendmsg(socket_fd, &msg, MSG_NOSIGNAL) == 1;
+}
+//============================================================================
+
+
+//============================================================================
+// receive_fds() - Receives file descriptors sent with send_fds()
+//
+// Passed:  socket_fd = A connected AF_UNIX socket
+//          fds       = Receives the file descriptors
+//          max_fds   = The most file descriptors we can store (at most 16)
+//
+// Returns: The number of file descriptors received, or -1 on error
+//
+// The file descriptors are close-on-exec.  Use set_inheritable() on an
+// adopted eventfd if it needs to survive an exec()
+//============================================================================
+int CEvent::receive_fds(int socket_fd, int* fds, int max_fds)
+{
+    char    payload;
+    char    control[CMSG_SPACE(16 * sizeof(int))];
+    iovec   iov = {&payload, 1};
+    msghdr  msg = {};
+
+    if (max_fds < 1 || max_fds > 16) return -1;
+
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = CMSG_SPACE(max_fds * sizeof(int));
+
+    // Fetch the message
+    if (recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC) != 1) return -1;
+
+    // Find the SCM_RIGHTS control message
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+        return count;
+    }
+
+    // There weren't any file descriptors in the message
+    return -1;
+}
+//============================================================================
+
+
+//============================================================================
+// send_to() - Sends the eventfd to another process
+//============================================================================
+bool CEvent::send_to(int socket_fd)
+{
+    return send_fds(socket_fd, &m_fd, 1);
+}
+//============================================================================
+
+
+//============================================================================
+// receive_from() - Receives an eventfd from another process and adopts it
+//============================================================================
+bool CEvent::receive_from(int socket_fd)
+{
+    int fd;
+    if (receive_fds(socket_fd, &fd, 1) != 1) return false;
+    adopt(fd);
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// Constructor - Creates a coalesced event with nothing accumulated
+//
+// Passed:  p_state = Zeroed memory to keep the state in (i.e., shared
+//                    memory), or nullptr to use our own
+//============================================================================
+CCoalescedEvent::CCoalescedEvent(coalesced_state_t* p_state)
+{
+    memset((void*)&m_own_state, 0, sizeof m_own_state);
+    m_state    = p_state ? p_state : &m_own_state;
+    m_state_fd = -1;
+}
+//============================================================================
+
+
+//============================================================================
+// Destructor - Releases the shared state, if there is any
+//============================================================================
+CCoalescedEvent::~CCoalescedEvent()
+{
+    if (m_state_fd < 0) return;
+    munmap(m_state, sizeof(coalesced_state_t));
+    close(m_state_fd);
+}
+//============================================================================
+
+
+//============================================================================
+// map_state() - Maps the shared state from a memfd, and starts using it
+//============================================================================
+bool CCoalescedEvent::map_state(int memfd)
+{
+    void* p = mmap(nullptr, sizeof(coalesced_state_t), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (p == MAP_FAILED) return false;
+
+    // Release any shared state we already had
+    if (m_state_fd >= 0)
+    {
+        munmap(m_state, sizeof(coalesced_state_t));
+        close(m_state_fd);
+    }
+
+    m_state    = (coalesced_state_t*)p;
+    m_state_fd = memfd;
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// create_shared() - Moves the state into a shared memfd mapping
+//
+// Returns: 'true' on success
+//============================================================================
+bool CCoalescedEvent::create_shared()
+{
+    // Create the memfd.  A new one is already zeroed
+    int memfd = memfd_create("coalesced_event", MFD_CLOEXEC);
+    if (memfd < 0) return false;
+
+    // Size it and map it
+    if (ftruncate(memfd, sizeof(coalesced_state_t)) < 0 || !map_state(memfd))
+    {
+        close(memfd);
+        return false;
+    }
+
+    // Tell the caller that all is well
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// send_to() - Sends the eventfd and the shared state to another process
+//============================================================================
+bool CCoalescedEvent::send_to(int socket_fd)
+{
+    if (m_state_fd < 0) return false;
+    int fds[2] = {m_fd, m_state_fd};
+    return send_fds(socket_fd, fds, 2);
+}
+//============================================================================
+
+
+//============================================================================
+// receive_from() - Receives an event sent with send_to()
+//============================================================================
+bool CCoalescedEvent::receive_from(int socket_fd)
+{
+    int fds[2];
+
+    // Fetch the eventfd and the memfd
+    int count = receive_fds(socket_fd, fds, 2);
+    if (count != 2)
+    {
+        for (int i = 0; i < count; ++i) close(fds[i]);
+        return false;
+    }
+
+    // Map the shared state
+    if (!map_state(fds[1]))
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    // And start using the sender's eventfd
+    adopt(fds[0]);
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// signal() - Writes the eventfd, but only if we're the producer that takes
+//            the event from idle to signalled.  Every other producer gets
+//            away with an atomic load
+//============================================================================
+void CCoalescedEvent::signal()
+{
+    if (m_state->signalled.load(std::memory_order_seq_cst)) return;
+    if (m_state->signalled.exchange(1, std::memory_order_seq_cst) == 0) CEvent::set(1);
+}
+//============================================================================
+
+
+//============================================================================
+// set_bits() - Marks the specified sources as having fired
+//============================================================================
+void CCoalescedEvent::set_bits(uint64_t mask)
+{
+    m_state->bits.fetch_or(mask, std::memory_order_seq_cst);
+    signal();
+}
+//============================================================================
+
+
+//============================================================================
+// add_count() - Adds to a source's count, and marks the source as fired
+//============================================================================
+void CCoalescedEvent::add_count(int source, uint64_t count)
+{
+    source &= coalesced_state_t::MAX_SOURCES - 1;
+    m_state->counts[source].fetch_add(count, std::memory_order_relaxed);
+    m_state->bits.fetch_or(1ULL << source, std::memory_order_seq_cst);
+    signal();
+}
+//============================================================================
+
+
+//============================================================================
+// take() - Collects and resets the accumulated bits and counts.  The
+//          "signalled" flag is cleared first, so that any producer that
+//          fires after this point writes the eventfd again
+//============================================================================
+uint64_t CCoalescedEvent::take(uint64_t* p_counts)
+{
+    m_state->signalled.store(0, std::memory_order_seq_cst);
+    uint64_t bits = m_state->bits.exchange(0, std::memory_order_seq_cst);
+
+    // Collect the counts of the sources that fired
+    if (p_counts)
+    {
+        for (int i = 0; i < coalesced_state_t::MAX_SOURCES; ++i)
+        {
+            p_counts[i] = (bits & (1ULL << i)) ? m_state->counts[i].exchange(0) : 0;
+        }
+    }
+
+    return bits;
+}
+//============================================================================
+
+
+//============================================================================
+// wait() - Waits for any source to fire, then collects everything that has
+//          accumulated
+//
+// Passed:  milliseconds = number of milliseconds to wait.  0 = Forever
+//          p_counts     = If not null, receives MAX_SOURCES counts
+//
+// Returns: The bits of the sources that fired, or 0 on timeout
+//============================================================================
+uint64_t CCoalescedEvent::wait(uint32_t milliseconds, uint64_t* p_counts)
+{
+    timespec start, now;
+    uint32_t remaining = milliseconds;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (true)
+    {
+        // Wait for the eventfd.  If it times out, nothing fired
+        if (CEvent::wait(remaining) == 0) return 0;
+
+        // Collect what happened.  We can be woken with nothing to collect if
+        // a previous wait() already picked up the data that went with this
+        // wake-up.  In that case, we go back to waiting
+        uint64_t bits = take(p_counts);
+        if (bits) return bits;
+
+        // If there's a timeout, figure out how much of it is left
+        if (milliseconds)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            uint32_t elapsed = (now.tv_sec - start.tv_sec) * 1000
+                             + (now.tv_nsec - start.tv_nsec) / 1000000;
+            if (elapsed >= milliseconds) return 0;
+            remaining = milliseconds - elapsed;
+        }
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// reset() - Throws away anything that has accumulated
+//============================================================================
+void CCoalescedEvent::reset()
+{
+    CEvent::reset();
+    uint64_t counts[coalesced_state_t::MAX_SOURCES];
+    take(counts);
+}
+//============================================================================
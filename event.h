@@ -3,6 +3,7 @@
 //============================================================================
 #pragma once
 #include <cstdint>
+#include <atomic>
 
 
 //============================================================================
@@ -37,6 +38,28 @@ public:
     // Returns the event file descriptor for use with "select"
     int     fd() {return m_fd;}
 
+    // Closes our eventfd and takes ownership of another one instead (i.e.,
+    // one that was inherited across exec() or received from another process)
+    void    adopt(int fd);
+
+    // Controls whether the eventfd survives an exec().  It always survives
+    // a fork(), and is inheritable by default
+    bool    set_inheritable(bool flag);
+
+    // Sends the eventfd to another process over a connected Unix-domain
+    // socket.  The other process calls receive_from()
+    bool    send_to(int socket_fd);
+
+    // Receives an eventfd sent with send_to() and adopts it
+    bool    receive_from(int socket_fd);
+
+    // Sends file descriptors over a connected Unix-domain socket
+    static bool send_fds(int socket_fd, const int* fds, int count);
+
+    // Receives file descriptors sent with send_fds().  Returns the number
+    // received, or -1 on error
+    static int  receive_fds(int socket_fd, int* fds, int max_fds);
+
 
 protected:
 
@@ -44,3 +67,104 @@ protected:
 
 };
 //============================================================================
+
+
+//============================================================================
+// coalesced_state_t - The state shared between the producers and consumer
+//                     of a CCoalescedEvent.  It can live in memory that is
+//                     shared between processes, so long as it starts out
+//                     zeroed
+//============================================================================
+struct coalesced_state_t
+{
+    enum {MAX_SOURCES = 64};
+
+    // 1 when the eventfd has been written and the consumer hasn't woken yet
+    std::atomic<uint32_t> signalled;
+
+    // One bit per source that has fired since the last wait()
+    std::atomic<uint64_t> bits;
+
+    // Per-source counts accumulated since the last wait()
+    std::atomic<uint64_t> counts[MAX_SOURCES];
+};
+//============================================================================
+
+
+//============================================================================
+// CCoalescedEvent - An event that any number of producers can fire at high
+//                   rates.  Producers set bits and add to per-source counts
+//                   with atomic operations, and only the producer that takes
+//                   the event from "idle" to "signalled" writes the eventfd.
+//                   Everything that happens before the consumer wakes up is
+//                   handed to it by a single wait()
+//
+//                   fd() works with select() and epoll() just as it does
+//                   for CEvent.  When it becomes readable, call wait(1) to
+//                   collect what happened
+//============================================================================
+class CCoalescedEvent : public CEvent
+{
+public:
+
+    // If p_state is null, the event uses its own state.  Otherwise, p_state
+    // must point to zeroed memory that outlives the event
+    CCoalescedEvent(coalesced_state_t* p_state = nullptr);
+
+    // Releases the shared state, if there is any
+    ~CCoalescedEvent();
+
+    // Moves the state into a shared memfd mapping, so that it's shared with
+    // child processes after a fork(), and can be sent with send_to()
+    bool    create_shared();
+
+    // Sends the eventfd and the shared state to another process over a
+    // connected Unix-domain socket.  Call create_shared() first
+    bool    send_to(int socket_fd);
+
+    // Receives an event sent with send_to().  Afterwards, both processes
+    // can fire the event, and either can wait on it
+    bool    receive_from(int socket_fd);
+
+    // Marks the specified sources as having fired
+    void    set_bits(uint64_t mask);
+
+    // Adds to the count for a source (0 thru 63), and marks it as having fired
+    void    add_count(int source, uint64_t count = 1);
+
+    // Waits "milliseconds" for any source to fire.  0 = wait forever.
+    // Returns the bits of the sources that fired, or 0 on timeout.  If
+    // p_counts isn't null, it receives the MAX_SOURCES accumulated counts.
+    // Either way, the bits and counts are reset
+    uint64_t wait(uint32_t milliseconds = 0, uint64_t* p_counts = nullptr);
+
+    // Throws away anything that has accumulated
+    void    reset();
+
+    // Returns the shared state
+    coalesced_state_t* state() {return m_state;}
+
+protected:
+
+    // Producers don't use set() directly
+    using CEvent::set;
+
+    // Wakes the consumer if nobody else already has
+    void    signal();
+
+    // Collects and resets the accumulated bits and counts
+    uint64_t take(uint64_t* p_counts);
+
+    // Maps the shared state from a memfd
+    bool    map_state(int memfd);
+
+    // Our own state, used when the caller doesn't supply any
+    coalesced_state_t  m_own_state;
+
+    // The memfd that holds the shared state, or -1 if it isn't shared
+    int     m_state_fd;
+
+    // The state we're actually using
+    coalesced_state_t* m_state;
+};
+//============================================================================
@@ -0,0 +1,160 @@
+//============================================================================
+// fast_event.cpp - Implements a futex() based event
+//============================================================================
+#include "fast_event.h"
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <thread>
+using namespace std;
+
+
+//============================================================================
+// cpu_relax() - Tells the CPU that we're in a spin-loop
+//============================================================================
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+//============================================================================
+
+
+//============================================================================
+// futex() - The futex system call has no glibc wrapper
+//============================================================================
+static inline long futex(atomic<uint32_t>* addr, int op, uint32_t value, const timespec* timeout)
+{
+    return syscall(SYS_futex, (uint32_t*)addr, op, value, timeout, nullptr, 0);
+}
+//============================================================================
+
+
+//============================================================================
+// Constructor - Creates the event object in the untriggered state
+//============================================================================
+CFastEvent::CFastEvent()
+{
+    m_value      = 0;
+    m_sequence   = 0;
+    m_waiters    = 0;
+
+    // Spinning only helps if the thread calling set() can be running on
+    // another CPU while we spin
+    m_spin_count = (thread::hardware_concurrency() > 1) ? 100 : 0;
+}
+//============================================================================
+
+
+//============================================================================
+// reset() - Resets the event to the untriggered state
+//============================================================================
+void CFastEvent::reset()
+{
+    m_value.store(0, memory_order_release);
+}
+//============================================================================
+
+
+//============================================================================
+// set() - Triggers the event with the specified value
+//============================================================================
+void CFastEvent::set(uint64_t value)
+{
+    // Add the value to the event
+    m_value.fetch_add(value, memory_order_seq_cst);
+
+    // If nobody is asleep, we're done.  This is the common case, and it
+    // costs no system call
+    if (m_waiters.load(memory_order_seq_cst) == 0) return;
+
+    // Change the futex word so that a waiter on its way to sleep doesn't,
+    // then wake up everyone who is already asleep
+    m_sequence.fetch_add(1, memory_order_seq_cst);
+    futex(&m_sequence, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr);
+}
+//============================================================================
+
+
+//============================================================================
+// take() - Fetches the event value and resets it to zero, or returns zero if
+//          the event isn't triggered
+//============================================================================
+uint64_t CFastEvent::take()
+{
+    if (m_value.load(memory_order_relaxed) == 0) return 0;
+    return m_value.exchange(0, memory_order_acquire);
+}
+//============================================================================
+
+
+//============================================================================
+// wait() - Waits the specified number of milliseconds for the event to
+//          become triggered.
+//
+// Passed:  milliseconds = number of milliseconds to wait.  0 = Forever
+//
+// Returns: The event value, or 0 if the event is untriggered
+//============================================================================
+uint64_t CFastEvent::wait(uint32_t milliseconds)
+{
+    uint64_t value;
+    timespec now, deadline, remaining;
+
+    // If the event is already triggered, we're done
+    if ((value = take()) != 0) return value;
+
+    // Spin for a little while, in case it's about to be triggered
+    for (int i = 0; i < m_spin_count; ++i)
+    {
+        cpu_relax();
+        if ((value = take()) != 0) return value;
+    }
+
+    // Figure out when we give up
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec  += milliseconds / 1000;
+    deadline.tv_nsec += (milliseconds % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {deadline.tv_sec++; deadline.tv_nsec -= 1000000000;}
+
+    // Let set() know that there's someone who needs waking
+    m_waiters.fetch_add(1, memory_order_seq_cst);
+
+    while (true)
+    {
+        // Fetch the futex word before the final check of the value.  If
+        // set() happens after this, the futex word will have changed and
+        // the kernel won't let us sleep
+        uint32_t sequence = m_sequence.load(memory_order_seq_cst);
+
+        // If the event was triggered, we're done
+        if ((value = take()) != 0) break;
+
+        // If there's a timeout, figure out how much of it is left
+        const timespec* p_timeout = nullptr;
+        if (milliseconds)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remaining.tv_sec  = deadline.tv_sec  - now.tv_sec;
+            remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (remaining.tv_nsec < 0) {remaining.tv_sec--; remaining.tv_nsec += 1000000000;}
+            if (remaining.tv_sec < 0) break;
+            p_timeout = &remaining;
+        }
+
+        // Go to sleep until set() changes the futex word
+        futex(&m_sequence, FUTEX_WAIT_PRIVATE, sequence, p_timeout);
+    }
+
+    // We're no longer waiting
+    m_waiters.fetch_sub(1, memory_order_seq_cst);
+
+    // Hand the caller the event value
+    return value;
+}
+//============================================================================
@@ -0,0 +1,63 @@
+//============================================================================
+// fast_event.h - Defines a futex() based event for use between threads of
+//                the same process
+//============================================================================
+#pragma once
+#include <cstdint>
+#include <atomic>
+
+
+//============================================================================
+// CFastEvent - Has the same semantics as CEvent, but set() and wait() only
+//              make a system call when a waiter actually has to sleep.
+//              When the event is already triggered, or becomes triggered
+//              while the waiter is spinning, nobody enters the kernel.
+//
+//              CFastEvent has no file descriptor, so it can't be used with
+//              select() or epoll().  Use CEvent for that.
+//============================================================================
+class CFastEvent
+{
+public:
+
+    // Constructs an event object in the "untriggered" state
+    CFastEvent();
+
+    // Resets the event to the "untriggered" state
+    void    reset();
+
+    // Triggers the event with the specified value.  If the event is already
+    // triggered, this will be added to the existing event value
+    void    set(uint64_t value = 1);
+
+    // Wait "milliseconds" for the event to become triggered.  Returns either
+    // the triggered value, or zero if the event hasn't happened yet.  If the
+    // return value is non-zero, the event is automatically reset to the
+    // "untriggered" state.  If milliseconds is 0, it will wait forever
+    uint64_t wait(uint32_t milliseconds = 0);
+
+    // Returns 'true' if the event is in the "triggered" state
+    bool    is_triggered() {return m_value.load(std::memory_order_acquire) != 0;}
+
+    // Sets the number of times wait() polls the event before going to sleep
+    void    set_spin_count(int count) {m_spin_count = count;}
+
+protected:
+
+    // Atomically fetches and clears the event value
+    uint64_t take();
+
+    // The event value
+    std::atomic<uint64_t> m_value;
+
+    // The futex word.  set() bumps this before waking sleepers, so that a
+    // waiter that was about to sleep notices the change
+    std::atomic<uint32_t> m_sequence;
+
+    // The number of threads that are (or are about to be) asleep
+    std::atomic<uint32_t> m_waiters;
+
+    // How many times wait() polls before sleeping
+    int     m_spin_count;
+};
+//============================================================================
@@ -2,11 +2,15 @@
 // netsock.cpp - Implements a network socket
 //==========================================================================================================
 #include <unistd.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <string.h>
 #include <signal.h>
 #include <netdb.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/tcp.h>
@@ -24,7 +28,11 @@ NetSock::NetSock()
     m_sd = -1;
 
     // This socket has not yet been created
-    m_is_created = false;
+    m_is_created  = false;
+    m_is_listener = false;
+
+    // Nothing has timed out yet
+    m_timed_out = false;
 }
 //==========================================================================================================
 
@@ -34,10 +42,12 @@ NetSock::NetSock()
 //==========================================================================================================
 void NetSock::copy_object(const NetSock& rhs)
 {
-    m_sd         = rhs.m_sd;
-    m_is_created = rhs.m_is_created;
-    m_error      = rhs.m_error;
-    m_error_str  = rhs.m_error_str;
+    m_sd          = rhs.m_sd;
+    m_is_created  = rhs.m_is_created;
+    m_is_listener = rhs.m_is_listener;
+    m_tuning      = rhs.m_tuning;
+    m_error       = rhs.m_error;
+    m_error_str   = rhs.m_error_str;
 }
 //==========================================================================================================
 
@@ -49,6 +59,7 @@ void NetSock::close()
 {
     if (m_sd >= 0) ::close(m_sd);
     m_sd = -1;
+    m_is_listener = false;
 }
 //==========================================================================================================
 
@@ -91,14 +102,36 @@ bool NetSock::connect(std::string server, int port)
         return false;
     }
 
-    // Save a copy of the results
-    struct addrinfo res = *p_res;
+    // Create the socket and connect it to the first address getaddrinfo handed us
+    bool status = connect(p_res->ai_addr, p_res->ai_addrlen);
 
     // Free the memory that was allocated by getaddrinfo
     freeaddrinfo(p_res);
 
+    // If the connection failed, make the error message mention the server by name
+    if (!status && m_error == CANT_CONNECT) m_error_str = "can't connect to "+server;
+
+    // Tell the caller whether we have a connected socket
+    return status;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// connect() - Creates the socket and connects it to an already-resolved server address
+//
+// This is what connection pools use to skip getaddrinfo() on every connection
+//==========================================================================================================
+bool NetSock::connect(const sockaddr* addr, socklen_t addr_len)
+{
+    // The socket is not yet created
+    m_is_created = false;
+
+    // Close this socket if it happens to be open
+    close();
+
     // Create the socket
-    m_sd = socket(res.ai_family, res.ai_socktype, res.ai_protocol);
+    m_sd = socket(addr->sa_family, SOCK_STREAM, 0);
 
     // If the socket() call fails, complain
     if (m_sd < 0)
@@ -108,15 +141,21 @@ bool NetSock::connect(std::string server, int port)
         return false;
     }
 
+    // Apply the options that have to be in place before the handshake (buffer sizes, fast-open, etc)
+    apply_tuning(TS_PRE_CONNECT, m_sd);
+
     // Attempt to connect to the server
-    if (::connect(m_sd, res.ai_addr, res.ai_addrlen) < 0)
+    if (::connect(m_sd, addr, addr_len) < 0)
     {
-        m_error_str = "can't connect to "+server;
-        m_error     = GETADDRINFO_FAILED;
+        m_error_str = "can't connect to server";
+        m_error     = CANT_CONNECT;
         close();
         return false;
     }
 
+    // Apply the options for a connected socket
+    apply_tuning(TS_CONNECTED, m_sd);
+
     // If we get here, we have a connected socket
     return true;
 }
@@ -196,6 +235,9 @@ bool NetSock::create_server(int port, string bind_to, int family)
     int optval = 1;
     setsockopt(m_sd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
 
+    // Apply the options that accepted sockets will inherit from the listening socket
+    apply_tuning(TS_LISTENER, m_sd);
+
     // Bind it to the port we passed in to getaddrinfo():
     if (bind(m_sd, res.ai_addr, res.ai_addrlen) < 0)
     {
@@ -205,8 +247,9 @@ bool NetSock::create_server(int port, string bind_to, int family)
         return false;
     }
 
-    // This socket has been created
-    m_is_created = true;
+    // This socket has been created, and it's a listener until it accepts a connection in place
+    m_is_created  = true;
+    m_is_listener = true;
 
     // Tell the caller that all is well
     return true;
@@ -245,18 +288,23 @@ bool NetSock::listen_and_accept(NetSock* new_sock)
         return false;
     }
 
+    // Apply the options for a connected socket
+    apply_tuning(TS_CONNECTED, new_sd);
+
     // If the caller passed us a socket object to clone ourselves into...
     if (new_sock)
     {
         *new_sock = *this;
-        new_sock->m_sd = new_sd;
+        new_sock->m_sd          = new_sd;
+        new_sock->m_is_listener = false;
     }
 
     // Otherwise, the new socket-descriptor is the one we'll read and write on
     else
     {
         ::close(m_sd);
-        m_sd = new_sd;        
+        m_sd          = new_sd;
+        m_is_listener = false;
     }
 
     // Tell the caller that all is well
@@ -301,6 +349,171 @@ void NetSock::set_nagling(bool flag)
 //==========================================================================================================
 
 
+//==========================================================================================================
+// set_tuning() - Sets the tuning profile for this socket.  If the socket is already connected (including
+//                a server socket that accepted a connection in place), the per-connection options are
+//                applied right away
+//==========================================================================================================
+void NetSock::set_tuning(const NetSockTuning& tuning)
+{
+    m_tuning = tuning;
+    if (m_sd >= 0 && !m_is_listener) apply_tuning(TS_CONNECTED, m_sd);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// apply_tuning() - Applies the options in m_tuning that are appropriate for the specified stage
+//
+// Passed:  stage = TS_LISTENER    : A server socket, before bind().  Accepted sockets inherit these
+//                  TS_PRE_CONNECT : A client socket, before connect()
+//                  TS_CONNECTED   : A socket that has just been connected or accepted
+//          sd    = The socket descriptor to apply the options to
+//
+// Options that fail (an old kernel, or no CAP_NET_ADMIN for busy-polling) are quietly ignored
+//==========================================================================================================
+void NetSock::apply_tuning(tuning_stage_t stage, int sd)
+{
+    const NetSockTuning& t = m_tuning;
+
+    // Buffer sizes have to be set before the handshake so the right TCP window-scale gets negotiated
+    if (stage != TS_CONNECTED)
+    {
+        if (t.rcvbuf != -1) setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &t.rcvbuf, sizeof t.rcvbuf);
+        if (t.sndbuf != -1) setsockopt(sd, SOL_SOCKET, SO_SNDBUF, &t.sndbuf, sizeof t.sndbuf);
+    }
+
+    // A listening socket is where the server side of TCP fast-open gets turned on
+    if (stage == TS_LISTENER && t.fastopen > 0)
+    {
+        setsockopt(sd, IPPROTO_TCP, TCP_FASTOPEN, &t.fastopen, sizeof t.fastopen);
+    }
+
+    // The client side of TCP fast-open has to be turned on before connect()
+#ifdef TCP_FASTOPEN_CONNECT
+    if (stage == TS_PRE_CONNECT && t.fastopen > 0)
+    {
+        int optval = 1;
+        setsockopt(sd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &optval, sizeof optval);
+    }
+#endif
+
+    // The remaining options are per-connection
+    if (stage != TS_CONNECTED) return;
+
+    if (t.nodelay         != -1) setsockopt(sd, IPPROTO_TCP, TCP_NODELAY,      &t.nodelay,         sizeof(int));
+    if (t.quickack        != -1) setsockopt(sd, IPPROTO_TCP, TCP_QUICKACK,     &t.quickack,        sizeof(int));
+    if (t.user_timeout_ms != -1) setsockopt(sd, IPPROTO_TCP, TCP_USER_TIMEOUT, &t.user_timeout_ms, sizeof(int));
+    if (t.busy_poll_us    != -1) setsockopt(sd, SOL_SOCKET,  SO_BUSY_POLL,     &t.busy_poll_us,    sizeof(int));
+
+    // The type-of-service byte is IP_TOS on IPv4, and the traffic class on IPv6
+    if (t.tos != -1)
+    {
+        sockaddr_storage addr;
+        socklen_t addr_len = sizeof addr;
+        bool is_ipv6 = getsockname(sd, (sockaddr*)&addr, &addr_len) == 0 && addr.ss_family == AF_INET6;
+
+        // An IPv6 socket can carry IPv4-mapped traffic, which still uses IP_TOS
+        if (is_ipv6) setsockopt(sd, IPPROTO_IPV6, IPV6_TCLASS, &t.tos, sizeof(int));
+        setsockopt(sd, IPPROTO_IP, IP_TOS, &t.tos, sizeof(int));
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// rearm_quickack() - Puts the socket back into quick-ACK mode if the tuning profile asks for it
+//
+// TCP_QUICKACK isn't sticky: the kernel falls back to delayed ACKs on its own, so this gets called once
+// at the end of each receive(), receive_for() and getline() call that pulled data off the socket
+//==========================================================================================================
+void NetSock::rearm_quickack()
+{
+    if (m_tuning.quickack == 1) setsockopt(m_sd, IPPROTO_TCP, TCP_QUICKACK, &m_tuning.quickack, sizeof(int));
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_blocking() - Puts the socket into blocking or non-blocking mode
+//
+// In non-blocking mode, receive() and send() return -1 immediately instead of waiting.  getline() and
+// the "_for()" functions work in either mode.
+//==========================================================================================================
+void NetSock::set_blocking(bool flag)
+{
+    int flags = fcntl(m_sd, F_GETFL, 0);
+    if (flags < 0) return;
+    fcntl(m_sd, F_SETFL, flag ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_timeouts() - Sets the kernel-side timeouts on blocking socket I/O.  When one of these expires,
+//                  receive() or send() returns -1
+//
+// Passed:  recv_timeout_ms = Timeout for receiving data.  0 = Wait forever
+//          send_timeout_ms = Timeout for sending data.    0 = Wait forever
+//==========================================================================================================
+void NetSock::set_timeouts(int recv_timeout_ms, int send_timeout_ms)
+{
+    timeval rcv = {recv_timeout_ms / 1000, (recv_timeout_ms % 1000) * 1000};
+    timeval snd = {send_timeout_ms / 1000, (send_timeout_ms % 1000) * 1000};
+    setsockopt(m_sd, SOL_SOCKET, SO_RCVTIMEO, &rcv, sizeof rcv);
+    setsockopt(m_sd, SOL_SOCKET, SO_SNDTIMEO, &snd, sizeof snd);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_keepalive() - Turns TCP keepalive probes on or off for this socket
+//
+// Passed:  flag          = true to turn keepalive on
+//          idle_secs     = Seconds of idle time before the first probe is sent   (0 = system default)
+//          interval_secs = Seconds between probes                                (0 = system default)
+//          count         = Unanswered probes before the connection is dropped   (0 = system default)
+//==========================================================================================================
+void NetSock::set_keepalive(bool flag, int idle_secs, int interval_secs, int count)
+{
+    int optval = flag;
+    setsockopt(m_sd, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof optval);
+
+    // If keepalive is off, the timing parameters don't matter
+    if (!flag) return;
+
+    // Set up the timing of the keepalive probes
+    if (idle_secs    ) setsockopt(m_sd, IPPROTO_TCP, TCP_KEEPIDLE,  &idle_secs,     sizeof idle_secs);
+    if (interval_secs) setsockopt(m_sd, IPPROTO_TCP, TCP_KEEPINTVL, &interval_secs, sizeof interval_secs);
+    if (count        ) setsockopt(m_sd, IPPROTO_TCP, TCP_KEEPCNT,   &count,         sizeof count);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// is_alive() - Checks whether a connected socket is still usable, without blocking
+//
+// Returns: 'false' if the socket isn't open, or if the other side has closed or reset the connection
+//==========================================================================================================
+bool NetSock::is_alive()
+{
+    char c;
+
+    // If the socket isn't open, it certainly isn't alive
+    if (m_sd < 0) return false;
+
+    // Peek at the socket without waiting.  Zero bytes means the other side closed the connection
+    int status = recv(m_sd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    // If there's data waiting to be read, the connection is alive
+    if (status > 0) return true;
+
+    // If there's simply nothing to read right now, the connection is alive
+    return (status < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+//==========================================================================================================
+
+
 //==========================================================================================================
 // wait_for_data() - Waits for the specified amount of time for data to be available for reading
 //
@@ -330,6 +543,9 @@ bool NetSock::wait_for_data(int timeout_ms)
         pTimeout = &timeout;
     }
 
+    // If there's data buffered above the socket, there's no need to wait
+    if (io_pending()) return true;
+
     // We'll wait on input from the file descriptor
     FD_ZERO(&rfds);
     FD_SET(m_sd, &rfds);
@@ -350,7 +566,7 @@ int NetSock::bytes_available()
 {
     int count = 0;
     ioctl(m_sd, FIONREAD, &count);
-    return count;
+    return count + io_pending();
 }
 //==========================================================================================================
 
@@ -385,7 +601,7 @@ int NetSock::receive(void* buffer, int length, bool peek)
     while (bytes_remaining)
     {
         // Fetch some bytes from the socket
-        int bytes_rcvd = recv(m_sd, ptr, bytes_remaining, flags);
+        int bytes_rcvd = io_recv(ptr, bytes_remaining, flags);
 
         // If the read failed, tell the caller
         if (bytes_rcvd < 0) return -1;
@@ -398,6 +614,9 @@ int NetSock::receive(void* buffer, int length, bool peek)
         bytes_remaining -= bytes_rcvd;
     }
 
+    // If we took data off the socket, go back to acknowledging it right away
+    if (!peek) rearm_quickack();
+
     // Tell the caller that we received all of the data they wanted
     return length;
 }
@@ -411,22 +630,82 @@ int NetSock::receive(void* buffer, int length, bool peek)
 //==========================================================================================================
 bool NetSock::getline(void* buffer, size_t buff_size)
 {
-    char c, *ptr, *origin;
+    bool eol = false;
 
     // Don't let the caller pass us a buffer size of zero
     if (buff_size == 0) return false;
 
-    // Reduce the buffer size by 1 to allow for appending the nul-byte to the end of it
-    --buff_size;
+    // Loop until either an error or until we see a linefeed.  These are plain blocking reads, so the
+    // timeouts from set_timeouts() apply
+    while (!eol)
+    {
+        // Fetch whatever part of the line is available, waiting for some if need be
+        int status = read_line_chunk(buff_size - 1, 0, &eol);
 
-    // Get a byte pointer to the caller's buffer
-    origin = ptr = (char*) buffer;
+        // If there's nothing available...
+        if (status < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // If the socket is in non-blocking mode, wait for something to arrive
+            if (fcntl(m_sd, F_GETFL, 0) & O_NONBLOCK)
+            {
+                wait_for_io(POLLIN, chrono::steady_clock::now(), true);
+                continue;
+            }
+
+            // Otherwise, the receive timeout expired.  Keep the partial line for the next call
+            return false;
+        }
 
-    // Loop until either an error or until we see a linefeed
-    while (true)
+        // If the socket closed or failed, the partial line is never going to be finished
+        if (status < 1)
+        {
+            m_partial_line.clear();
+            return false;
+        }
+    }
+
+    // Hand the line to the caller
+    return finish_line(buffer);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// read_line_chunk() - Appends whatever is waiting on the socket, up to and including the next linefeed,
+//                     to m_partial_line
+//
+// We peek at the data to find the end of the line, then consume just that much.  That way a whole line
+// costs a couple of reads instead of one per byte, and nothing past the linefeed is taken off the socket
+//
+// Passed:  max_len = The longest line the caller can accept.  Anything past that is thrown away
+//          flags   = 0 to block until data arrives, MSG_DONTWAIT to return -1/EAGAIN if there isn't any
+//          p_eol   = Set to true if we reached the end of the line
+//
+// Returns: The number of bytes consumed, 0 if the socket closed, or -1 on error
+//==========================================================================================================
+int NetSock::read_line_chunk(size_t max_len, int flags, bool* p_eol)
+{
+    char chunk[1024];
+
+    // We haven't found the end of the line yet
+    *p_eol = false;
+
+    // Find out what's waiting for us
+    int status = io_recv(chunk, sizeof chunk, flags | MSG_PEEK);
+    if (status < 1) return status;
+
+    // We'll consume up to and including the linefeed, if there is one
+    char* lf = (char*)memchr(chunk, '\n', status);
+    if (lf) status = lf - chunk + 1;
+
+    // Take those bytes off the socket
+    status = io_recv(chunk, status, flags);
+    if (status < 1) return status;
+
+    // Loop through each character we received...
+    for (int i=0; i<status; ++i)
     {
-        // Fetch a single byte from the socket
-        if (recv(m_sd, &c, 1, 0) < 1) return false;
+        char c = chunk[i];
 
         // If it's a carriage-return, throw it away
         if (c == '\r') continue;
@@ -434,26 +713,200 @@ bool NetSock::getline(void* buffer, size_t buff_size)
         // Handle backspace, in case the client is a human-being typing
         if (c == 8)
         {
-            if (ptr > origin) --ptr;
-            continue;            
+            if (!m_partial_line.empty()) m_partial_line.pop_back();
+            continue;
         }
 
         // If it's a line-feed, it's the end of the line
-        if (c == '\n') break;
+        if (c == '\n')
+        {
+            *p_eol = true;
+            break;
+        }
 
-        // If this character will fit into the caller's buffer, append it there
-        if ((ptr - origin) < buff_size) *ptr++ = c;
+        // If this character will fit into the caller's buffer, append it to the line
+        if (m_partial_line.size() < max_len) m_partial_line += c;
     }
 
-    // We've encountered the end of the line.  Terminate the output string
-    *ptr = 0;
+    // Tell the caller how many bytes we consumed
+    return status;
+}
+//==========================================================================================================
 
-    // And tell the caller that he has a line of data waiting in his buffer
+
+//==========================================================================================================
+// finish_line() - Hands the line in m_partial_line to the caller as a nul-terminated string
+//==========================================================================================================
+bool NetSock::finish_line(void* buffer)
+{
+    // Copy the line into the caller's buffer
+    memcpy(buffer, m_partial_line.c_str(), m_partial_line.size() + 1);
+
+    // The next line starts out empty
+    m_partial_line.clear();
+
+    // Go back to acknowledging incoming data right away
+    rearm_quickack();
+
+    // And tell the caller that they have a line of data waiting in their buffer
     return true;
 }
 //==========================================================================================================
 
 
+//==========================================================================================================
+// wait_for_io() - Waits for the socket to become readable or writeable
+//
+// Passed:  events   = POLLIN or POLLOUT
+//          deadline = The time at which we give up
+//          forever  = If true, 'deadline' is ignored and we wait forever
+//
+// Returns: 'true' if the socket is ready, 'false' if the deadline passed first
+//==========================================================================================================
+bool NetSock::wait_for_io(short events, chrono::steady_clock::time_point deadline, bool forever)
+{
+    // If we're waiting to read and there's already data buffered above the socket, we're ready
+    if ((events & POLLIN) && io_pending()) return true;
+
+    // We're waiting on just the one socket
+    pollfd pfd = {m_sd, events, 0};
+
+    while (true)
+    {
+        // Assume for the moment that we are going to wait forever
+        int timeout_ms = -1;
+
+        // If we're not waiting forever, find out how much time is left before the deadline
+        if (!forever)
+        {
+            auto remaining = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+            timeout_ms = remaining.count() > 0 ? remaining.count() : 0;
+        }
+
+        // Wait for the socket to become ready
+        int status = poll(&pfd, 1, timeout_ms);
+
+        // If the socket is ready (or has hung up, which the caller will find out about), we're done
+        if (status > 0) return true;
+
+        // If we timed out, tell the caller
+        if (status == 0) return false;
+
+        // If poll() was interrupted by a signal, go back and wait some more
+        if (errno != EINTR) return true;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive_for() - Receives data from the socket, giving up when the timeout expires
+//
+// Passed:  buffer     = Pointer to the place to store the received data
+//          length     = The number of bytes to read in
+//          timeout_ms = The maximum time to spend receiving.  -1 = Wait forever
+//
+// Returns: The number of bytes that were read, which may be less than 'length' if the timeout expired
+//          (timed_out() is true) or the socket was closed (timed_out() is false)
+//             -- or -- -1 = An error occured
+//==========================================================================================================
+int NetSock::receive_for(void* buffer, int length, int timeout_ms)
+{
+    // Find out when we give up
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+
+    // Nothing has timed out yet
+    m_timed_out = false;
+
+    // Get a byte-pointer to the caller's buffer
+    unsigned char* ptr = (unsigned char*)buffer;
+
+    // Keep track of how many bytes we have left to read
+    int bytes_remaining = length;
+
+    // Loop until there are no more bytes to read...
+    while (bytes_remaining)
+    {
+        // Fetch whatever bytes are available right now
+        int bytes_rcvd = io_recv(ptr, bytes_remaining, MSG_DONTWAIT);
+
+        // If there's nothing available, wait for some to arrive
+        if (bytes_rcvd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if (wait_for_io(POLLIN, deadline, timeout_ms == -1)) continue;
+            m_timed_out = true;
+            break;
+        }
+
+        // If the read failed, tell the caller
+        if (bytes_rcvd < 0) return -1;
+
+        // If the socket is closed, we're done
+        if (bytes_rcvd == 0) break;
+
+        // Adjust our pointer and the number of bytes remaining to be read
+        ptr             += bytes_rcvd;
+        bytes_remaining -= bytes_rcvd;
+    }
+
+    // If we took data off the socket, go back to acknowledging it right away
+    if (bytes_remaining < length) rearm_quickack();
+
+    // Tell the caller how many bytes we received
+    return (length - bytes_remaining);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// getline_for() - Fetches a line of text from the socket, giving up when the timeout expires
+//
+// The result buffer doesn't include the terminating carriage-return/linefeed.  If the timeout expires
+// in the middle of a line, the partial line is kept and the next call picks up where this one left off
+//
+// Returns: 'true' if a line was fetched.  If 'false', timed_out() tells you whether the timeout expired
+//==========================================================================================================
+bool NetSock::getline_for(void* buffer, size_t buff_size, int timeout_ms)
+{
+    bool eol = false;
+
+    // Find out when we give up
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+
+    // Nothing has timed out yet
+    m_timed_out = false;
+
+    // Don't let the caller pass us a buffer size of zero
+    if (buff_size == 0) return false;
+
+    // Loop until either an error or until we see a linefeed
+    while (!eol)
+    {
+        // Fetch whatever part of the line is available right now
+        int status = read_line_chunk(buff_size - 1, MSG_DONTWAIT, &eol);
+
+        // If there's nothing available, wait for something to arrive
+        if (status < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if (wait_for_io(POLLIN, deadline, timeout_ms == -1)) continue;
+            m_timed_out = true;
+            return false;
+        }
+
+        // If the socket closed or failed, the partial line is never going to be finished
+        if (status < 1)
+        {
+            m_partial_line.clear();
+            return false;
+        }
+    }
+
+    // Hand the line to the caller
+    return finish_line(buffer);
+}
+//==========================================================================================================
+
+
 //==========================================================================================================
 // send() - Sends a string to the other side of a connected socket
 //
@@ -490,7 +943,99 @@ int NetSock::send(const void* buffer, int length)
     while (bytes_remaining)
     {
         // Attempt to send all of the bytes
-        int sent = ::send(m_sd, ptr, bytes_remaining, MSG_NOSIGNAL);
+        int sent = io_send(ptr, bytes_remaining, 0);
+
+        // If an error occured, tell the caller
+        if (sent < 0) return -1;
+
+        // If the socket is closed, we're done
+        if (sent == 0) break;
+
+        // Adjust the pointer and the count of bytes remaining to be sent
+        ptr             += sent;
+        bytes_remaining -= sent;
+    }
+
+    // Tell the caller how many bytes we sent
+    return (length - bytes_remaining);
+}
+//==========================================================================================================
+
+
+
+//==========================================================================================================
+// send_file() - Sends part of a file to the other side of a connected socket using sendfile(), so the
+//               data never gets copied through user-space
+//
+// Passed:  fd     = An open file descriptor
+//          offset = The offset within the file of the first byte to send
+//          count  = The number of bytes to send
+//
+// Returns either : -1 = An error occured
+//                  Anything else = the number of bytes actually sent
+//==========================================================================================================
+int64_t NetSock::send_file(int fd, off_t offset, size_t count)
+{
+    // Keep track of how many bytes remain to be sent
+    size_t bytes_remaining = count;
+
+    // Loop until there are no more bytes to send...
+    while (bytes_remaining)
+    {
+        // Have the kernel send as much as it can.  This advances 'offset'
+        ssize_t sent = sendfile(m_sd, fd, &offset, bytes_remaining);
+
+        // If an error occured, tell the caller
+        if (sent < 0) return -1;
+
+        // If we've hit end-of-file, we're done
+        if (sent == 0) break;
+
+        // Adjust the count of bytes remaining to be sent
+        bytes_remaining -= sent;
+    }
+
+    // Tell the caller how many bytes we sent
+    return (count - bytes_remaining);
+}
+//==========================================================================================================
+
+
+
+//==========================================================================================================
+// send_for() - Sends a buffer to the other side of a connected socket, giving up when the timeout expires
+//
+// Returns either : -1 = An error occured
+//                  Anything else = the number of bytes actually sent.  If this is less than 'length',
+//                  timed_out() tells you whether the timeout expired
+//==========================================================================================================
+int NetSock::send_for(const void* buffer, int length, int timeout_ms)
+{
+    // Find out when we give up
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+
+    // Nothing has timed out yet
+    m_timed_out = false;
+
+    // Get a byte pointer to the caller's buffer
+    unsigned char* ptr = (unsigned char*)buffer;
+
+    // Keep track of how many bytes remain to be sent
+    int bytes_remaining = length;
+
+    // Loop until there are no more bytes to send...
+    while (bytes_remaining)
+    {
+        // Send as many bytes as the socket will take right now
+        int sent = io_send(ptr, bytes_remaining, MSG_DONTWAIT);
+
+        // If the socket buffer is full, wait for room
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if (wait_for_io(POLLOUT, deadline, timeout_ms == -1)) continue;
+            m_timed_out = true;
+            break;
+        }
 
         // If an error occured, tell the caller
         if (sent < 0) return -1;
@@ -540,6 +1085,27 @@ int NetSock::sendf(const char* fmt, ...)
 
 
 
+//==========================================================================================================
+// io_recv() - Reads raw data from the socket.  Same return values as recv()
+//==========================================================================================================
+int NetSock::io_recv(void* buffer, int length, int flags)
+{
+    return recv(m_sd, buffer, length, flags);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// io_send() - Writes raw data to the socket.  Same return values as send()
+//==========================================================================================================
+int NetSock::io_send(const void* buffer, int length, int flags)
+{
+    return ::send(m_sd, buffer, length, flags | MSG_NOSIGNAL);
+}
+//==========================================================================================================
+
+
+
 //==========================================================================================================
 // get_error() - Returns information about the most recent failure
 //==========================================================================================================
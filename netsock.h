@@ -3,7 +3,11 @@
 //==========================================================================================================
 #pragma once
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
 #include <string>
+#include <chrono>
+#include "netsock_tuning.h"
 
 class NetSock
 {
@@ -24,7 +28,7 @@ public:
 
     // Constructor and Destructor
     NetSock();
-    ~NetSock() {close();}
+    virtual ~NetSock() {close();}
 
     // Copy constructor
     NetSock(const NetSock& rhs) {copy_object(rhs);}
@@ -41,9 +45,27 @@ public:
     // Call this to connect to a server
     bool    connect(std::string server_name, int port);
 
+    // Call this to connect to a server whose address has already been resolved
+    bool    connect(const sockaddr* addr, socklen_t addr_len);
+
     // Call this to turn Nagle's algorithm on or off
     void    set_nagling(bool flag);
 
+    // Call this to set the tuning profile applied by create_server(), connect() and listen_and_accept()
+    void    set_tuning(const NetSockTuning& tuning);
+
+    // Call this to put the socket in blocking or non-blocking mode
+    void    set_blocking(bool flag);
+
+    // Call this to set kernel-side timeouts (SO_RCVTIMEO/SO_SNDTIMEO) on ordinary receive() and send()
+    void    set_timeouts(int recv_timeout_ms, int send_timeout_ms);
+
+    // Call this to turn TCP keepalive on or off.  Zeros leave the system defaults in place
+    void    set_keepalive(bool flag, int idle_secs = 0, int interval_secs = 0, int count = 0);
+
+    // Cheaply checks that a connected socket hasn't been closed by the other side
+    bool    is_alive();
+
     // After an "accept()", call this to find the IP address of the client
     std::string get_peer_address(int family = AF_INET);
 
@@ -59,15 +81,27 @@ public:
     // Call this to fetch a line of text from the socket
     bool    getline(void* buffer, size_t buff_size);
 
+    // These are like receive(), getline() and send(), but give up when the timeout expires.  After
+    // they return, timed_out() tells you whether they stopped short because the timeout expired
+    int     receive_for(void* buffer, int length, int timeout_ms);
+    bool    getline_for(void* buffer, size_t buff_size, int timeout_ms);
+    int     send_for(const void* buffer, int length, int timeout_ms);
+
+    // Returns 'true' if the most recent receive_for(), getline_for() or send_for() timed out
+    bool    timed_out() {return m_timed_out;}
+
     // Call these to send a string or buffer full of data
     int     send(std::string s);
     int     send(const void* buffer, int length);
 
+    // Call this to send 'count' bytes of a file, starting at 'offset', without copying through user-space
+    virtual int64_t send_file(int fd, off_t offset, size_t count);
+
     // Call this to send data using print-style formatting
     int     sendf(const char* fmt, ...);
 
     // Call this to close this socket.  Safe to call if socket isn't open
-    void    close();
+    virtual void close();
 
     // When connect(), create() (etc) fail, this will give information about the error
     int     get_error(std::string* p_str = nullptr);
@@ -77,6 +111,39 @@ protected:
     // Copy another object of this type
     void    copy_object(const NetSock& rhs);
 
+    // These are the primitives that all socket I/O goes through.  Derived classes (such as TlsSock)
+    // over-ride them to put a protocol layer between the socket and the caller
+    virtual int io_recv(void* buffer, int length, int flags);
+    virtual int io_send(const void* buffer, int length, int flags);
+
+    // Returns the number of bytes buffered above the socket that are available for reading
+    virtual int io_pending() {return 0;}
+
+    // These are the points in a socket's life at which tuning options get applied
+    enum tuning_stage_t {TS_LISTENER, TS_PRE_CONNECT, TS_CONNECTED};
+
+    // Applies the options in m_tuning that are appropriate to the specified stage
+    void    apply_tuning(tuning_stage_t stage, int sd);
+
+    // The kernel drops out of quick-ACK mode on its own, so this turns it back on after each receive call
+    void    rearm_quickack();
+
+    // The tuning options for this socket
+    NetSockTuning m_tuning;
+
+    // Waits until the socket is ready for reading (POLLIN) or writing (POLLOUT), or the deadline passes
+    bool    wait_for_io(short events, std::chrono::steady_clock::time_point deadline, bool forever);
+
+    // This is true if the most recent "_for()" call timed out
+    bool    m_timed_out;
+
+    // Appends the waiting part of a line to m_partial_line, and hands a finished line to the caller
+    int     read_line_chunk(size_t max_len, int flags, bool* p_eol);
+    bool    finish_line(void* buffer);
+
+    // The part of a line that getline() or getline_for() has received so far
+    std::string m_partial_line;
+
     // Most recent error
     std::string m_error_str;
     int     m_error;
@@ -84,6 +151,9 @@ protected:
     // This will be true on a socket for which create_server() or connect() has been called
     bool    m_is_created;
 
+    // This is true while m_sd is a server socket that hasn't yet accepted a connection in place
+    bool    m_is_listener;
+
     // The socket descriptor of our socket
     int     m_sd;
 };
\ No newline at end of file
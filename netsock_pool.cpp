@@ -0,0 +1,426 @@
+//==========================================================================================================
+// netsock_pool.cpp - Implements a pool of re-usable outbound NetSock connections
+//==========================================================================================================
+#include <string.h>
+#include <netdb.h>
+#include "netsock_pool.h"
+using namespace std;
+
+//==========================================================================================================
+// Constructor - Sets up reasonable defaults
+//==========================================================================================================
+NetSockPool::NetSockPool()
+{
+    m_error              = 0;
+    m_dns_ttl            = chrono::seconds(60);
+    m_idle_timeout       = chrono::seconds(300);
+    m_max_idle           = 8;
+    m_keepalive_idle     = 60;
+    m_keepalive_interval = 10;
+    m_keepalive_count    = 3;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Destructor - Closes every connection the pool owns
+//==========================================================================================================
+NetSockPool::~NetSockPool()
+{
+    for (auto& entry : m_idle  ) for (auto& idle : entry.second) delete idle.sock;
+    for (auto& entry : m_leased) delete entry.first;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_dns_ttl(), set_idle_timeout(), set_max_idle() - Change the pool settings
+//==========================================================================================================
+void NetSockPool::set_dns_ttl(int seconds)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_dns_ttl = chrono::seconds(seconds);
+}
+
+void NetSockPool::set_idle_timeout(int seconds)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_idle_timeout = chrono::seconds(seconds);
+}
+
+void NetSockPool::set_max_idle(int count)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_max_idle = count;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_error() - Hands an error to the caller of the current call, and records it for get_error()
+//==========================================================================================================
+void NetSockPool::set_error(int error, const string& text, int* p_error, string* p_error_str)
+{
+    if (p_error    ) *p_error     = error;
+    if (p_error_str) *p_error_str = text;
+
+    lock_guard<mutex> lock(m_mutex);
+    m_error     = error;
+    m_error_str = text;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_keepalive() - Sets the keepalive timing applied to new connections
+//==========================================================================================================
+void NetSockPool::set_keepalive(int idle_secs, int interval_secs, int count)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_keepalive_idle     = idle_secs;
+    m_keepalive_interval = interval_secs;
+    m_keepalive_count    = count;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// resolve() - Looks up the addresses of a server, using the cache if the cached result hasn't expired
+//
+// Passed:  key         = The (host, port) to look up
+//          p_result    = Where to store the result
+//          p_error     = If not null, receives the error code on failure
+//          p_error_str = If not null, receives a description of the error on failure
+//
+// Returns: 'true' on success, 'false' if the host can't be resolved
+//==========================================================================================================
+bool NetSockPool::resolve(const key_t& key, dns_entry_t* p_result, int* p_error, string* p_error_str)
+{
+    char ascii_port[20];
+    struct addrinfo hints, *p_res;
+
+    // If we have a cached result that hasn't expired, use it
+    m_mutex.lock();
+    auto it = m_dns.find(key);
+    if (it != m_dns.end() && it->second.expires > steady_clock_t::now())
+    {
+        *p_result = it->second;
+        m_mutex.unlock();
+        return true;
+    }
+    auto dns_ttl = m_dns_ttl;
+    m_mutex.unlock();
+
+    // Get an ASCII version of the port number
+    sprintf(ascii_port, "%i", key.second);
+
+    // We're looking for IPv4/IPv6 TCP addresses
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    // Ask the resolver.  We don't hold the lock while we do this, since it can take a long time
+    if (getaddrinfo(key.first.c_str(), ascii_port, &hints, &p_res) != 0 || p_res == nullptr)
+    {
+        set_error(NetSock::NO_SUCH_SERVER, "no such server: "+key.first, p_error, p_error_str);
+        return false;
+    }
+
+    // Copy every address that getaddrinfo handed us
+    p_result->addrs.clear();
+    p_result->lens.clear();
+    for (addrinfo* p = p_res; p; p = p->ai_next)
+    {
+        sockaddr_storage addr;
+        memcpy(&addr, p->ai_addr, p->ai_addrlen);
+        p_result->addrs.push_back(addr);
+        p_result->lens.push_back(p->ai_addrlen);
+    }
+
+    // Free the memory that was allocated by getaddrinfo
+    freeaddrinfo(p_res);
+
+    // Decide when this result expires
+    p_result->expires = steady_clock_t::now() + dns_ttl;
+
+    // And cache it
+    m_mutex.lock();
+    m_dns[key] = *p_result;
+    m_mutex.unlock();
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create_connection() - Creates a new connection to the specified server
+//
+// Returns: A pointer to a connected socket, or nullptr on failure
+//==========================================================================================================
+NetSock* NetSockPool::create_connection(const key_t& key, int* p_error, string* p_error_str)
+{
+    dns_entry_t dns;
+
+    // Find out where the server is
+    if (!resolve(key, &dns, p_error, p_error_str)) return nullptr;
+
+    // Fetch the keepalive settings
+    m_mutex.lock();
+    int keepalive_idle     = m_keepalive_idle;
+    int keepalive_interval = m_keepalive_interval;
+    int keepalive_count    = m_keepalive_count;
+    m_mutex.unlock();
+
+    // Create a new socket
+    NetSock* sock = new NetSock;
+
+    // Try each of the server's addresses in turn
+    for (size_t i=0; i<dns.addrs.size(); ++i)
+    {
+        if (sock->connect((sockaddr*)&dns.addrs[i], dns.lens[i]))
+        {
+            // Don't let the server get away with idling the connection to death
+            sock->set_keepalive(true, keepalive_idle, keepalive_interval, keepalive_count);
+
+            // Hand the caller their new connection
+            return sock;
+        }
+    }
+
+    // If we get here, we couldn't connect.  Throw the cached DNS result away in case it's stale
+    m_mutex.lock();
+    m_dns.erase(key);
+    m_mutex.unlock();
+
+    // And tell the caller
+    set_error(NetSock::CANT_CONNECT, "can't connect to "+key.first, p_error, p_error_str);
+    delete sock;
+    return nullptr;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// acquire() - Hands the caller a connected socket
+//
+// Passed:  host        = The name or IP address of the server
+//          port        = The TCP port number on the server
+//          p_error     = If not null, receives the error code on failure
+//          p_error_str = If not null, receives a description of the error on failure
+//
+// Returns: A connected socket that belongs to the pool, or nullptr on failure.  Give it back by calling
+//          release()
+//==========================================================================================================
+NetSock* NetSockPool::acquire(string host, int port, int* p_error, string* p_error_str)
+{
+    key_t    key(host, port);
+    NetSock* sock = nullptr;
+
+    // Take the most recently used connection that's still healthy
+    while (true)
+    {
+        m_mutex.lock();
+
+        // Find the list of idle connections to this server
+        vector<idle_t>& idle = m_idle[key];
+
+        // If there aren't any left, we'll have to make a new one
+        if (idle.empty())
+        {
+            m_mutex.unlock();
+            break;
+        }
+
+        // Take the most recently used one out of the pool
+        idle_t candidate = idle.back();
+        idle.pop_back();
+        bool expired = (steady_clock_t::now() - candidate.since) > m_idle_timeout;
+
+        m_mutex.unlock();
+
+        // A connection that's timed out, been closed, or has unsolicited data in it isn't usable.  The
+        // checks (and the close) are done outside the lock so they don't hold up other threads
+        if (expired || !candidate.sock->is_alive() || candidate.sock->bytes_available())
+        {
+            delete candidate.sock;
+            continue;
+        }
+
+        // We found one
+        sock = candidate.sock;
+        break;
+    }
+
+    // If there wasn't an idle connection available, make a new one
+    if (sock == nullptr) sock = create_connection(key, p_error, p_error_str);
+
+    // If we couldn't make a connection, the caller can find out why from p_error/p_error_str
+    if (sock == nullptr) return nullptr;
+
+    // Keep track of the fact that this socket is on loan
+    m_mutex.lock();
+    m_leased[sock] = key;
+    m_mutex.unlock();
+
+    // Hand the caller their connection
+    return sock;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// release() - Takes back a socket that was handed out by acquire()
+//
+// Passed:  sock     = The socket from acquire()
+//          reusable = false if the caller knows the connection is no good (protocol error, etc)
+//==========================================================================================================
+void NetSockPool::release(NetSock* sock, bool reusable)
+{
+    // A connection that the server has closed can't be re-used.  Find that out before taking the lock
+    if (reusable && !sock->is_alive()) reusable = false;
+
+    m_mutex.lock();
+
+    // Find out which server this socket is connected to
+    auto it = m_leased.find(sock);
+
+    // If this isn't one of ours, ignore it
+    if (it == m_leased.end())
+    {
+        m_mutex.unlock();
+        return;
+    }
+
+    // Fetch the list of idle connections for that server
+    vector<idle_t>& idle = m_idle[it->second];
+
+    // It's no longer on loan
+    m_leased.erase(it);
+
+    // If the socket can be re-used and we don't already have plenty of idle ones, put it back in the pool
+    bool keep = reusable && (int)idle.size() < m_max_idle;
+    if (keep) idle.push_back({sock, steady_clock_t::now()});
+
+    m_mutex.unlock();
+
+    // Otherwise, throw it away
+    if (!keep) delete sock;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// warm() - Pre-connects idle connections to the specified server
+//
+// Returns: The number of idle connections that are now in the pool for that server
+//==========================================================================================================
+int NetSockPool::warm(string host, int port, int count, int* p_error, string* p_error_str)
+{
+    key_t key(host, port);
+
+    // Find out how many connections we already have, and how many we're allowed
+    m_mutex.lock();
+    int existing = m_idle[key].size();
+    int max_idle = m_max_idle;
+    m_mutex.unlock();
+
+    // Make sure we don't exceed the maximum number of idle connections
+    if (count > max_idle) count = max_idle;
+
+    // Create the connections we need
+    for (int i=existing; i<count; ++i)
+    {
+        NetSock* sock = create_connection(key, p_error, p_error_str);
+        if (sock == nullptr) break;
+        lock_guard<mutex> lock(m_mutex);
+        m_idle[key].push_back({sock, steady_clock_t::now()});
+    }
+
+    // Tell the caller how many idle connections there are now
+    lock_guard<mutex> lock(m_mutex);
+    return m_idle[key].size();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// purge() - Closes idle connections that have timed out or been closed by the server, and throws away
+//           expired DNS results
+//==========================================================================================================
+void NetSockPool::purge()
+{
+    vector<pair<key_t, idle_t>> candidates, discards;
+
+    m_mutex.lock();
+
+    // What time is it now?
+    auto now = steady_clock_t::now();
+
+    // Take every idle connection out of the pool.  The ones that have timed out get thrown away
+    for (auto& entry : m_idle)
+    {
+        for (auto& candidate : entry.second)
+        {
+            if ((now - candidate.since) > m_idle_timeout)
+                discards.push_back({entry.first, candidate});
+            else
+                candidates.push_back({entry.first, candidate});
+        }
+        entry.second.clear();
+    }
+
+    // Throw away any DNS results that have expired
+    for (auto it = m_dns.begin(); it != m_dns.end();)
+    {
+        if (it->second.expires <= now)
+            it = m_dns.erase(it);
+        else
+            ++it;
+    }
+
+    m_mutex.unlock();
+
+    // Find out which of the rest the server has closed.  This happens outside the lock so that
+    // acquire() and release() aren't held up by our syscalls
+    vector<pair<key_t, idle_t>> survivors;
+    for (auto& candidate : candidates)
+    {
+        if (candidate.second.sock->is_alive())
+            survivors.push_back(candidate);
+        else
+            discards.push_back(candidate);
+    }
+
+    m_mutex.lock();
+
+    // Put the survivors back in the pool.  They're older than anything released in the meantime, so they
+    // go in front of those.  If that puts us over the limit, the oldest ones get thrown away
+    for (auto it = survivors.rbegin(); it != survivors.rend(); ++it)
+    {
+        vector<idle_t>& idle = m_idle[it->first];
+        if ((int)idle.size() < m_max_idle)
+            idle.insert(idle.begin(), it->second);
+        else
+            discards.push_back(*it);
+    }
+
+    m_mutex.unlock();
+
+    // And close the connections we're throwing away
+    for (auto& discard : discards) delete discard.second.sock;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_error() - Returns information about the most recent failure
+//==========================================================================================================
+int NetSockPool::get_error(string* p_str)
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (p_str) *p_str = m_error_str;
+    return m_error;
+}
+//==========================================================================================================
@@ -0,0 +1,101 @@
+//==========================================================================================================
+// netsock_pool.h - Defines a pool of re-usable outbound NetSock connections
+//==========================================================================================================
+#pragma once
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include "netsock.h"
+
+class NetSockPool
+{
+public:
+
+    // Constructor and Destructor.  The destructor closes every connection the pool owns
+    NetSockPool();
+    ~NetSockPool();
+
+    // Call this to set how long a DNS lookup remains valid
+    void    set_dns_ttl(int seconds);
+
+    // Call this to set how long a connection can sit idle in the pool before it's closed
+    void    set_idle_timeout(int seconds);
+
+    // Call this to set the maximum number of idle connections kept for each (host, port)
+    void    set_max_idle(int count);
+
+    // Call this to set the TCP keepalive timing applied to every connection the pool creates
+    void    set_keepalive(int idle_secs, int interval_secs, int count);
+
+    // Call this to fetch a connected socket, either from the pool or newly connected.  On failure, the
+    // error code and description for this call are stored in *p_error and *p_error_str
+    NetSock* acquire(std::string host, int port, int* p_error = nullptr, std::string* p_error_str = nullptr);
+
+    // Call this to give a socket back.  If 'reusable' is false, the socket is closed and discarded
+    void    release(NetSock* sock, bool reusable = true);
+
+    // Call this to pre-connect 'count' idle connections so the first requests don't pay for them
+    int     warm(std::string host, int port, int count, int* p_error = nullptr, std::string* p_error_str = nullptr);
+
+    // Call this periodically to close connections that are expired or dead
+    void    purge();
+
+    // Returns the most recent failure of any thread.  When several threads share the pool, use the
+    // p_error/p_error_str parameters of acquire() and warm() to find out why a particular call failed
+    int     get_error(std::string* p_str = nullptr);
+
+protected:
+
+    // Connections and DNS results are keyed by (host, port)
+    typedef std::pair<std::string, int> key_t;
+    typedef std::chrono::steady_clock steady_clock_t;
+
+    // The result of a DNS lookup, and when it expires
+    struct dns_entry_t
+    {
+        std::vector<sockaddr_storage> addrs;
+        std::vector<socklen_t>        lens;
+        steady_clock_t::time_point    expires;
+    };
+
+    // An idle connection, and when it was returned to the pool
+    struct idle_t
+    {
+        NetSock*                   sock;
+        steady_clock_t::time_point since;
+    };
+
+    // Resolves a host name, using the DNS cache when possible
+    bool    resolve(const key_t& key, dns_entry_t* p_result, int* p_error, std::string* p_error_str);
+
+    // Creates a brand new connection to the specified server
+    NetSock* create_connection(const key_t& key, int* p_error, std::string* p_error_str);
+
+    // Reports an error to the caller of the current call, and records it for get_error()
+    void    set_error(int error, const std::string& text, int* p_error, std::string* p_error_str);
+
+    // Most recent error of any thread.  Protected by m_mutex
+    std::string m_error_str;
+    int     m_error;
+
+    // Pool settings
+    steady_clock_t::duration m_dns_ttl, m_idle_timeout;
+    int     m_max_idle;
+    int     m_keepalive_idle, m_keepalive_interval, m_keepalive_count;
+
+    // Cached DNS results
+    std::map<key_t, dns_entry_t> m_dns;
+
+    // Idle connections, the most recently used at the back
+    std::map<key_t, std::vector<idle_t>> m_idle;
+
+    // Connections that are currently handed out, and the key they belong to
+    std::map<NetSock*, key_t> m_leased;
+
+    // Protects all of the above, so the pool can be shared between threads
+    std::mutex m_mutex;
+};
+//==========================================================================================================
@@ -0,0 +1,120 @@
+//==========================================================================================================
+// netsock_tuning.cpp - Implements the socket tuning profiles that NetSock applies to connections
+//==========================================================================================================
+#include "netsock_tuning.h"
+#include "config_file.h"
+using namespace std;
+
+
+//==========================================================================================================
+// latency() - Returns a profile for small, latency-sensitive messages
+//==========================================================================================================
+NetSockTuning NetSockTuning::latency()
+{
+    NetSockTuning tuning;
+
+    // Send every write immediately and ACK every segment immediately
+    tuning.nodelay  = 1;
+    tuning.quickack = 1;
+
+    // Spin on the NIC queue briefly rather than taking a wakeup for each message
+    tuning.busy_poll_us = 50;
+
+    // Small buffers keep the amount of queued (i.e., delayed) data small
+    tuning.rcvbuf = 64 * 1024;
+    tuning.sndbuf = 64 * 1024;
+
+    // Detect a dead peer quickly
+    tuning.user_timeout_ms = 5000;
+
+    // DSCP "expedited forwarding"
+    tuning.tos = 0xB8;
+
+    // Skip a round-trip on connection setup
+    tuning.fastopen = 1;
+
+    return tuning;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// throughput() - Returns a profile for bulk transfers
+//==========================================================================================================
+NetSockTuning NetSockTuning::throughput()
+{
+    NetSockTuning tuning;
+
+    // Let the stack coalesce small writes and delay ACKs
+    tuning.nodelay  = 0;
+    tuning.quickack = 0;
+
+    // Large buffers keep a high bandwidth-delay-product link full
+    tuning.rcvbuf = 4 * 1024 * 1024;
+    tuning.sndbuf = 4 * 1024 * 1024;
+
+    // DSCP "high throughput"
+    tuning.tos = 0x08;
+
+    return tuning;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// load() - Loads a tuning profile from a config file
+//
+// The section looks like this.  Every key is optional, and "profile" picks the starting point:
+//
+//    [low_latency_link]
+//    profile         = latency      # latency, throughput or custom
+//    rcvbuf          = 131072
+//    sndbuf          = 131072
+//    nodelay         = 1
+//    quickack        = 1
+//    busy_poll_us    = 50
+//    user_timeout_ms = 5000
+//    tos             = 0xB8
+//    fastopen        = 1
+//
+// Returns: 'true' if the section has a valid profile name
+//==========================================================================================================
+bool NetSockTuning::load(CConfigFile& config, string section)
+{
+    string profile = "custom";
+
+    // This is the prefix for fully-scoped key names in this section
+    string scope = section + "::";
+
+    // Find out which profile we're starting from
+    if (config.exists(scope + "profile")) config.get(scope + "profile", &profile);
+
+    // Start with the requested profile
+    if      (profile == "latency"   ) *this = latency();
+    else if (profile == "throughput") *this = throughput();
+    else if (profile == "custom"    ) *this = NetSockTuning();
+    else return false;
+
+    // These are the keys that can over-ride individual values
+    struct {const char* key; int* p_value;} field[] =
+    {
+        {"rcvbuf",          &rcvbuf         },
+        {"sndbuf",          &sndbuf         },
+        {"nodelay",         &nodelay        },
+        {"quickack",        &quickack       },
+        {"busy_poll_us",    &busy_poll_us   },
+        {"user_timeout_ms", &user_timeout_ms},
+        {"tos",             &tos            },
+        {"fastopen",        &fastopen       }
+    };
+
+    // Fetch every value that's in the config file
+    for (auto& f : field)
+    {
+        if (config.exists(scope + f.key)) config.get(scope + f.key, f.p_value);
+    }
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
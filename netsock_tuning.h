@@ -0,0 +1,46 @@
+//==========================================================================================================
+// netsock_tuning.h - Defines a set of socket options that NetSock applies when a connection is made
+//==========================================================================================================
+#pragma once
+#include <string>
+
+class CConfigFile;
+
+//----------------------------------------------------------------------------------------------------------
+// NetSockTuning - Socket tuning parameters.  A value of -1 means "leave the system default alone"
+//----------------------------------------------------------------------------------------------------------
+struct NetSockTuning
+{
+    // SO_RCVBUF and SO_SNDBUF, in bytes
+    int     rcvbuf          = -1;
+    int     sndbuf          = -1;
+
+    // TCP_NODELAY: 1 = send small writes immediately, 0 = let Nagle's algorithm coalesce them
+    int     nodelay         = -1;
+
+    // TCP_QUICKACK: 1 = ACK immediately instead of delaying the ACK.  The kernel doesn't keep this
+    // setting, so NetSock turns it back on after every read
+    int     quickack        = -1;
+
+    // SO_BUSY_POLL: microseconds to busy-poll the NIC for incoming data before sleeping
+    int     busy_poll_us    = -1;
+
+    // TCP_USER_TIMEOUT: milliseconds that sent data can remain unacknowledged before the connection drops
+    int     user_timeout_ms = -1;
+
+    // IP_TOS (IPV6_TCLASS on IPv6): the type-of-service/DSCP byte on outgoing packets
+    int     tos             = -1;
+
+    // TCP_FASTOPEN: on a server this is the length of the fast-open queue, on a client 1 = use fast-open
+    int     fastopen        = -1;
+
+    // A tuning profile for small messages where latency matters most
+    static NetSockTuning latency();
+
+    // A tuning profile for bulk transfers where throughput matters most
+    static NetSockTuning throughput();
+
+    // Call this to load a profile from the specified section of a config file.  Can throw runtime_error
+    bool    load(CConfigFile& config, std::string section);
+};
+//----------------------------------------------------------------------------------------------------------
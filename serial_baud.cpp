@@ -0,0 +1,39 @@
+//============================================================================
+// serial_baud.cpp - Sets arbitrary baud-rates via the Linux termios2 API
+//
+// This lives in its own file because <asm/termbits.h> (which defines
+// termios2 and BOTHER) can't be included alongside <termios.h>
+//============================================================================
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#include <cstdint>
+
+
+//============================================================================
+// sp_set_custom_baud() - Sets the input and output speed of a serial port to
+//                        an arbitrary number of bits per second.  The driver
+//                        picks the closest divisor it can manage
+//
+// Returns: 'true' on success, 'false' if the driver refused
+//============================================================================
+bool sp_set_custom_baud(int fd, uint32_t baud)
+{
+    struct termios2 tio;
+
+    // Fetch the current settings
+    if (ioctl(fd, TCGETS2, &tio) < 0) return false;
+
+    // Tell the driver that the output speed is in c_ospeed...
+    tio.c_cflag &= ~CBAUD;
+    tio.c_cflag |= BOTHER;
+    tio.c_ospeed = baud;
+
+    // ...and that the input speed is in c_ispeed
+    tio.c_cflag &= ~(CBAUD << IBSHIFT);
+    tio.c_cflag |= (BOTHER << IBSHIFT);
+    tio.c_ispeed = baud;
+
+    // And apply the new settings
+    return ioctl(fd, TCSETS2, &tio) == 0;
+}
+//============================================================================
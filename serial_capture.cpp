@@ -0,0 +1,310 @@
+//============================================================================
+// serial_capture.cpp - Implements a buffered, timestamped recorder of serial
+//                      traffic
+//============================================================================
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/select.h>
+#include "serial_capture.h"
+using namespace std;
+
+// The capture file header
+static const char    CAPTURE_MAGIC[6] = {'S', 'P', 'C', 'A', 'P', 0};
+static const uint16_t CAPTURE_VERSION = 1;
+
+// When this much data is buffered, the writer thread is woken up early
+static const size_t  WAKE_THRESHOLD   = 64 * 1024;
+
+// When this much data is buffered, new data gets thrown away
+static const size_t  MAX_BUFFERED     = 16 * 1024 * 1024;
+
+// How often the writer thread flushes the buffer when traffic is light
+static const int     FLUSH_INTERVAL_MS = 100;
+
+
+//============================================================================
+// Constructor() - No capture file is open
+//============================================================================
+CSerialCapture::CSerialCapture()
+{
+    m_fd             = -1;
+    m_last_offset    = -1;
+    m_last_direction = -1;
+    m_last_ns        = 0;
+    m_coalesce_ns    = 0;
+    m_dropped        = 0;
+}
+//============================================================================
+
+
+//============================================================================
+// Destructor() - Flushes and closes the capture file
+//============================================================================
+CSerialCapture::~CSerialCapture()
+{
+    close();
+}
+//============================================================================
+
+
+//============================================================================
+// now_ns() - Returns CLOCK_MONOTONIC in nanoseconds
+//============================================================================
+uint64_t CSerialCapture::now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+//============================================================================
+
+
+//============================================================================
+// open() - Creates the capture file and starts the writer thread
+//
+// Passed:  filename    = The name of the capture file to create
+//          coalesce_us = Same-direction data closer together than this (in
+//                        microseconds) is merged into one record
+//
+// Returns: 'true' on success, 'false' if the file can't be created
+//============================================================================
+bool CSerialCapture::open(const string& filename, int coalesce_us)
+{
+    uint8_t header[8];
+
+    // Make sure any previous capture file is closed
+    close();
+
+    // Create the capture file
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+
+    // Write the file header
+    memcpy(header, CAPTURE_MAGIC, 6);
+    memcpy(header + 6, &CAPTURE_VERSION, 2);
+    if (::write(fd, header, sizeof header) != sizeof header)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    // Make sure the work event isn't left over from a previous capture
+    m_work_event.reset();
+
+    // Start out with an empty buffer.  record() can be called from other
+    // threads at any time, so it only sees the new file once it's ready
+    m_mutex.lock();
+    m_pending.clear();
+    m_last_offset    = -1;
+    m_last_direction = -1;
+    m_coalesce_ns    = (uint64_t)coalesce_us * 1000;
+    m_dropped        = 0;
+    m_fd             = fd;
+    m_mutex.unlock();
+
+    // And start the writer thread
+    spawn();
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// close() - Stops the writer thread, which flushes the buffer on its way
+//           out, then closes the capture file
+//============================================================================
+void CSerialCapture::close()
+{
+    if (m_fd < 0) return;
+    request_stop();
+    join();
+    lock_guard<mutex> lock(m_mutex);
+    ::close(m_fd);
+    m_fd = -1;
+}
+//============================================================================
+
+
+//============================================================================
+// record() - Appends data to the capture buffer
+//
+// Passed:  direction    = RX or TX
+//          data         = The data that was sent or received
+//          length       = The number of bytes of data
+//          timestamp_ns = When the data was sent or received, or 0 to mean
+//                         "now"
+//============================================================================
+void CSerialCapture::record(direction_t direction, const void* data, size_t length,
+                            uint64_t timestamp_ns)
+{
+    const uint8_t* in = (const uint8_t*)data;
+
+    // If there's nothing to record, don't
+    if (length == 0) return;
+
+    // If the caller didn't tell us when this happened, it happened now
+    if (timestamp_ns == 0) timestamp_ns = now_ns();
+
+    lock_guard<mutex> lock(m_mutex);
+
+    // If the capture file isn't open, there's nowhere to record it
+    if (m_fd < 0) return;
+
+    // If the disk can't keep up, throw the data away
+    if (m_pending.size() + length > MAX_BUFFERED)
+    {
+        m_dropped += length;
+        return;
+    }
+
+    // If this data is a continuation of the previous record, merge it in
+    if (m_last_offset >= 0 && direction == m_last_direction
+    &&  timestamp_ns - m_last_ns <= m_coalesce_ns)
+    {
+        // Records aren't aligned in the buffer, so we can't just poke at it
+        uint8_t* p_length = m_pending.data() + m_last_offset + offsetof(record_t, length);
+        uint32_t total;
+        memcpy(&total, p_length, sizeof total);
+        total += length;
+        memcpy(p_length, &total, sizeof total);
+    }
+
+    // Otherwise, start a new record
+    else
+    {
+        record_t rec = {};
+        rec.timestamp_ns = timestamp_ns;
+        rec.length       = length;
+        rec.direction    = direction;
+        m_last_offset    = m_pending.size();
+        m_pending.insert(m_pending.end(), (uint8_t*)&rec, (uint8_t*)(&rec + 1));
+    }
+
+    // Append the data to the buffer
+    m_pending.insert(m_pending.end(), in, in + length);
+    m_last_direction = direction;
+    m_last_ns        = timestamp_ns;
+
+    // If the buffer is getting large, wake up the writer thread
+    if (m_pending.size() >= WAKE_THRESHOLD && m_pending.size() - length < WAKE_THRESHOLD)
+    {
+        m_work_event.set();
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// write_buffer() - Writes an entire buffer to the capture file
+//============================================================================
+void CSerialCapture::write_buffer(const vector<uint8_t>& buffer)
+{
+    const uint8_t* ptr = buffer.data();
+    size_t remaining   = buffer.size();
+
+    while (remaining)
+    {
+        ssize_t written = ::write(m_fd, ptr, remaining);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return;
+        ptr       += written;
+        remaining -= written;
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// main() - The writer thread.  Periodically moves the buffer to disk
+//============================================================================
+void CSerialCapture::main()
+{
+    fd_set  rfds;
+    timeval timeout;
+
+    // We wait on both the work event and the stop event
+    int work_fd = m_work_event.fd();
+    int stop_fd = CThread::stop_fd();
+    int max_fd  = (work_fd > stop_fd) ? work_fd : stop_fd;
+
+    while (true)
+    {
+        // Wait for the buffer to fill, for the flush interval to expire, or
+        // for someone to tell us to stop
+        FD_ZERO(&rfds);
+        FD_SET(work_fd, &rfds);
+        FD_SET(stop_fd, &rfds);
+        timeout.tv_sec  = 0;
+        timeout.tv_usec = FLUSH_INTERVAL_MS * 1000;
+        int count = select(max_fd+1, &rfds, NULL, NULL, &timeout);
+        bool stopping = (count > 0 && FD_ISSET(stop_fd, &rfds));
+
+        // Clear the work event
+        if (count > 0 && FD_ISSET(work_fd, &rfds)) m_work_event.reset();
+
+        // Grab everything that's been buffered.  Once the buffer changes
+        // hands, its last record can't be extended any more
+        m_mutex.lock();
+        m_writing.clear();
+        m_writing.swap(m_pending);
+        m_last_offset = -1;
+        m_mutex.unlock();
+
+        // Write it out
+        write_buffer(m_writing);
+
+        // If we've been told to stop, we're done
+        if (stopping) break;
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// read_header() - Verifies that a file is a capture file
+//
+// Passed:  fp = A capture file, opened for reading and positioned at the
+//               start of the file
+//
+// Returns: 'true' if the header is valid
+//============================================================================
+bool CSerialCapture::read_header(FILE* fp)
+{
+    uint8_t  header[8];
+    uint16_t version;
+
+    // Fetch the header
+    if (fread(header, sizeof header, 1, fp) != 1) return false;
+
+    // Check the magic number and the version
+    memcpy(&version, header + 6, 2);
+    return memcmp(header, CAPTURE_MAGIC, 6) == 0 && version == CAPTURE_VERSION;
+}
+//============================================================================
+
+
+//============================================================================
+// read_record() - Reads the next record from a capture file
+//
+// Passed:  fp       = A capture file, positioned at a record
+//          p_record = Receives the record header
+//          p_data   = Receives the data in the record
+//
+// Returns: 'true' on success, 'false' at the end of the file (or if the
+//          last record is truncated)
+//============================================================================
+bool CSerialCapture::read_record(FILE* fp, record_t* p_record, vector<uint8_t>* p_data)
+{
+    // Fetch the record header
+    if (fread(p_record, sizeof(record_t), 1, fp) != 1) return false;
+
+    // And fetch the data that goes with it
+    p_data->resize(p_record->length);
+    if (p_record->length == 0) return true;
+    return fread(p_data->data(), p_record->length, 1, fp) == 1;
+}
+//============================================================================
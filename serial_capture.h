@@ -0,0 +1,112 @@
+//============================================================================
+// serial_capture.h - Defines a recorder that logs serial traffic in both
+//                    directions, with timestamps, to a compact binary file
+//============================================================================
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+#include "cthread.h"
+#include "event.h"
+
+
+//============================================================================
+// Class CSerialCapture - record() is cheap enough to call from the I/O path:
+//                        it appends to a memory buffer, and a background
+//                        thread writes that buffer to disk.  Bytes that
+//                        travel in the same direction within the coalescing
+//                        window are merged into a single record.
+//
+// File format:  An 8-byte header ("SPCAP" followed by a nul and a 16-bit
+//               version), then any number of records.  Each record is a
+//               record_t followed by 'length' bytes of data.  Timestamps
+//               are CLOCK_MONOTONIC nanoseconds
+//============================================================================
+class CSerialCapture : public CThread
+{
+public:
+
+    // Which way the data was travelling, from the point of view of the host
+    enum direction_t {RX = 0, TX = 1};
+
+    // The header of a single record in the capture file
+    struct record_t
+    {
+        uint64_t timestamp_ns;
+        uint32_t length;
+        uint8_t  direction;
+        uint8_t  reserved[3];
+    };
+
+    // Constructor and destructor
+    CSerialCapture();
+    ~CSerialCapture();
+
+    // Creates the capture file and starts the writer thread.  Data in the
+    // same direction that arrives within 'coalesce_us' of the previous
+    // data is merged into the same record
+    bool    open(const std::string& filename, int coalesce_us = 1000);
+
+    // Writes out anything still buffered and closes the capture file
+    void    close();
+
+    // Returns 'true' if a capture file is open
+    bool    is_open() {return m_fd >= 0;}
+
+    // Records data travelling in the specified direction.  If the timestamp
+    // is 0, the current time is used.  Safe to call from any thread
+    void    record(direction_t direction, const void* data, size_t length,
+                   uint64_t timestamp_ns = 0);
+
+    // Returns the number of bytes thrown away because the disk couldn't
+    // keep up
+    uint64_t dropped() {return m_dropped;}
+
+    // Returns the monotonic clock in nanoseconds
+    static uint64_t now_ns();
+
+    // Call this on a capture file opened for reading to verify its header
+    static bool read_header(FILE* fp);
+
+    // Call this to read the next record from a capture file.  Returns
+    // 'false' at the end of the file
+    static bool read_record(FILE* fp, record_t* p_record, std::vector<uint8_t>* p_data);
+
+protected:
+
+    // The writer thread
+    void    main() override;
+
+    // Writes the entire buffer to the capture file
+    void    write_buffer(const std::vector<uint8_t>& buffer);
+
+    // The capture file
+    int     m_fd;
+
+    // Records waiting to be written, and records being written right now
+    std::vector<uint8_t> m_pending, m_writing;
+
+    // The offset in m_pending of the most recent record, or -1 if that
+    // record has already been handed to the writer thread
+    int64_t m_last_offset;
+
+    // The direction and time of the most recent data recorded
+    int     m_last_direction;
+    uint64_t m_last_ns;
+
+    // Records closer together than this get merged
+    uint64_t m_coalesce_ns;
+
+    // The number of bytes we had to throw away
+    uint64_t m_dropped;
+
+    // Protects everything above
+    std::mutex m_mutex;
+
+    // Signals the writer thread that the buffer is getting full.  It's told
+    // to flush and exit through the CThread stop token
+    CEvent  m_work_event;
+};
+//============================================================================
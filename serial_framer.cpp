@@ -0,0 +1,537 @@
+//============================================================================
+// serial_framer.cpp - Implements binary packet framers and CRCs
+//============================================================================
+#include <string.h>
+#include "serial_framer.h"
+using namespace std;
+
+
+//============================================================================
+// SLIP special characters
+//============================================================================
+enum
+{
+    SLIP_END     = 0xC0,
+    SLIP_ESC     = 0xDB,
+    SLIP_ESC_END = 0xDC,
+    SLIP_ESC_ESC = 0xDD
+};
+//============================================================================
+
+
+//============================================================================
+// crc_tables_t - Lookup tables for the CRCs.  CRC-32 uses "slicing-by-8",
+//                which processes 8 bytes per step with 8 table lookups
+//============================================================================
+struct crc_tables_t
+{
+    uint16_t crc16[256];
+    uint32_t crc32[8][256];
+
+    crc_tables_t()
+    {
+        for (int i=0; i<256; ++i)
+        {
+            // CRC-16/CCITT is MSB-first with polynomial 0x1021
+            uint16_t c16 = i << 8;
+            for (int bit=0; bit<8; ++bit) c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x1021 : (c16 << 1);
+            crc16[i] = c16;
+
+            // CRC-32 is LSB-first with (reflected) polynomial 0xEDB88320
+            uint32_t c32 = i;
+            for (int bit=0; bit<8; ++bit) c32 = (c32 & 1) ? (c32 >> 1) ^ 0xEDB88320 : (c32 >> 1);
+            crc32[0][i] = c32;
+        }
+
+        // Each successive CRC-32 table advances the CRC by one more byte
+        for (int i=0; i<256; ++i)
+        {
+            for (int t=1; t<8; ++t)
+            {
+                uint32_t prev = crc32[t-1][i];
+                crc32[t][i] = (prev >> 8) ^ crc32[0][prev & 0xFF];
+            }
+        }
+    }
+};
+//============================================================================
+
+
+//============================================================================
+// tables() - Returns the CRC lookup tables, building them on first use
+//============================================================================
+static const crc_tables_t& tables()
+{
+    static const crc_tables_t t;
+    return t;
+}
+//============================================================================
+
+
+//============================================================================
+// crc16_ccitt() - Computes a CRC-16/CCITT-FALSE
+//============================================================================
+uint16_t crc16_ccitt(const void* data, size_t length, uint16_t crc)
+{
+    const uint8_t*  in    = (const uint8_t*)data;
+    const uint16_t* table = tables().crc16;
+
+    while (length--) crc = (crc << 8) ^ table[(crc >> 8) ^ *in++];
+
+    return crc;
+}
+//============================================================================
+
+
+//============================================================================
+// crc32() - Computes a zlib-compatible CRC-32
+//============================================================================
+uint32_t crc32(const void* data, size_t length, uint32_t crc)
+{
+    const uint8_t* in = (const uint8_t*)data;
+    const auto&    t  = tables().crc32;
+
+    crc = ~crc;
+
+    // Process 8 bytes at a time
+    while (length >= 8)
+    {
+        uint32_t lo, hi;
+        memcpy(&lo, in,   4);
+        memcpy(&hi, in+4, 4);
+        lo ^= crc;
+        crc = t[7][ lo        & 0xFF] ^ t[6][(lo >>  8) & 0xFF] ^
+              t[5][(lo >> 16) & 0xFF] ^ t[4][ lo >> 24        ] ^
+              t[3][ hi        & 0xFF] ^ t[2][(hi >>  8) & 0xFF] ^
+              t[1][(hi >> 16) & 0xFF] ^ t[0][ hi >> 24        ];
+        in     += 8;
+        length -= 8;
+    }
+
+    // And then the leftovers one at a time
+    while (length--) crc = (crc >> 8) ^ t[0][(crc ^ *in++) & 0xFF];
+
+    return ~crc;
+}
+//============================================================================
+
+
+
+//============================================================================
+// CPacketFramer constructor
+//============================================================================
+CPacketFramer::CPacketFramer()
+{
+    m_max_packet = 4096;
+    m_errors     = 0;
+}
+//============================================================================
+
+
+//============================================================================
+// feed() - Decodes raw bytes from the serial port
+//
+// Returns: The number of decoded packets waiting to be fetched
+//============================================================================
+int CPacketFramer::feed(const void* data, int count)
+{
+    if (count > 0) decode((const uint8_t*)data, count);
+    return m_packets.size();
+}
+//============================================================================
+
+
+//============================================================================
+// get_packet() - Fetches the oldest decoded packet
+//============================================================================
+bool CPacketFramer::get_packet(vector<uint8_t>* p_packet)
+{
+    if (m_packets.empty()) return false;
+    p_packet->swap(m_packets.front());
+    m_packets.pop_front();
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// reset() - Throws away any partial frame and any waiting packets
+//============================================================================
+void CPacketFramer::reset()
+{
+    m_current.clear();
+    m_packets.clear();
+}
+//============================================================================
+
+
+//============================================================================
+// emit() - Moves the packet in m_current to the queue of decoded packets
+//============================================================================
+void CPacketFramer::emit()
+{
+    m_packets.emplace_back();
+    m_packets.back().swap(m_current);
+    m_current.clear();
+}
+//============================================================================
+
+
+//============================================================================
+// discard() - Throws away a bad frame
+//============================================================================
+void CPacketFramer::discard()
+{
+    m_current.clear();
+    ++m_errors;
+}
+//============================================================================
+
+
+
+//============================================================================
+// CCobsFramer::reset() - Gets ready to decode the start of a frame
+//============================================================================
+void CCobsFramer::reset()
+{
+    CPacketFramer::reset();
+    m_code      = 0;
+    m_remaining = 0;
+    m_bad       = false;
+}
+//============================================================================
+
+
+//============================================================================
+// CCobsFramer::encode() - COBS-encodes a packet and appends the terminating
+//                         zero
+//============================================================================
+void CCobsFramer::encode(const void* data, int count, vector<uint8_t>* p_out)
+{
+    const uint8_t* in = (const uint8_t*)data;
+
+    // Worst case is one extra byte per 254, plus the leading code byte and
+    // the terminating zero
+    p_out->clear();
+    p_out->reserve(count + count / 254 + 2);
+
+    // Reserve a spot for the first code byte
+    size_t code_index = 0;
+    p_out->push_back(0);
+    uint8_t code = 1;
+
+    for (int i=0; i<count; ++i)
+    {
+        // A zero ends the current block
+        if (in[i] == 0)
+        {
+            (*p_out)[code_index] = code;
+            code_index = p_out->size();
+            p_out->push_back(0);
+            code = 1;
+            continue;
+        }
+
+        // Otherwise, it's just data
+        p_out->push_back(in[i]);
+
+        // A block can only hold 254 data bytes
+        if (++code == 0xFF)
+        {
+            (*p_out)[code_index] = code;
+            code_index = p_out->size();
+            p_out->push_back(0);
+            code = 1;
+        }
+    }
+
+    // Finish the last block, and terminate the frame
+    (*p_out)[code_index] = code;
+    p_out->push_back(0);
+}
+//============================================================================
+
+
+//============================================================================
+// CCobsFramer::decode() - Decodes COBS frames from a buffer of raw bytes
+//============================================================================
+void CCobsFramer::decode(const uint8_t* in, int count)
+{
+    const uint8_t* end = in + count;
+
+    while (in < end)
+    {
+        // If we're in the middle of a block, copy as many data bytes as we can
+        // in one go.  A zero inside a block means the frame was truncated
+        if (m_remaining)
+        {
+            int n = end - in;
+            if (n > m_remaining) n = m_remaining;
+            const uint8_t* zero = (const uint8_t*)memchr(in, 0, n);
+            if (zero) n = zero - in;
+            if (!m_bad) m_current.insert(m_current.end(), in, in + n);
+            in          += n;
+            m_remaining -= n;
+            if (zero == nullptr) continue;
+        }
+
+        // Fetch the next byte.  It's either a code byte or a frame delimiter
+        uint8_t c = *in++;
+
+        // A zero is the end of a frame
+        if (c == 0)
+        {
+            // If the frame ended in the middle of a block, it's bad
+            if (m_remaining) m_bad = true;
+
+            // Hand over good frames, and throw away bad ones
+            if (m_bad)
+                discard();
+            else if (!m_current.empty())
+                emit();
+
+            // Get ready for the next frame
+            m_code      = 0;
+            m_remaining = 0;
+            m_bad       = false;
+            continue;
+        }
+
+        // This is a code byte.  Unless this is the first block or the
+        // previous block was full-length, there was a zero between the blocks
+        if (m_code != 0 && m_code != 0xFF && !m_bad) m_current.push_back(0);
+
+        // Now we know how many data bytes are in this block
+        m_code      = c;
+        m_remaining = c - 1;
+
+        // If the frame is too large, it's bad
+        if (m_current.size() + m_remaining > m_max_packet) m_bad = true;
+    }
+}
+//============================================================================
+
+
+
+//============================================================================
+// CSlipFramer::reset() - Gets ready to decode the start of a frame
+//============================================================================
+void CSlipFramer::reset()
+{
+    CPacketFramer::reset();
+    m_escaped = false;
+    m_bad     = false;
+}
+//============================================================================
+
+
+//============================================================================
+// CSlipFramer::encode() - SLIP-encodes a packet.  The frame begins with an
+//                         END too, which flushes out any line noise
+//============================================================================
+void CSlipFramer::encode(const void* data, int count, vector<uint8_t>* p_out)
+{
+    const uint8_t* in = (const uint8_t*)data;
+
+    p_out->clear();
+    p_out->reserve(count + count / 8 + 2);
+    p_out->push_back(SLIP_END);
+
+    for (int i=0; i<count; ++i)
+    {
+        switch (in[i])
+        {
+            case SLIP_END:  p_out->push_back(SLIP_ESC);
+                            p_out->push_back(SLIP_ESC_END);
+                            break;
+
+            case SLIP_ESC:  p_out->push_back(SLIP_ESC);
+                            p_out->push_back(SLIP_ESC_ESC);
+                            break;
+
+            default:        p_out->push_back(in[i]);
+        }
+    }
+
+    p_out->push_back(SLIP_END);
+}
+//============================================================================
+
+
+//============================================================================
+// CSlipFramer::decode() - Decodes SLIP frames from a buffer of raw bytes
+//============================================================================
+void CSlipFramer::decode(const uint8_t* in, int count)
+{
+    const uint8_t* end = in + count;
+
+    while (in < end)
+    {
+        // Copy a run of ordinary bytes in one go
+        if (!m_escaped)
+        {
+            const uint8_t* p = in;
+            while (p < end && *p != SLIP_END && *p != SLIP_ESC) ++p;
+            if (!m_bad) m_current.insert(m_current.end(), in, p);
+            in = p;
+
+            // If the frame is too large, it's bad, and there's no point keeping what we have of it
+            if (m_current.size() > m_max_packet)
+            {
+                m_bad = true;
+                m_current.clear();
+            }
+
+            if (in == end) break;
+        }
+
+        // Fetch the special character
+        uint8_t c = *in++;
+
+        // An END is the end of a frame.  Empty frames are just line noise
+        if (c == SLIP_END)
+        {
+            if (m_bad || m_escaped || m_current.size() > m_max_packet)
+                discard();
+            else if (!m_current.empty())
+                emit();
+            m_escaped = false;
+            m_bad     = false;
+            continue;
+        }
+
+        // If this is the character after an ESC, translate it
+        if (m_escaped)
+        {
+            m_escaped = false;
+            if (m_bad) continue;
+            if      (c == SLIP_ESC_END) m_current.push_back(SLIP_END);
+            else if (c == SLIP_ESC_ESC) m_current.push_back(SLIP_ESC);
+            else m_bad = true;
+            continue;
+        }
+
+        // Otherwise, this is an ESC
+        m_escaped = true;
+    }
+}
+//============================================================================
+
+
+
+//============================================================================
+// CLengthCrcFramer constructor
+//============================================================================
+CLengthCrcFramer::CLengthCrcFramer(crc_t crc_type, uint8_t sync)
+{
+    m_crc_type = crc_type;
+    m_crc_size = (crc_type == CRC16) ? 2 : 4;
+    m_sync     = sync;
+}
+//============================================================================
+
+
+//============================================================================
+// CLengthCrcFramer::reset() - Throws away any undecoded data
+//============================================================================
+void CLengthCrcFramer::reset()
+{
+    CPacketFramer::reset();
+    m_raw.clear();
+}
+//============================================================================
+
+
+//============================================================================
+// CLengthCrcFramer::encode() - Builds a frame around a packet
+//============================================================================
+void CLengthCrcFramer::encode(const void* data, int count, vector<uint8_t>* p_out)
+{
+    const uint8_t* in = (const uint8_t*)data;
+
+    p_out->resize(3 + count + m_crc_size);
+    uint8_t* out = p_out->data();
+
+    // Sync byte and length
+    out[0] = m_sync;
+    out[1] = count & 0xFF;
+    out[2] = count >> 8;
+
+    // Payload
+    memcpy(out + 3, in, count);
+
+    // The CRC covers the length and the payload
+    uint32_t crc = (m_crc_type == CRC16) ? crc16_ccitt(out + 1, count + 2)
+                                         : crc32      (out + 1, count + 2);
+    for (int i=0; i<m_crc_size; ++i) out[3 + count + i] = crc >> (8 * i);
+}
+//============================================================================
+
+
+//============================================================================
+// CLengthCrcFramer::decode() - Decodes frames from a buffer of raw bytes
+//============================================================================
+void CLengthCrcFramer::decode(const uint8_t* in, int count)
+{
+    // Append the new data to whatever we haven't decoded yet
+    m_raw.insert(m_raw.end(), in, in + count);
+
+    const uint8_t* buf  = m_raw.data();
+    size_t         size = m_raw.size();
+    size_t         pos  = 0;
+
+    while (pos < size)
+    {
+        // Find the next sync byte.  Anything before it is line noise
+        const uint8_t* sync = (const uint8_t*)memchr(buf + pos, m_sync, size - pos);
+        if (sync == nullptr)
+        {
+            pos = size;
+            break;
+        }
+        pos = sync - buf;
+
+        // We need the whole header before we can do anything
+        if (size - pos < 3) break;
+
+        // Fetch the payload length
+        size_t length = buf[pos+1] | (buf[pos+2] << 8);
+
+        // If the length is impossible, this wasn't really a sync byte
+        if (length > m_max_packet)
+        {
+            ++m_errors;
+            ++pos;
+            continue;
+        }
+
+        // We need the whole frame before we can check it
+        size_t frame_size = 3 + length + m_crc_size;
+        if (size - pos < frame_size) break;
+
+        // Fetch the CRC that was sent
+        uint32_t sent_crc = 0;
+        for (int i=0; i<m_crc_size; ++i) sent_crc |= (uint32_t)buf[pos + 3 + length + i] << (8 * i);
+
+        // Compute the CRC of what we actually received
+        uint32_t crc = (m_crc_type == CRC16) ? crc16_ccitt(buf + pos + 1, length + 2)
+                                             : crc32      (buf + pos + 1, length + 2);
+
+        // If the CRC is bad, resynchronize on the next sync byte
+        if (crc != sent_crc)
+        {
+            ++m_errors;
+            ++pos;
+            continue;
+        }
+
+        // It's a good packet.  Hand it over
+        m_current.assign(buf + pos + 3, buf + pos + 3 + length);
+        emit();
+        pos += frame_size;
+    }
+
+    // Throw away the bytes we're finished with
+    m_raw.erase(m_raw.begin(), m_raw.begin() + pos);
+}
+//============================================================================
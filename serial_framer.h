@@ -0,0 +1,164 @@
+//============================================================================
+// serial_framer.h - Defines binary packet framers (COBS, SLIP, and
+//                   length-prefixed with CRC) for use with CSerialPort
+//============================================================================
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <deque>
+
+
+//============================================================================
+// Table-driven CRCs
+//
+// crc16_ccitt() is CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+// crc32()       is the zlib/Ethernet CRC-32.  Pass the previous result back
+//               in as 'crc' to checksum a buffer in pieces
+//============================================================================
+uint16_t crc16_ccitt(const void* data, size_t length, uint16_t crc = 0xFFFF);
+uint32_t crc32      (const void* data, size_t length, uint32_t crc = 0);
+//============================================================================
+
+
+//============================================================================
+// Class CPacketFramer - Base class for a packet encoder/decoder.  Raw bytes
+//                       from the serial port go into feed() in whatever size
+//                       pieces they arrive in, and whole packets come out of
+//                       get_packet().  Corrupt frames are counted and thrown
+//                       away, and the decoder resynchronizes on the next one
+//============================================================================
+class CPacketFramer
+{
+public:
+
+    // Constructor and destructor
+    CPacketFramer();
+    virtual ~CPacketFramer() {}
+
+    // Call this with raw bytes from the serial port.  Returns the number of
+    // decoded packets waiting to be fetched
+    int     feed(const void* data, int count);
+
+    // Fetches the next decoded packet.  Returns 'false' if there isn't one
+    bool    get_packet(std::vector<uint8_t>* p_packet);
+
+    // Returns the number of decoded packets waiting to be fetched
+    int     packets_waiting() {return m_packets.size();}
+
+    // Encodes a packet, ready to be written to the serial port
+    virtual void encode(const void* data, int count, std::vector<uint8_t>* p_out) = 0;
+
+    // Throws away any partially decoded frame and any waiting packets
+    virtual void reset();
+
+    // Call this to set the size of the largest legal packet
+    void    set_max_packet(size_t size) {m_max_packet = size;}
+
+    // Returns the number of corrupt or oversized frames thrown away
+    uint32_t errors() {return m_errors;}
+
+protected:
+
+    // Derived classes implement this to decode a buffer full of raw bytes
+    virtual void decode(const uint8_t* data, int count) = 0;
+
+    // Derived classes call this when m_current holds a complete packet
+    void    emit();
+
+    // Derived classes call this when the frame in m_current is bad
+    void    discard();
+
+    // The packet currently being decoded
+    std::vector<uint8_t> m_current;
+
+    // Decoded packets waiting to be fetched
+    std::deque<std::vector<uint8_t>> m_packets;
+
+    // Frames larger than this are considered corrupt
+    size_t   m_max_packet;
+
+    // The number of frames that were thrown away
+    uint32_t m_errors;
+};
+//============================================================================
+
+
+//============================================================================
+// Class CCobsFramer - Consistent Overhead Byte Stuffing.  Frames are
+//                     terminated by a 0x00 byte
+//============================================================================
+class CCobsFramer : public CPacketFramer
+{
+public:
+    CCobsFramer() {reset();}
+    void    encode(const void* data, int count, std::vector<uint8_t>* p_out) override;
+    void    reset() override;
+
+protected:
+    void    decode(const uint8_t* data, int count) override;
+
+    // The code byte of the current block, and the data bytes remaining in it
+    int     m_code, m_remaining;
+
+    // True if we're in the middle of a frame that has already gone bad
+    bool    m_bad;
+};
+//============================================================================
+
+
+//============================================================================
+// Class CSlipFramer - RFC 1055 SLIP framing.  Frames are terminated by 0xC0
+//============================================================================
+class CSlipFramer : public CPacketFramer
+{
+public:
+    CSlipFramer() {reset();}
+    void    encode(const void* data, int count, std::vector<uint8_t>* p_out) override;
+    void    reset() override;
+
+protected:
+    void    decode(const uint8_t* data, int count) override;
+
+    // True if the previous byte was an escape character
+    bool    m_escaped;
+
+    // True if we're in the middle of a frame that has already gone bad
+    bool    m_bad;
+};
+//============================================================================
+
+
+//============================================================================
+// Class CLengthCrcFramer - Frames look like this (multi-byte fields are
+//                          little-endian):
+//
+//      sync byte | 16-bit payload length | payload | CRC
+//
+// The CRC is either CRC-16/CCITT or CRC-32, and covers the length and the
+// payload.  On a bad CRC, we resynchronize on the next sync byte after the
+// start of the bad frame
+//============================================================================
+class CLengthCrcFramer : public CPacketFramer
+{
+public:
+    enum crc_t {CRC16, CRC32};
+
+    CLengthCrcFramer(crc_t crc_type = CRC16, uint8_t sync = 0xA5);
+    void    encode(const void* data, int count, std::vector<uint8_t>* p_out) override;
+    void    reset() override;
+
+protected:
+    void    decode(const uint8_t* data, int count) override;
+
+    // The type of CRC, and how many bytes it occupies
+    crc_t   m_crc_type;
+    int     m_crc_size;
+
+    // The byte that marks the start of a frame
+    uint8_t m_sync;
+
+    // Raw bytes that haven't been decoded yet
+    std::vector<uint8_t> m_raw;
+};
+//============================================================================
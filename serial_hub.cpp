@@ -0,0 +1,377 @@
+//============================================================================
+// serial_hub.cpp - Implements an epoll() based serial port multiplexer
+//============================================================================
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include "serial_hub.h"
+#include "serial_framer.h"
+using namespace std;
+
+
+//============================================================================
+// Constructor() - Creates the epoll instance and registers the stop event
+//============================================================================
+CSerialHub::CSerialHub()
+{
+    epoll_event ev = {};
+
+    // Lines longer than this get truncated
+    m_max_line = 4096;
+
+    // Create the epoll instance
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    // The stop event is level-triggered so that it wakes every thread
+    ev.events  = EPOLLIN;
+    ev.data.fd = m_stop_event.fd();
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+}
+//============================================================================
+
+
+//============================================================================
+// Destructor() - Closes the epoll instance.  The ports themselves are left
+//                open, since we don't own them
+//============================================================================
+CSerialHub::~CSerialHub()
+{
+    if (m_epoll_fd >= 0) ::close(m_epoll_fd);
+}
+//============================================================================
+
+
+//============================================================================
+// now_ms() - Returns the monotonic clock in milliseconds
+//============================================================================
+uint64_t CSerialHub::now_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+//============================================================================
+
+
+//============================================================================
+// add_port() - Registers a port whose data is lines of text
+//
+// Passed:  port       = An open serial port
+//          on_line    = Called with each line of text received
+//          timeout_ms = How long the port may be quiet before on_timeout is
+//                       called.  SP_NO_TIMEOUT = never
+//          on_timeout = Called when the port has been quiet too long
+//
+// Returns: 'true' on success, 'false' if the port isn't open or is already
+//          registered
+//============================================================================
+bool CSerialHub::add_port(CSerialPort* port, line_cb_t on_line, int timeout_ms,
+                          timeout_cb_t on_timeout)
+{
+    auto p = make_shared<port_t>();
+    p->port       = port;
+    p->framer     = nullptr;
+    p->on_line    = on_line;
+    p->on_timeout = on_timeout;
+    p->timeout_ms = timeout_ms;
+    return add_port(p);
+}
+//============================================================================
+
+
+//============================================================================
+// add_port() - Registers a port whose data is packets
+//
+// Passed:  port       = An open serial port
+//          framer     = The framer that decodes this port's packets
+//          on_packet  = Called with each packet decoded
+//          timeout_ms = How long the port may be quiet before on_timeout is
+//                       called.  SP_NO_TIMEOUT = never
+//          on_timeout = Called when the port has been quiet too long
+//
+// Returns: 'true' on success, 'false' if the port isn't open or is already
+//          registered
+//============================================================================
+bool CSerialHub::add_port(CSerialPort* port, CPacketFramer* framer, packet_cb_t on_packet,
+                          int timeout_ms, timeout_cb_t on_timeout)
+{
+    auto p = make_shared<port_t>();
+    p->port       = port;
+    p->framer     = framer;
+    p->on_packet  = on_packet;
+    p->on_timeout = on_timeout;
+    p->timeout_ms = timeout_ms;
+    return add_port(p);
+}
+//============================================================================
+
+
+//============================================================================
+// add_port() - Registers a fully populated port_t with epoll
+//============================================================================
+bool CSerialHub::add_port(shared_ptr<port_t> p)
+{
+    epoll_event ev = {};
+
+    // Make sure the port is open
+    p->fd = p->port->get_fd();
+    if (p->fd < 0) return false;
+
+    // The port hasn't been quiet yet
+    p->last_activity_ms = now_ms();
+    p->removed          = false;
+
+    lock_guard<mutex> lock(m_mutex);
+
+    // A port can only be registered once
+    if (m_ports.count(p->fd)) return false;
+
+    // EPOLLONESHOT guarantees that only one thread services the port at a
+    // time.  The port gets re-armed once that thread is done with it
+    ev.events  = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = p->fd;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, p->fd, &ev) < 0) return false;
+
+    // Keep track of this port
+    m_ports[p->fd] = p;
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// remove_port() - Unregisters a port
+//============================================================================
+void CSerialHub::remove_port(CSerialPort* port)
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    // Find this port.  We can't go by its fd, since it may have been closed
+    for (auto it = m_ports.begin(); it != m_ports.end(); ++it)
+    {
+        if (it->second->port != port) continue;
+
+        // Any thread currently servicing this port won't re-arm it
+        it->second->removed = true;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, it->first, nullptr);
+        m_ports.erase(it);
+        return;
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// port_count() - Returns the number of registered ports
+//============================================================================
+int CSerialHub::port_count()
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_ports.size();
+}
+//============================================================================
+
+
+//============================================================================
+// next_timeout() - Returns the number of milliseconds that epoll_wait() may
+//                  sleep before some port's timeout is due
+//
+// Passed:  timeout_ms = The longest the caller is willing to wait.  -1 means
+//                       forever
+//============================================================================
+int CSerialHub::next_timeout(int timeout_ms)
+{
+    uint64_t now = now_ms();
+
+    lock_guard<mutex> lock(m_mutex);
+
+    for (auto& it : m_ports)
+    {
+        port_t& p = *it.second;
+
+        // Skip over ports that don't have a timeout
+        if (p.timeout_ms < 0 || !p.on_timeout) continue;
+
+        // How long until this port times out?
+        uint64_t due  = p.last_activity_ms + p.timeout_ms;
+        int      wait = (due > now) ? (int)(due - now) : 0;
+
+        // Keep track of the soonest one
+        if (timeout_ms < 0 || wait < timeout_ms) timeout_ms = wait;
+    }
+
+    return timeout_ms;
+}
+//============================================================================
+
+
+//============================================================================
+// check_timeouts() - Calls the timeout callback on every port that has been
+//                    quiet for its timeout period
+//
+// Returns: The number of timeout callbacks that were called
+//============================================================================
+int CSerialHub::check_timeouts()
+{
+    vector<shared_ptr<port_t>> expired;
+    uint64_t now = now_ms();
+    int      count = 0;
+
+    // Find all of the ports that are due.  We don't call back with m_mutex
+    // held, so that callbacks can add or remove ports
+    m_mutex.lock();
+    for (auto& it : m_ports)
+    {
+        port_t& p = *it.second;
+        if (p.timeout_ms < 0 || !p.on_timeout) continue;
+        if (now >= p.last_activity_ms + p.timeout_ms) expired.push_back(it.second);
+    }
+    m_mutex.unlock();
+
+    for (auto& p : expired)
+    {
+        lock_guard<mutex> lock(p->mutex);
+
+        // Another thread may have beaten us to it
+        if (p->removed || now < p->last_activity_ms + p->timeout_ms) continue;
+
+        // The next timeout is another full period from now
+        p->last_activity_ms = now;
+        p->on_timeout(p->port);
+        ++count;
+    }
+
+    return count;
+}
+//============================================================================
+
+
+//============================================================================
+// service() - Reads whatever data is waiting on a port, hands it to the
+//             line assembler or the framer, and dispatches the callbacks
+//============================================================================
+void CSerialHub::service(shared_ptr<port_t> p, uint32_t events)
+{
+    uint8_t buffer[4096];
+    vector<uint8_t> packet;
+    bool    hung_up = false;
+
+    p->mutex.lock();
+
+    // Fetch whatever data is available.  epoll told us there's some, so
+    // this won't block
+    ssize_t count = ::read(p->fd, buffer, sizeof buffer);
+
+    // A failed read or a hang-up with nothing left to read means the port
+    // is gone
+    if (count < 0 && errno != EINTR && errno != EAGAIN) hung_up = true;
+    if (count <= 0 && (events & (EPOLLHUP | EPOLLERR))) hung_up = true;
+
+    // If we got data, this port isn't idle
+    if (count > 0) p->last_activity_ms = now_ms();
+
+    // If this is a packet port, decode and dispatch the packets
+    if (count > 0 && p->framer)
+    {
+        p->framer->feed(buffer, count);
+        while (p->framer->get_packet(&packet)) p->on_packet(p->port, packet);
+    }
+
+    // Otherwise, assemble and dispatch lines of text
+    else if (count > 0)
+    {
+        for (ssize_t i = 0; i < count; ++i)
+        {
+            char c = buffer[i];
+
+            // Carriage returns are thrown away
+            if (c == '\r') continue;
+
+            // A line-feed ends the line
+            if (c == '\n')
+            {
+                p->on_line(p->port, p->line);
+                p->line.clear();
+                continue;
+            }
+
+            // If the line has room for this character, append it
+            if (p->line.size() < m_max_line) p->line += c;
+        }
+    }
+
+    p->mutex.unlock();
+
+    // If the port hung up, take it out of the hub and tell someone
+    if (hung_up)
+    {
+        remove_port(p->port);
+        if (m_hangup_cb) m_hangup_cb(p->port);
+        return;
+    }
+
+    // Re-arm the port, unless a callback removed it
+    lock_guard<mutex> lock(m_mutex);
+    if (!p->removed)
+    {
+        epoll_event ev = {};
+        ev.events  = EPOLLIN | EPOLLONESHOT;
+        ev.data.fd = p->fd;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, p->fd, &ev);
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// poll_once() - Waits for activity on any port and services it
+//
+// Passed:  timeout_ms = The maximum time to wait.  -1 = wait forever
+//
+// Returns: The number of ports that were serviced (including timeouts)
+//============================================================================
+int CSerialHub::poll_once(int timeout_ms)
+{
+    epoll_event events[16];
+    int serviced = 0;
+
+    // Don't sleep past the next port timeout
+    int wait_ms = next_timeout(timeout_ms);
+
+    // Wait for something to happen
+    int count = epoll_wait(m_epoll_fd, events, 16, wait_ms);
+
+    // Service every port that has data waiting
+    for (int i = 0; i < count; ++i)
+    {
+        // The stop event stays triggered, so just ignore it here
+        if (events[i].data.fd == m_stop_event.fd()) continue;
+
+        // Find the port this event belongs to
+        m_mutex.lock();
+        auto it = m_ports.find(events[i].data.fd);
+        shared_ptr<port_t> p = (it == m_ports.end()) ? nullptr : it->second;
+        m_mutex.unlock();
+
+        // If it was removed in the meantime, there's nothing to do
+        if (!p) continue;
+
+        service(p, events[i].events);
+        ++serviced;
+    }
+
+    // And handle any ports that have been quiet too long
+    return serviced + check_timeouts();
+}
+//============================================================================
+
+
+//============================================================================
+// run() - Services ports until someone calls stop()
+//============================================================================
+void CSerialHub::run()
+{
+    while (!m_stop_event.is_triggered()) poll_once(-1);
+}
+//============================================================================
@@ -0,0 +1,142 @@
+//============================================================================
+// serial_hub.h - Defines an epoll() based multiplexer that services many
+//                serial ports from one (or a few) threads
+//============================================================================
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include "serial_port.h"
+#include "event.h"
+
+class CPacketFramer;
+
+
+//============================================================================
+// Class CSerialHub - Each registered port gets its own receive buffer and
+//                    either a line callback or a packet callback.  Any
+//                    number of threads may call run() or poll_once() on the
+//                    same hub.  A given port is only ever serviced by one
+//                    thread at a time, so per-port callbacks never overlap.
+//
+//                    Ports registered with the hub must not have their async
+//                    reader enabled, and must not be read from directly
+//============================================================================
+class CSerialHub
+{
+public:
+
+    // Called with each line of text received.  CR/LF is stripped off
+    typedef std::function<void(CSerialPort*, const std::string&)> line_cb_t;
+
+    // Called with each packet decoded by the port's framer
+    typedef std::function<void(CSerialPort*, const std::vector<uint8_t>&)> packet_cb_t;
+
+    // Called when a port has received nothing for its timeout period, and
+    // again each time another timeout period elapses in silence
+    typedef std::function<void(CSerialPort*)> timeout_cb_t;
+
+    // Called when a port hangs up (i.e., a USB adapter is unplugged).  The
+    // port has already been removed from the hub
+    typedef std::function<void(CSerialPort*)> hangup_cb_t;
+
+    // Constructor and destructor
+    CSerialHub();
+    ~CSerialHub();
+
+    // Registers a port whose data is lines of text.  The timeout is in
+    // milliseconds, and SP_NO_TIMEOUT disables it
+    bool    add_port(CSerialPort* port, line_cb_t on_line,
+                     int timeout_ms = SP_NO_TIMEOUT, timeout_cb_t on_timeout = nullptr);
+
+    // Registers a port whose data is packets.  The hub doesn't own the framer
+    bool    add_port(CSerialPort* port, CPacketFramer* framer, packet_cb_t on_packet,
+                     int timeout_ms = SP_NO_TIMEOUT, timeout_cb_t on_timeout = nullptr);
+
+    // Unregisters a port.  Safe to call from inside a callback
+    void    remove_port(CSerialPort* port);
+
+    // Returns the number of registered ports
+    int     port_count();
+
+    // Call this to be told when a port hangs up
+    void    set_hangup_callback(hangup_cb_t callback) {m_hangup_cb = callback;}
+
+    // Sets the longest line a line port will assemble.  Characters past
+    // this are thrown away until the line-feed arrives.  Call this before
+    // any thread is in run() or poll_once()
+    void    set_max_line(size_t max_len) {m_max_line = max_len;}
+
+    // Waits up to 'timeout_ms' for activity and services it.  -1 = wait
+    // forever.  Returns the number of ports that were serviced
+    int     poll_once(int timeout_ms);
+
+    // Services ports until stop() is called
+    void    run();
+
+    // Causes every thread in run() to return
+    void    stop() {m_stop_event.set();}
+
+    // Clears a previous stop(), so run() can be called again
+    void    restart() {m_stop_event.reset();}
+
+    // Returns the epoll file descriptor, for nesting in another event loop
+    int     fd() {return m_epoll_fd;}
+
+protected:
+
+    // Everything we know about a registered port
+    struct port_t
+    {
+        CSerialPort*    port;
+        int             fd;
+        CPacketFramer*  framer;
+        line_cb_t       on_line;
+        packet_cb_t     on_packet;
+        timeout_cb_t    on_timeout;
+        int             timeout_ms;
+        std::atomic<uint64_t> last_activity_ms;
+        std::atomic<bool>     removed;
+        std::string     line;
+        std::mutex      mutex;
+    };
+
+    // Registers a fully populated port_t with epoll
+    bool    add_port(std::shared_ptr<port_t> p);
+
+    // Reads whatever is waiting on a port and dispatches the callbacks
+    void    service(std::shared_ptr<port_t> p, uint32_t events);
+
+    // Fires the timeout callback on any port that's been quiet too long
+    int     check_timeouts();
+
+    // Returns how long epoll_wait() may sleep before a timeout is due
+    int     next_timeout(int timeout_ms);
+
+    // Returns the monotonic clock in milliseconds
+    static uint64_t now_ms();
+
+    // The epoll instance that watches all of the ports
+    int     m_epoll_fd;
+
+    // The registered ports, keyed by file descriptor
+    std::map<int, std::shared_ptr<port_t>> m_ports;
+
+    // Protects m_ports
+    std::mutex  m_mutex;
+
+    // Called when a port hangs up
+    hangup_cb_t m_hangup_cb;
+
+    // The longest line we'll assemble for a line port
+    size_t  m_max_line;
+
+    // When this is set, run() returns
+    CEvent  m_stop_event;
+};
+//============================================================================
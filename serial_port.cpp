@@ -8,9 +8,20 @@
 #include <sys/ioctl.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <linux/serial.h>
 #include "serial_port.h"
+#include "serial_reader.h"
+#include "serial_framer.h"
+#include "serial_writer.h"
+#include "serial_capture.h"
+#include <chrono>
+#include <thread>
 using std::string;
 
+// Sets a non-standard baud-rate.  This lives in serial_baud.cpp because the
+// termios2 headers it needs collide with <termios.h>
+bool sp_set_custom_baud(int fd, uint32_t baud);
+
 //============================================================================
 // Constructor() - Serial port begins in the 'closed' state
 //============================================================================
@@ -42,6 +53,10 @@ void CSerialPort::set_default_read_timeout(int milliseconds)
 //============================================================================
 void CSerialPort::close()
 {
+    // If there's a reader or writer thread running, stop it
+    enable_async_reader(false);
+    enable_async_writer(false);
+
     // If the serial port is open, close it
     if (m_fd >= 0) ::close(m_fd);
 
@@ -57,19 +72,69 @@ void CSerialPort::close()
 //
 // Returns:  One of the baud-rate constants from termios.h
 //              -- OR --
-//           (speed_t)0 to indicate the requested baud-rate is insupported
+//           (speed_t)0 to indicate that there's no constant for this rate,
+//           in which case the caller must set it with sp_set_custom_baud()
 //=============================================================================
 speed_t CSerialPort::baud_to_constant(uint32_t baud)
 {
     switch (baud)
     {
+        case 50:        return B50;
+        case 75:        return B75;
+        case 110:       return B110;
+        case 134:       return B134;
+        case 150:       return B150;
+        case 200:       return B200;
         case 300:       return B300;
+        case 600:       return B600;
         case 1200:      return B1200;
+        case 1800:      return B1800;
+        case 2400:      return B2400;
+        case 4800:      return B4800;
         case 9600:      return B9600;
         case 19200:     return B19200;
         case 38400:     return B38400;
         case 57600:     return B57600;
         case 115200:    return B115200;
+#ifdef B230400
+        case 230400:    return B230400;
+#endif
+#ifdef B460800
+        case 460800:    return B460800;
+#endif
+#ifdef B500000
+        case 500000:    return B500000;
+#endif
+#ifdef B576000
+        case 576000:    return B576000;
+#endif
+#ifdef B921600
+        case 921600:    return B921600;
+#endif
+#ifdef B1000000
+        case 1000000:   return B1000000;
+#endif
+#ifdef B1152000
+        case 1152000:   return B1152000;
+#endif
+#ifdef B1500000
+        case 1500000:   return B1500000;
+#endif
+#ifdef B2000000
+        case 2000000:   return B2000000;
+#endif
+#ifdef B2500000
+        case 2500000:   return B2500000;
+#endif
+#ifdef B3000000
+        case 3000000:   return B3000000;
+#endif
+#ifdef B3500000
+        case 3500000:   return B3500000;
+#endif
+#ifdef B4000000
+        case 4000000:   return B4000000;
+#endif
     };
 
     // Tell the caller that we don't support the baud-rate
@@ -79,20 +144,53 @@ speed_t CSerialPort::baud_to_constant(uint32_t baud)
 
 
 //============================================================================
-// open() - Opens a connection to the serial port.
+// open() - Opens a connection to the serial port at 8-N-1
 //============================================================================
 bool CSerialPort::open(string device, uint32_t baud)
 {
-    termios tio;
+    serial_config_t config;
+    config.baud = baud;
+    return open(device, config);
+}
+//============================================================================
+
+
+//============================================================================
+// open() - Opens a connection to the serial port
+//
+// Passed:  device = The name of the device file (i.e., "/dev/ttyUSB0")
+//          config = The baud-rate, framing, flow control, etc.
+//
+// Returns: 'true' on success, 'false' if the device can't be opened or the
+//          configuration is invalid
+//============================================================================
+bool CSerialPort::open(string device, const serial_config_t& config)
+{
+    termios  tio;
+    tcflag_t char_size;
 
     // Make sure that any currently open connection is closed
     close();
 
-    // Convert the integer baud-rate into one of the termios speed constants
-    speed_t speed = baud_to_constant(baud);
+    // Convert the number of data bits into a termios character size
+    switch (config.data_bits)
+    {
+        case 5:  char_size = CS5; break;
+        case 6:  char_size = CS6; break;
+        case 7:  char_size = CS7; break;
+        case 8:  char_size = CS8; break;
+        default: return false;
+    }
+
+    // Make sure the parity and stop bits are sensible
+    if (strchr("NEOMS", config.parity) == nullptr || config.parity == 0) return false;
+    if (config.stop_bits != 1 && config.stop_bits != 2) return false;
+    if (config.baud == 0) return false;
 
-    // If the requested baud-rate was illegal, tell the caller
-    if (speed == (speed_t)0) return false;
+    // Convert the integer baud-rate into one of the termios speed constants.
+    // If there isn't one, we'll set the exact rate after the port is open
+    speed_t speed  = baud_to_constant(config.baud);
+    bool    custom = (speed == (speed_t)0);
 
     // Open the device file
     m_fd = ::open(device.c_str(), O_RDWR | O_NOCTTY);
@@ -106,11 +204,58 @@ bool CSerialPort::open(string device, uint32_t baud)
     // Fill in the settings that make this a non-canonical (i.e., raw) port
     cfmakeraw(&tio);
 
-    // Set up the speed (and 8/N/1)
-    tio.c_cflag = speed | CS8 | CLOCAL | CREAD;
+    // Set up the speed and character size.  A custom baud-rate gets
+    // overwritten by sp_set_custom_baud() below
+    tio.c_cflag = (custom ? B38400 : speed) | char_size | CLOCAL | CREAD;
+
+    // Set up the parity.  Mark and space parity are "sticky" even/odd parity
+    switch (config.parity)
+    {
+        case 'E':   tio.c_cflag |= PARENB;                   break;
+        case 'O':   tio.c_cflag |= PARENB | PARODD;          break;
+        case 'M':   tio.c_cflag |= PARENB | PARODD | CMSPAR; break;
+        case 'S':   tio.c_cflag |= PARENB | CMSPAR;          break;
+    }
+
+    // If there's a parity bit, have the driver check it
+    if (tio.c_cflag & PARENB) tio.c_iflag |= INPCK;
+
+    // Set up the number of stop bits
+    if (config.stop_bits == 2) tio.c_cflag |= CSTOPB;
+
+    // Set up flow control
+    if (config.rtscts)  tio.c_cflag |= CRTSCTS;
+    if (config.xonxoff) tio.c_iflag |= IXON | IXOFF;
+
+    // Set up how a blocking read() behaves
+    tio.c_cc[VMIN]  = config.vmin;
+    tio.c_cc[VTIME] = config.vtime;
 
     // Set the settings for this serial port
-    tcsetattr(m_fd, TCSANOW, &tio);
+    if (tcsetattr(m_fd, TCSANOW, &tio) < 0)
+    {
+        close();
+        return false;
+    }
+
+    // If there's no termios constant for this baud-rate, set it exactly
+    if (custom && !sp_set_custom_baud(m_fd, config.baud))
+    {
+        close();
+        return false;
+    }
+
+    // If the caller wants low latency, ask the driver for it.  Not every
+    // driver supports this, so failure isn't an error
+    if (config.low_latency)
+    {
+        serial_struct ss;
+        if (ioctl(m_fd, TIOCGSERIAL, &ss) == 0)
+        {
+            ss.flags |= ASYNC_LOW_LATENCY;
+            ioctl(m_fd, TIOCSSERIAL, &ss);
+        }
+    }
 
     // Tell the caller that all is well
     return true;
@@ -136,6 +281,9 @@ bool CSerialPort::data_is_available(int timeout_ms)
     // If we're supposed to use the default timeout, do so
     if (timeout_ms == SP_DEFAULT_TIMEOUT) timeout_ms = m_default_timeout_ms;
 
+    // If the async reader is running, the data is in its ring-buffer
+    if (m_reader) return m_reader->data_is_available(timeout_ms);
+
     // Assume for the moment that we are going to wait forever
     timeval* pTimeout = NULL;
 
@@ -171,10 +319,8 @@ bool CSerialPort::data_is_available(int timeout_ms)
 //============================================================================
 void CSerialPort::drain_input(int timeout_ms)
 {
-    char c;
-
     // Read in and throw away data until the line goes quiet for awhile
-    while (data_is_available(timeout_ms)) ::read(m_fd, &c, 1);
+    while (data_is_available(timeout_ms)) get_char(0);
 }
 //============================================================================
 
@@ -185,18 +331,38 @@ void CSerialPort::drain_input(int timeout_ms)
 //============================================================================
 bool CSerialPort::get_line(void* buffer, int timeout_ms)
 {
+    return get_line(buffer, nullptr, timeout_ms);
+}
+//============================================================================
+
+
+//============================================================================
+// get_line() - Fetches a line from the serial port, along with the arrival
+//              time of its first character.  Throws away carriage returns
+//              and strips off the terminating line-feed
+//
+// Arrival times are only accurate when the async reader is enabled.
+// Otherwise, they're the time we got around to reading the character
+//============================================================================
+bool CSerialPort::get_line(void* buffer, uint64_t* p_timestamp, int timeout_ms)
+{
+    uint64_t timestamp;
+
     // Convert "buffer" to a char*
     char* out = (char*) buffer;
 
     // We're going to read bytes until we encounter a line-feed...
-    while (true)
+    for (bool first = true; true; first = false)
     {
         // Read a single character from the serial port using get_char
-        int c = get_char(timeout_ms);
+        int c = get_char(timeout_ms, (first && p_timestamp) ? &timestamp : nullptr);
 
         // If a timeout occured, tell the caller
         if (c == -1) return false;
 
+        // If this is the first character of the line, it's the line's timestamp
+        if (first && p_timestamp) *p_timestamp = timestamp;
+
         // If it's a carriage return, throw it away
         if (c == '\r') continue;
 
@@ -264,17 +430,32 @@ void CSerialPort::put_line(const void* text)
 //               --OR--
 //          A -1 to indicate that no character was available to read
 //============================================================================
-int CSerialPort::get_char(int timeout_ms)
+int CSerialPort::get_char(int timeout_ms, uint64_t* p_timestamp)
 {
     unsigned char c;
 
+    // If the async reader is running, fetch the character from its ring
+    if (m_reader)
+    {
+        if (timeout_ms == SP_DEFAULT_TIMEOUT) timeout_ms = m_default_timeout_ms;
+        int result = m_reader->get_char(timeout_ms, p_timestamp);
+        if (m_sniff && result != -1) ::printf("%c", result);
+        return result;
+    }
+
     // Wait for a character to be available for reading, and if one doesn't
     // arrive within the specified timeout, tell the caller that a timeout
     // occured.
     if (!data_is_available(timeout_ms)) return -1;
 
     // Read a single character from the serial port
-    ::read(m_fd, &c, 1);
+    if (::read(m_fd, &c, 1) != 1) return -1;
+
+    // If the caller wants to know when the character arrived, tell them
+    if (p_timestamp) *p_timestamp = CSerialReader::now_ns();
+
+    // If we're recording traffic, record it
+    if (m_capture) m_capture->record(CSerialCapture::RX, &c, 1);
 
     // If we are supposed to display our output, do so
     if (m_sniff) ::printf("%c", c);
@@ -328,7 +509,15 @@ bool CSerialPort::read(void* buffer, int count, int timeout_ms)
 //============================================================================
 void CSerialPort::write(const void* buffer, int count)
 {
-    ::write(m_fd, buffer, count);
+    // If the async writer is running, just queue the data.  Otherwise
+    // write it directly
+    if (m_writer)
+        m_writer->enqueue(buffer, count);
+    else
+        ::write(m_fd, buffer, count);
+
+    // If we're recording traffic, record it
+    if (m_capture) m_capture->record(CSerialCapture::TX, buffer, count);
 
     // If we're sniffing...
     if (m_sniff)
@@ -347,4 +536,231 @@ void CSerialPort::write(const void* buffer, int count)
 //============================================================================
 
 
+//============================================================================
+// enable_async_reader() - Starts or stops the background reader thread
+//
+// Passed:  flag        = true to start the reader, false to stop it
+//          ring_chunks = The number of chunks in the ring-buffer.  Each
+//                        chunk holds up to CSerialReader::CHUNK_SIZE bytes
+//
+// Returns: 'true' on success, 'false' if the port isn't open
+//============================================================================
+bool CSerialPort::enable_async_reader(bool flag, int ring_chunks)
+{
+    // Stop and throw away any existing reader
+    if (m_reader)
+    {
+        m_reader->stop();
+        delete m_reader;
+        m_reader = nullptr;
+    }
+
+    // If we're just stopping the reader, we're done
+    if (!flag) return true;
+
+    // We can't read from a port that isn't open
+    if (m_fd < 0) return false;
+
+    // Create the reader and start it draining the port
+    m_reader = new CSerialReader;
+    m_reader->set_capture(m_capture);
+    return m_reader->start(m_fd, ring_chunks);
+}
+//============================================================================
+
+
+//============================================================================
+// reader_failed() - Returns 'true' if the async reader thread has stopped
+//                   because the port failed or hung up
+//============================================================================
+bool CSerialPort::reader_failed(int* p_errno)
+{
+    return m_reader && m_reader->failed(p_errno);
+}
+//============================================================================
+
+
+//============================================================================
+// set_capture() - Starts or stops recording traffic
+//
+// Passed:  capture = An open CSerialCapture, or nullptr to stop recording
+//
+// While the async reader is running, received data is recorded by the
+// reader thread with its true arrival time
+//============================================================================
+void CSerialPort::set_capture(CSerialCapture* capture)
+{
+    m_capture = capture;
+    if (m_reader) m_reader->set_capture(capture);
+}
+//============================================================================
+
 
+//============================================================================
+// read_chunk() - Fetches whatever data is available, up to 'max' bytes
+//
+// Passed:  buffer      = Where to store the data
+//          max         = The maximum number of bytes to fetch
+//          p_timestamp = If not null, receives the arrival time (monotonic
+//                        nanoseconds) of the first byte
+//          timeout_ms  = How long to wait for data to arrive
+//
+// Returns: The number of bytes read.  0 means we timed out
+//============================================================================
+int CSerialPort::read_chunk(void* buffer, int max, uint64_t* p_timestamp, int timeout_ms)
+{
+    // If we're supposed to use the default timeout, do so
+    if (timeout_ms == SP_DEFAULT_TIMEOUT) timeout_ms = m_default_timeout_ms;
+
+    // If the async reader is running, the data is in its ring-buffer
+    if (m_reader) return m_reader->read(buffer, max, timeout_ms, p_timestamp);
+
+    // Wait for data to arrive
+    if (max < 1 || !data_is_available(timeout_ms)) return 0;
+
+    // This is when we noticed the data
+    if (p_timestamp) *p_timestamp = CSerialReader::now_ns();
+
+    // Read whatever is available
+    int count = ::read(m_fd, buffer, max);
+
+    // If we're recording traffic, record it
+    if (m_capture && count > 0) m_capture->record(CSerialCapture::RX, buffer, count);
+
+    // Tell the caller how many bytes we read
+    return (count < 0) ? 0 : count;
+}
+//============================================================================
+
+
+//============================================================================
+// get_packet() - Fetches the next whole packet from the serial port
+//
+// Passed:  framer     = The framer that decodes packets on this link.  It
+//                       holds any partial frame between calls
+//          p_packet   = Where to store the decoded packet
+//          timeout_ms = How long to wait for each burst of data to arrive
+//
+// Returns: 'true' if a packet was fetched, 'false' on timeout
+//============================================================================
+bool CSerialPort::get_packet(CPacketFramer* framer, std::vector<uint8_t>* p_packet, int timeout_ms)
+{
+    uint8_t buffer[4096];
+
+    // Keep reading until the framer has a whole packet for us
+    while (!framer->get_packet(p_packet))
+    {
+        // Fetch whatever has arrived, in bulk
+        int count = read_chunk(buffer, sizeof buffer, nullptr, timeout_ms);
+
+        // If nothing arrived, tell the caller that we timed out
+        if (count == 0) return false;
+
+        // Hand the data to the framer for decoding
+        framer->feed(buffer, count);
+    }
+
+    // Tell the caller that their packet is ready
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// put_packet() - Encodes a packet and writes it to the serial port
+//============================================================================
+void CSerialPort::put_packet(CPacketFramer* framer, const void* packet, int count)
+{
+    std::vector<uint8_t> frame;
+    framer->encode(packet, count, &frame);
+    write(frame.data(), frame.size());
+}
+//============================================================================
+
+
+//============================================================================
+// enable_async_writer() - Starts or stops the background writer thread
+//
+// Passed:  flag       = true to start the writer, false to stop it
+//          high_water = Queue size (bytes) at which the back-pressure
+//                       callback is told to back off
+//          low_water  = Queue size (bytes) at which it's told to resume
+//
+// Returns: 'true' on success, 'false' if the port isn't open
+//
+// Stopping the writer throws away anything still in the queue.  Call
+// flush() first if that matters
+//============================================================================
+bool CSerialPort::enable_async_writer(bool flag, size_t high_water, size_t low_water)
+{
+    // Stop and throw away any existing writer
+    if (m_writer)
+    {
+        m_writer->stop();
+        delete m_writer;
+        m_writer = nullptr;
+    }
+
+    // If we're just stopping the writer, we're done
+    if (!flag) return true;
+
+    // We can't write to a port that isn't open
+    if (m_fd < 0) return false;
+
+    // Create the writer and start it
+    m_writer = new CSerialWriter;
+    m_writer->set_backpressure_callback(m_backpressure_cb);
+    return m_writer->start(m_fd, high_water, low_water);
+}
+//============================================================================
+
+
+//============================================================================
+// set_backpressure_callback() - Sets the function that gets called when the
+//                               async write queue crosses a water-mark
+//============================================================================
+void CSerialPort::set_backpressure_callback(std::function<void(bool)> callback)
+{
+    m_backpressure_cb = callback;
+    if (m_writer) m_writer->set_backpressure_callback(callback);
+}
+//============================================================================
+
+
+//============================================================================
+// write_queue_size() - Returns the number of bytes waiting in the async
+//                      write queue
+//============================================================================
+size_t CSerialPort::write_queue_size()
+{
+    return m_writer ? m_writer->queued() : 0;
+}
+//============================================================================
+
+
+//============================================================================
+// flush() - Waits for everything that's been written to be transmitted
+//
+// Passed:  timeout_ms = The maximum time to wait.  -1 = wait forever
+//
+// Returns: 'true' if everything was transmitted, 'false' on timeout
+//============================================================================
+bool CSerialPort::flush(int timeout_ms)
+{
+    // If the async writer is running, it knows how to do this
+    if (m_writer) return m_writer->flush(timeout_ms);
+
+    // If we're waiting forever, tcdrain() does the job
+    if (timeout_ms < 0) return tcdrain(m_fd) == 0;
+
+    // Otherwise, poll the kernel's output queue until it's empty
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true)
+    {
+        int outq = 0;
+        if (ioctl(m_fd, TIOCOUTQ, &outq) < 0 || outq == 0) return true;
+        if (std::chrono::steady_clock::now() >= deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+//============================================================================
@@ -5,6 +5,8 @@
 #include <termios.h>
 #include <string>
 #include <cstdint>
+#include <vector>
+#include <functional>
 
 //============================================================================
 // Handy constants used for describing timeout values
@@ -13,6 +15,43 @@
 #define SP_NO_TIMEOUT      -1
 //============================================================================
 
+class CSerialReader;
+class CPacketFramer;
+class CSerialWriter;
+class CSerialCapture;
+
+
+//============================================================================
+// serial_config_t - Describes how a serial port should be configured.  The
+//                   defaults are 115200-8-N-1 with no flow control
+//============================================================================
+struct serial_config_t
+{
+    // Any baud-rate.  Rates without a termios constant are set via termios2
+    uint32_t    baud        = 115200;
+
+    // 5, 6, 7 or 8
+    int         data_bits   = 8;
+
+    // 'N'one, 'E'ven, 'O'dd, 'M'ark or 'S'pace
+    char        parity      = 'N';
+
+    // 1 or 2
+    int         stop_bits   = 1;
+
+    // Hardware (RTS/CTS) and software (XON/XOFF) flow control
+    bool        rtscts      = false;
+    bool        xonxoff     = false;
+
+    // The termios VMIN and VTIME settings for a blocking read()
+    int         vmin        = 1;
+    int         vtime       = 0;
+
+    // If true, ask the driver to hand us received bytes without delay
+    bool        low_latency = false;
+};
+//============================================================================
+
 
 //============================================================================
 // Class CSerialPort - Provides an API to a UART
@@ -31,6 +70,10 @@ public:
     // Call this to open a connection.  Returns 'false' on error
     bool    open(std::string device, uint32_t baud);
 
+    // Call this to open a connection with full control over the line
+    // settings.  Returns 'false' on error
+    bool    open(std::string device, const serial_config_t& config);
+
     // Call this to close a connection
     void    close();
 
@@ -48,11 +91,29 @@ public:
     // Fetches a line of text from the serial port. Strips cr/lf off the end
     bool    get_line(void* buffer, int timeout_ms = SP_DEFAULT_TIMEOUT);
 
+    // Same as above, but also fetches the monotonic time (in nanoseconds)
+    // that the first character of the line arrived
+    bool    get_line(void* buffer, uint64_t* p_timestamp, int timeout_ms = SP_DEFAULT_TIMEOUT);
+
+    // Starts or stops a background thread that continuously drains the
+    // UART into a ring-buffer.  While it's running, all reads come from
+    // the ring-buffer and arrival times are accurate
+    bool    enable_async_reader(bool flag, int ring_chunks = 1024);
+
+    // Returns 'true' if the async reader has stopped because the port failed
+    // or hung up.  *p_errno receives the error, or 0 for end-of-file
+    bool    reader_failed(int* p_errno = nullptr);
+
+    // Fetches whatever data is available (up to 'max' bytes), along with
+    // the arrival time of the first byte.  Returns the number of bytes read
+    int     read_chunk(void* buffer, int max, uint64_t* p_timestamp = nullptr,
+                       int timeout_ms = SP_DEFAULT_TIMEOUT);
+
     // Call this to fetch the file descriptor of the UART
     int     get_fd() {return m_fd;}
 
     // Fetches one character from the serial port
-    int     get_char(int timeout_ms = SP_DEFAULT_TIMEOUT);
+    int     get_char(int timeout_ms = SP_DEFAULT_TIMEOUT, uint64_t* p_timestamp = nullptr);
 
     // Puts a single character to the serial port
     void    put_char(int byte);
@@ -63,9 +124,35 @@ public:
     // Writes a specified number of bytes from the serial port
     void    write(const void* buffer, int count);
 
+    // Fetches the next whole packet, decoded by the specified framer
+    bool    get_packet(CPacketFramer* framer, std::vector<uint8_t>* p_packet,
+                       int timeout_ms = SP_DEFAULT_TIMEOUT);
+
+    // Encodes a packet with the specified framer and writes it
+    void    put_packet(CPacketFramer* framer, const void* packet, int count);
+
+    // Starts or stops a background thread that does the actual writing, so
+    // write(), put_line(), printf() and put_char() never block on the UART
+    bool    enable_async_writer(bool flag, size_t high_water = 65536, size_t low_water = 16384);
+
+    // Call this to be told when the write queue rises above the high-water
+    // mark (true) and when it drains below the low-water mark (false)
+    void    set_backpressure_callback(std::function<void(bool)> callback);
+
+    // Returns the number of bytes in the write queue
+    size_t  write_queue_size();
+
+    // Waits for all written data to be transmitted by the UART.  Returns
+    // 'false' if that doesn't happen within the timeout.  -1 = wait forever
+    bool    flush(int timeout_ms = SP_NO_TIMEOUT);
+
     // Enable sniffing
     void    enable_sniffing(bool flag) {m_sniff = flag;}
 
+    // Call this to record all traffic in both directions, with timestamps.
+    // The capture must outlive the port or be removed with nullptr first
+    void    set_capture(CSerialCapture* capture);
+
 protected:
 
     // This returns 'true' if data is available to be read in.
@@ -79,8 +166,20 @@ protected:
     // File descriptor we use to read/write serial data
     int     m_fd;
 
+    // When the async reader is enabled, this is the thread that drains the UART
+    CSerialReader* m_reader = nullptr;
+
+    // When the async writer is enabled, this is the thread that writes to it
+    CSerialWriter* m_writer = nullptr;
+
+    // The back-pressure callback for the async writer
+    std::function<void(bool)> m_backpressure_cb;
+
+    // If this isn't null, all traffic gets recorded here
+    CSerialCapture* m_capture = nullptr;
+
     // If this is 'true', all incoming characters will be printed
-    bool    m_sniff;
+    bool    m_sniff = false;
 
     // This is the default timeout in milliseconds
     int     m_default_timeout_ms = SP_NO_TIMEOUT;
@@ -0,0 +1,358 @@
+//============================================================================
+// serial_reader.cpp - Implements a background thread that drains a serial
+//                     port into a lock-free ring-buffer of timestamped chunks
+//============================================================================
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/select.h>
+#include "serial_reader.h"
+#include "serial_capture.h"
+using namespace std;
+
+
+//============================================================================
+// Constructor() - The reader starts out stopped
+//============================================================================
+CSerialReader::CSerialReader()
+{
+    m_ring              = nullptr;
+    m_mask              = 0;
+    m_head              = 0;
+    m_tail              = 0;
+    m_consumer_sleeping = 0;
+    m_offset            = 0;
+    m_overruns          = 0;
+    m_capture           = nullptr;
+    m_fd                = -1;
+    m_running           = false;
+    m_failed            = false;
+    m_errno             = 0;
+}
+//============================================================================
+
+
+//============================================================================
+// Destructor() - Stops the reader thread and frees the ring
+//============================================================================
+CSerialReader::~CSerialReader()
+{
+    stop();
+    delete[] m_ring;
+}
+//============================================================================
+
+
+//============================================================================
+// now_ns() - Returns CLOCK_MONOTONIC in nanoseconds
+//============================================================================
+uint64_t CSerialReader::now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+//============================================================================
+
+
+//============================================================================
+// start() - Allocates the ring and spawns the reader thread
+//
+// Passed:  fd          = The file descriptor of an open serial port
+//          ring_chunks = The number of chunks in the ring
+//============================================================================
+bool CSerialReader::start(int fd, int ring_chunks)
+{
+    // Make sure we're not already running
+    stop();
+
+    // Round the ring size up to a power of 2
+    uint32_t size = 2;
+    while (size < (uint32_t)ring_chunks) size <<= 1;
+
+    // Allocate the ring
+    delete[] m_ring;
+    m_ring = new chunk_t[size];
+    m_mask = size - 1;
+
+    // The ring starts out empty
+    m_head     = 0;
+    m_tail     = 0;
+    m_offset   = 0;
+    m_overruns = 0;
+    m_errno    = 0;
+    m_failed   = false;
+
+    // Make sure the data event isn't left over from a previous run
+    m_data_event.reset();
+
+    // Spin up the reader thread
+    m_fd      = fd;
+    m_running = true;
+    spawn();
+
+    // Tell the caller that all is well
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// stop() - Stops the reader thread.  Safe to call if it isn't running
+//============================================================================
+void CSerialReader::stop()
+{
+    if (!m_running) return;
+    request_stop();
+    join();
+    m_running = false;
+}
+//============================================================================
+
+
+//============================================================================
+// failed() - Returns 'true' if the reader thread has stopped because the
+//            port failed or hung up
+//============================================================================
+bool CSerialReader::failed(int* p_errno)
+{
+    if (!m_failed.load(memory_order_acquire)) return false;
+    if (p_errno) *p_errno = m_errno;
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// main() - The reader thread.  Moves data from the serial port into the ring
+//          as fast as it arrives
+//============================================================================
+void CSerialReader::main()
+{
+    fd_set  rfds;
+    uint8_t discard[CHUNK_SIZE];
+
+    // We wait on both the serial port and the stop event
+    int stop_fd = CThread::stop_fd();
+    int max_fd  = (m_fd > stop_fd) ? m_fd : stop_fd;
+
+    while (true)
+    {
+        // Wait for data to arrive or for someone to tell us to stop
+        FD_ZERO(&rfds);
+        FD_SET(m_fd,    &rfds);
+        FD_SET(stop_fd, &rfds);
+        if (select(max_fd+1, &rfds, NULL, NULL, NULL) < 0)
+        {
+            if (errno == EINTR) continue;
+            fail(errno);
+            return;
+        }
+
+        // If we've been told to stop, we're done
+        if (FD_ISSET(stop_fd, &rfds)) break;
+
+        // This is when the data arrived
+        uint64_t timestamp = now_ns();
+
+        // Fetch the positions of the producer and consumer
+        uint32_t head = m_head.load(memory_order_relaxed);
+        uint32_t tail = m_tail.load(memory_order_acquire);
+
+        // If the ring is full, we still have to drain the port, but the
+        // data gets thrown away
+        if (head - tail > m_mask)
+        {
+            int count = ::read(m_fd, discard, sizeof discard);
+            if (count < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            if (count <= 0)
+            {
+                fail(count < 0 ? errno : 0);
+                return;
+            }
+            ++m_overruns;
+
+            // The data was still received, so it still gets recorded
+            CSerialCapture* capture = m_capture;
+            if (capture) capture->record(CSerialCapture::RX, discard, count, timestamp);
+            continue;
+        }
+
+        // Read as much as is available into the next chunk
+        chunk_t& chunk = m_ring[head & m_mask];
+        int count = ::read(m_fd, chunk.data, CHUNK_SIZE);
+
+        // If we were interrupted, or select() woke us for nothing, try again
+        if (count < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+
+        // If the port has failed or hung up, there's nothing more to do
+        if (count <= 0)
+        {
+            fail(count < 0 ? errno : 0);
+            return;
+        }
+
+        // If we're recording, record the data
+        CSerialCapture* capture = m_capture;
+        if (capture) capture->record(CSerialCapture::RX, chunk.data, count, timestamp);
+
+        // Publish the chunk to the consumer
+        chunk.timestamp_ns = timestamp;
+        chunk.length       = count;
+        m_head.store(head + 1, memory_order_release);
+
+        // If the consumer is asleep, wake it up
+        atomic_thread_fence(memory_order_seq_cst);
+        if (m_consumer_sleeping.load(memory_order_relaxed) && m_consumer_sleeping.exchange(0))
+        {
+            m_data_event.set();
+        }
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// fail() - Called by the reader thread when the port fails or hangs up.
+//          Records the reason and wakes the consumer so it doesn't wait
+//          for data that's never going to come
+//============================================================================
+void CSerialReader::fail(int error)
+{
+    m_errno = error;
+    m_failed.store(true, memory_order_release);
+    m_data_event.set();
+}
+//============================================================================
+
+
+//============================================================================
+// data_is_available() - Waits for data to arrive in the ring
+//
+// Passed:  The number of milliseconds to wait.  -1 = wait forever
+//
+// Returns: 'true' if data is available for reading, otherwise 'false'.  If
+//          the port has failed, this returns 'false' once the ring is empty
+//============================================================================
+bool CSerialReader::data_is_available(int timeout_ms)
+{
+    // If there's data in the ring, we don't need to wait
+    if (m_head.load(memory_order_acquire) != m_tail.load(memory_order_relaxed)) return true;
+
+    // If the caller doesn't want to wait, or no more data is coming, we're done
+    if (timeout_ms == 0 || m_failed.load(memory_order_acquire)) return false;
+
+    // This is when we give up waiting
+    uint64_t deadline = now_ns() + (uint64_t)timeout_ms * 1000000;
+
+    while (true)
+    {
+        // Tell the reader thread that we're about to go to sleep
+        m_consumer_sleeping.store(1);
+
+        // If data arrived in the meantime, we don't need to sleep
+        if (m_head.load() != m_tail.load(memory_order_relaxed))
+        {
+            m_consumer_sleeping.store(0);
+            return true;
+        }
+
+        // Assume for the moment that we're going to wait forever
+        uint32_t wait_ms = 0;
+
+        // If we're waiting for a finite amount of time, find out how much is left
+        if (timeout_ms >= 0)
+        {
+            uint64_t now = now_ns();
+            if (now >= deadline)
+            {
+                m_consumer_sleeping.store(0);
+                return false;
+            }
+            wait_ms = (deadline - now + 999999) / 1000000;
+        }
+
+        // Sleep until the reader thread wakes us up or we time out
+        m_data_event.wait(wait_ms);
+        m_consumer_sleeping.store(0);
+
+        // If data has arrived, tell the caller
+        if (m_head.load(memory_order_acquire) != m_tail.load(memory_order_relaxed)) return true;
+
+        // If the port has failed, there's nothing left to wait for
+        if (m_failed.load(memory_order_acquire)) return false;
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// read() - Fetches up to 'max' bytes from the ring
+//
+// Passed:  buffer      = Where to store the data
+//          max         = The maximum number of bytes to fetch
+//          timeout_ms  = How long to wait for data.  -1 = forever
+//          p_timestamp = If not null, receives the arrival time of the
+//                        first byte
+//
+// Returns: The number of bytes read.  0 = Timed out
+//============================================================================
+int CSerialReader::read(void* buffer, int max, int timeout_ms, uint64_t* p_timestamp)
+{
+    // Convert the buffer into a byte pointer
+    uint8_t* out = (uint8_t*) buffer;
+
+    // Wait for data to arrive
+    if (max < 1 || !data_is_available(timeout_ms)) return 0;
+
+    // If the caller wants to know when the data arrived, tell them
+    if (p_timestamp) *p_timestamp = m_ring[m_tail & m_mask].timestamp_ns;
+
+    // Fetch the positions of the producer and consumer
+    uint32_t head = m_head.load(memory_order_acquire);
+    uint32_t tail = m_tail.load(memory_order_relaxed);
+
+    // Keep track of how many bytes we've fetched
+    int count = 0;
+
+    // Copy out of as many chunks as it takes
+    while (tail != head && count < max)
+    {
+        chunk_t& chunk = m_ring[tail & m_mask];
+
+        // Copy out as much of this chunk as will fit
+        int n = chunk.length - m_offset;
+        if (n > max - count) n = max - count;
+        memcpy(out + count, chunk.data + m_offset, n);
+        count    += n;
+        m_offset += n;
+
+        // If we've emptied this chunk, move on to the next one
+        if (m_offset == chunk.length)
+        {
+            m_offset = 0;
+            ++tail;
+        }
+    }
+
+    // Give the emptied chunks back to the reader thread
+    m_tail.store(tail, memory_order_release);
+
+    // Tell the caller how many bytes we fetched
+    return count;
+}
+//============================================================================
+
+
+//============================================================================
+// get_char() - Fetches a single character from the ring
+//
+// Returns: The character, or -1 if none arrived within the timeout
+//============================================================================
+int CSerialReader::get_char(int timeout_ms, uint64_t* p_timestamp)
+{
+    uint8_t c;
+    return (read(&c, 1, timeout_ms, p_timestamp) == 1) ? c : -1;
+}
+//============================================================================
@@ -0,0 +1,112 @@
+//============================================================================
+// serial_reader.h - Defines a background thread that drains a serial port
+//                   into a lock-free ring-buffer of timestamped chunks
+//============================================================================
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "cthread.h"
+#include "event.h"
+
+class CSerialCapture;
+
+
+//============================================================================
+// Class CSerialReader - The reader thread is the only producer and the
+//                       thread calling read()/get_char()/get_line() is the
+//                       only consumer.
+//============================================================================
+class CSerialReader : public CThread
+{
+public:
+
+    // The largest number of bytes stored in a single chunk
+    enum {CHUNK_SIZE = 256};
+
+    // Constructor and destructor
+    CSerialReader();
+    ~CSerialReader();
+
+    // Call this to start draining the specified file descriptor.  The
+    // number of chunks in the ring is rounded up to a power of 2
+    bool    start(int fd, int ring_chunks = 1024);
+
+    // Call this to stop the reader thread
+    void    stop();
+
+    // Returns 'true' if data arrives within the timeout.  -1 = wait forever
+    bool    data_is_available(int timeout_ms);
+
+    // Reads up to 'max' bytes and the monotonic time (in nanoseconds) that
+    // the first of them arrived.  Returns the number of bytes read
+    int     read(void* buffer, int max, int timeout_ms, uint64_t* p_timestamp = nullptr);
+
+    // Fetches a single character, or -1 on timeout
+    int     get_char(int timeout_ms, uint64_t* p_timestamp = nullptr);
+
+    // Call this to have everything the reader receives recorded, with its
+    // arrival time.  nullptr turns recording off
+    void    set_capture(CSerialCapture* capture) {m_capture = capture;}
+
+    // Returns the number of chunks dropped because the ring was full
+    uint64_t overruns() {return m_overruns;}
+
+    // Returns 'true' once the port has failed or hung up, and no more data
+    // will arrive.  *p_errno receives the error, or 0 for end-of-file
+    bool    failed(int* p_errno = nullptr);
+
+    // Returns the monotonic clock in nanoseconds
+    static uint64_t now_ns();
+
+protected:
+
+    // The reader thread
+    void    main() override;
+
+    // Records a port failure and wakes the consumer
+    void    fail(int error);
+
+    // A chunk of data as it came off the serial port
+    struct chunk_t
+    {
+        uint64_t timestamp_ns;
+        uint32_t length;
+        uint8_t  data[CHUNK_SIZE];
+    };
+
+    // The ring of chunks, and the mask that turns a position into an index
+    chunk_t* m_ring;
+    uint32_t m_mask;
+
+    // The reader thread fills chunks at 'head', the consumer empties them
+    // at 'tail'.  They live on separate cache-lines
+    alignas(64) std::atomic<uint32_t> m_head;
+    alignas(64) std::atomic<uint32_t> m_tail;
+
+    // This is 1 when the consumer is asleep waiting for data
+    alignas(64) std::atomic<uint32_t> m_consumer_sleeping;
+
+    // The number of bytes of the chunk at 'tail' that have been consumed
+    uint32_t m_offset;
+
+    // The number of chunks we had to throw away because the ring was full
+    std::atomic<uint64_t> m_overruns;
+
+    // If this isn't null, received data gets recorded here
+    std::atomic<CSerialCapture*> m_capture;
+
+    // The file descriptor we're draining
+    int     m_fd;
+
+    // True while the reader thread is running
+    bool    m_running;
+
+    // Set by the reader thread when the port fails or hangs up, along with
+    // the errno (0 = end-of-file).  m_errno is written before m_failed
+    std::atomic<bool> m_failed;
+    int     m_errno;
+
+    // Signals the consumer when data arrives
+    CEvent  m_data_event;
+};
+//============================================================================
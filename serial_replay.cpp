@@ -0,0 +1,360 @@
+//============================================================================
+// serial_replay.cpp - Implements a pseudo-terminal that plays back a serial
+//                     capture file
+//============================================================================
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <poll.h>
+#include <vector>
+#include "serial_replay.h"
+#include "serial_capture.h"
+using namespace std;
+
+
+//============================================================================
+// Constructor() - Nothing is open
+//============================================================================
+CSerialReplay::CSerialReplay()
+{
+    m_fp             = nullptr;
+    m_master_fd      = -1;
+    m_slave_fd       = -1;
+    m_speed          = 1.0;
+    m_loop           = false;
+    m_running        = false;
+    m_bytes_sent     = 0;
+    m_bytes_received = 0;
+}
+//============================================================================
+
+
+//============================================================================
+// Destructor() - Stops playback and closes everything
+//============================================================================
+CSerialReplay::~CSerialReplay()
+{
+    close();
+}
+//============================================================================
+
+
+//============================================================================
+// open() - Opens the capture file and creates the pseudo-terminal
+//
+// Passed:  capture_file = The name of a file written by CSerialCapture
+//
+// Returns: 'true' on success, 'false' if the capture file is missing or
+//          invalid, or if a pseudo-terminal can't be created
+//============================================================================
+bool CSerialReplay::open(const string& capture_file)
+{
+    termios tio;
+
+    // Make sure nothing is already open
+    close();
+
+    // Open the capture file and make sure it's valid
+    m_fp = fopen(capture_file.c_str(), "rb");
+    if (m_fp == nullptr) return false;
+    if (!CSerialCapture::read_header(m_fp))
+    {
+        close();
+        return false;
+    }
+
+    // Create the master side of the pseudo-terminal
+    m_master_fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (m_master_fd < 0 || grantpt(m_master_fd) < 0 || unlockpt(m_master_fd) < 0)
+    {
+        close();
+        return false;
+    }
+
+    // Find out what the slave side is called
+    m_slave_name = ptsname(m_master_fd);
+
+    // We hold the slave side open ourselves.  That way the data we write
+    // isn't lost if the program under test hasn't opened it yet, and the
+    // master doesn't see a hang-up if the program closes it
+    m_slave_fd = ::open(m_slave_name.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (m_slave_fd < 0)
+    {
+        close();
+        return false;
+    }
+
+    // The slave must behave like a raw serial port: no echo, no line editing
+    tcgetattr(m_slave_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(m_slave_fd, TCSANOW, &tio);
+
+    // Tell the caller that all is well
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// close() - Stops playback and closes everything
+//============================================================================
+void CSerialReplay::close()
+{
+    stop();
+    if (m_fp)             fclose(m_fp);
+    if (m_slave_fd  >= 0) ::close(m_slave_fd);
+    if (m_master_fd >= 0) ::close(m_master_fd);
+    m_fp        = nullptr;
+    m_slave_fd  = -1;
+    m_master_fd = -1;
+    m_slave_name.clear();
+}
+//============================================================================
+
+
+//============================================================================
+// start() - Starts playing the capture file from the beginning
+//
+// Passed:  speed = The playback speed relative to real time.  0 means "as
+//                  fast as possible"
+//          loop  = If true, playback starts over when it reaches the end
+//
+// Returns: 'true' on success, 'false' if nothing is open
+//============================================================================
+bool CSerialReplay::start(double speed, bool loop)
+{
+    // Make sure we're not already playing
+    stop();
+
+    // We can't play anything if we haven't been opened
+    if (m_fp == nullptr) return false;
+
+    // Position the capture file at the first record
+    fseek(m_fp, 0, SEEK_SET);
+    CSerialCapture::read_header(m_fp);
+
+    // Save the playback settings
+    m_speed          = speed;
+    m_loop           = loop;
+    m_bytes_sent     = 0;
+    m_bytes_received = 0;
+
+    // Make sure the done event isn't left over from a previous playback
+    m_done_event.reset();
+
+    // And start the playback thread
+    m_running = true;
+    spawn();
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// stop() - Stops playback.  Safe to call if it isn't running
+//============================================================================
+void CSerialReplay::stop()
+{
+    if (!m_running) return;
+    request_stop();
+    join();
+    m_running = false;
+}
+//============================================================================
+
+
+//============================================================================
+// wait() - Waits for playback to reach the end of the capture file
+//
+// Passed:  timeout_ms = The maximum time to wait.  -1 = wait forever
+//
+// Returns: 'true' if playback finished, 'false' on timeout
+//============================================================================
+bool CSerialReplay::wait(int timeout_ms)
+{
+    if (!m_running) return true;
+    if (m_done_event.is_triggered()) return true;
+
+    // CEvent::wait() takes 0 to mean "forever"
+    if (timeout_ms < 0) timeout_ms = 0;
+    else if (timeout_ms == 0) return false;
+
+    // Wait for the playback thread to signal that it's done, and leave the
+    // event set so that later calls to wait() return immediately
+    if (m_done_event.wait(timeout_ms) == 0) return false;
+    m_done_event.set();
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// drain_master() - Reads and counts whatever the program under test has
+//                  written to its end of the pseudo-terminal
+//============================================================================
+void CSerialReplay::drain_master()
+{
+    uint8_t buffer[4096];
+    ssize_t count;
+
+    while ((count = ::read(m_master_fd, buffer, sizeof buffer)) > 0)
+    {
+        m_bytes_received += count;
+        if (count < (ssize_t)sizeof buffer) break;
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// sleep_until() - Waits until the specified time, meanwhile draining any
+//                 data that the program under test writes
+//
+// Returns: 'true' when the time arrives, 'false' if we've been told to stop
+//============================================================================
+bool CSerialReplay::sleep_until(uint64_t when_ns)
+{
+    pollfd fds[2];
+
+    fds[0].fd     = stop_fd();
+    fds[0].events = POLLIN;
+    fds[1].fd     = m_master_fd;
+    fds[1].events = POLLIN;
+
+    while (true)
+    {
+        uint64_t now = CSerialCapture::now_ns();
+
+        // Round up, so we never wake up early and spin
+        int timeout_ms = (when_ns > now) ? (int)((when_ns - now + 999999) / 1000000) : 0;
+
+        // Wait for the time to arrive, for data, or for a stop request
+        int count = poll(fds, 2, timeout_ms);
+        if (count < 0 && errno == EINTR) continue;
+
+        // If we've been told to stop, do so
+        if (count > 0 && (fds[0].revents & POLLIN)) return false;
+
+        // If the program wrote something, throw it away
+        if (count > 0 && (fds[1].revents & POLLIN)) drain_master();
+
+        // If we've reached the time, we're done
+        if (CSerialCapture::now_ns() >= when_ns) return true;
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// write_all() - Writes a buffer to the master side of the pseudo-terminal,
+//               waiting for room as needed
+//
+// Returns: 'true' on success, 'false' if we've been told to stop or the
+//          pseudo-terminal has gone away
+//============================================================================
+bool CSerialReplay::write_all(const uint8_t* data, size_t length)
+{
+    pollfd fds[2];
+
+    fds[0].fd     = stop_fd();
+    fds[0].events = POLLIN;
+    fds[1].fd     = m_master_fd;
+    fds[1].events = POLLIN | POLLOUT;
+
+    while (length)
+    {
+        // Wait for room in the pseudo-terminal, or for a stop request
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        // If we've been told to stop, do so
+        if (fds[0].revents & POLLIN) return false;
+
+        // The program may be writing while we are.  Don't let it stall us
+        if (fds[1].revents & POLLIN) drain_master();
+
+        // If there's no room yet, go back to waiting
+        if (!(fds[1].revents & POLLOUT)) continue;
+
+        // Write as much as the pseudo-terminal will take
+        ssize_t written = ::write(m_master_fd, data, length);
+        if (written < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (written <= 0) return false;
+        data   += written;
+        length -= written;
+        m_bytes_sent += written;
+    }
+
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// main() - The playback thread.  Plays each RX record at the right moment
+//============================================================================
+void CSerialReplay::main()
+{
+    CSerialCapture::record_t rec;
+    vector<uint8_t>          data;
+
+    // The master is non-blocking so that drain_master() never stalls us
+    fcntl(m_master_fd, F_SETFL, fcntl(m_master_fd, F_GETFL) | O_NONBLOCK);
+
+    while (true)
+    {
+        // The capture time of the first record, and when we started playing
+        uint64_t first_ns = 0, start_ns = CSerialCapture::now_ns();
+        bool     first    = true;
+        bool     played   = false;
+
+        // Play each record in the file
+        while (CSerialCapture::read_record(m_fp, &rec, &data))
+        {
+            // All times are relative to the first record
+            if (first)
+            {
+                first_ns = rec.timestamp_ns;
+                first    = false;
+            }
+
+            // Data the host transmitted is what the program under test
+            // will be sending, so we don't play it
+            if (rec.direction != CSerialCapture::RX) continue;
+
+            // Wait for the moment this data arrived, scaled by the speed
+            if (m_speed > 0)
+            {
+                // A record that's older than the first one (the reader and
+                // writer threads stamp their own data) is played right away
+                int64_t elapsed = (int64_t)(rec.timestamp_ns - first_ns);
+                double  offset  = elapsed > 0 ? elapsed / m_speed : 0;
+                if (!sleep_until(start_ns + (uint64_t)offset)) return;
+            }
+
+            // And send it to the program under test
+            if (!write_all(data.data(), data.size())) return;
+            played = true;
+        }
+
+        // If we're not looping, we're done.  A file with nothing in it to
+        // play would just spin, so that ends playback too
+        if (!m_loop || !played) break;
+
+        // If we've been told to stop, do so
+        if (stop_requested()) return;
+
+        // Otherwise, start again from the top
+        fseek(m_fp, 0, SEEK_SET);
+        CSerialCapture::read_header(m_fp);
+    }
+
+    // Tell anyone waiting that playback is finished
+    m_done_event.set();
+}
+//============================================================================
@@ -0,0 +1,94 @@
+//============================================================================
+// serial_replay.h - Defines a simulated serial device that plays back a
+//                   capture file through a pseudo-terminal
+//============================================================================
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <atomic>
+#include "cthread.h"
+#include "event.h"
+
+
+//============================================================================
+// Class CSerialReplay - Plays the RX records from a CSerialCapture file out
+//                       of the master side of a pseudo-terminal, so that a
+//                       program that opens slave_name() with CSerialPort
+//                       sees the same data, with the same timing, that the
+//                       real device sent.  Anything the program writes to
+//                       the port is read and counted, but otherwise ignored
+//============================================================================
+class CSerialReplay : public CThread
+{
+public:
+
+    // Constructor and destructor
+    CSerialReplay();
+    ~CSerialReplay();
+
+    // Opens the capture file and creates the pseudo-terminal.  Returns
+    // 'false' if either of those fails
+    bool    open(const std::string& capture_file);
+
+    // Stops any replay and closes everything
+    void    close();
+
+    // Returns the name of the device that the program under test should open
+    std::string slave_name() {return m_slave_name;}
+
+    // Starts playing the capture.  'speed' of 1.0 is real time, 2.0 is twice
+    // as fast, and 0 is as fast as the pseudo-terminal will take it.  If
+    // 'loop' is true, playback starts over when it reaches the end
+    bool    start(double speed = 1.0, bool loop = false);
+
+    // Stops playback
+    void    stop();
+
+    // Waits for playback to finish.  Returns 'false' on timeout.  -1 means
+    // wait forever
+    bool    wait(int timeout_ms = -1);
+
+    // The number of bytes played to the program, and received from it
+    uint64_t bytes_sent()     {return m_bytes_sent;}
+    uint64_t bytes_received() {return m_bytes_received;}
+
+protected:
+
+    // The playback thread
+    void    main() override;
+
+    // Waits until the specified monotonic time, draining whatever the
+    // program writes in the meantime.  Returns 'false' if told to stop
+    bool    sleep_until(uint64_t when_ns);
+
+    // Writes a buffer to the pseudo-terminal.  Returns 'false' if told
+    // to stop
+    bool    write_all(const uint8_t* data, size_t length);
+
+    // Reads and throws away whatever the program has written to the port
+    void    drain_master();
+
+    // The capture file
+    FILE*   m_fp;
+
+    // The two sides of the pseudo-terminal
+    int     m_master_fd, m_slave_fd;
+
+    // The name of the slave side of the pseudo-terminal
+    std::string m_slave_name;
+
+    // Playback speed, and whether to start over at the end
+    double  m_speed;
+    bool    m_loop;
+
+    // True while the playback thread is running
+    bool    m_running;
+
+    // Statistics
+    std::atomic<uint64_t> m_bytes_sent, m_bytes_received;
+
+    // Signals the caller that playback is done
+    CEvent  m_done_event;
+};
+//============================================================================
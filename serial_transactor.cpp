@@ -0,0 +1,540 @@
+//============================================================================
+// serial_transactor.cpp - Implements a pipelined command/response
+//                         transaction manager for CSerialPort
+//============================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/select.h>
+#include <vector>
+#include "serial_transactor.h"
+#include "serial_port.h"
+using namespace std;
+
+
+//============================================================================
+// Constructor() - The transactor starts out stopped
+//============================================================================
+CSerialTransactor::CSerialTransactor()
+{
+    m_port          = nullptr;
+    m_mode          = MATCH_ORDER;
+    m_max_in_flight = 1;
+    m_late_grace_ms = 1000;
+    m_max_line      = 4096;
+    m_next_tag      = 1;
+    m_running       = false;
+}
+//============================================================================
+
+
+//============================================================================
+// Destructor() - Stops the reader thread and cancels anything outstanding
+//============================================================================
+CSerialTransactor::~CSerialTransactor()
+{
+    stop();
+}
+//============================================================================
+
+
+//============================================================================
+// now_ms() - Returns the monotonic clock in milliseconds
+//============================================================================
+uint64_t CSerialTransactor::now_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+//============================================================================
+
+
+//============================================================================
+// start() - Starts the reader thread
+//
+// Passed:  port          = An open serial port
+//          max_in_flight = The most commands that may await a response
+//          mode          = MATCH_ORDER or MATCH_TAG
+//
+// Returns: 'true' on success, 'false' if the port isn't open
+//============================================================================
+bool CSerialTransactor::start(CSerialPort* port, int max_in_flight, match_t mode)
+{
+    // Make sure we're not already running
+    stop();
+
+    // We can't talk to a port that isn't open
+    if (port->get_fd() < 0) return false;
+
+    // Save the settings
+    m_port          = port;
+    m_mode          = mode;
+    m_max_in_flight = (max_in_flight < 1) ? 1 : max_in_flight;
+    m_line.clear();
+
+    // Make sure the wake event isn't left over from a previous run
+    m_wake_event.reset();
+
+    // Spin up the reader thread
+    m_running = true;
+    spawn();
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// stop() - Stops the reader thread and cancels every outstanding transaction
+//============================================================================
+void CSerialTransactor::stop()
+{
+    // Stop the reader thread.  If the port hung up, the thread has already
+    // stopped on its own, but it still needs to be joined
+    m_mutex.lock();
+    m_running = false;
+    m_mutex.unlock();
+    request_stop();
+    join();
+
+    // And cancel everything that's still outstanding
+    cancel_all();
+}
+//============================================================================
+
+
+//============================================================================
+// cancel_all() - Cancels every transaction that's in flight or queued
+//============================================================================
+void CSerialTransactor::cancel_all()
+{
+    deque<txn_ptr> cancelled;
+
+    // Collect everything that's still outstanding
+    m_mutex.lock();
+    for (auto& txn : m_in_flight) if (!txn->expired) cancelled.push_back(txn);
+    for (auto& txn : m_queued) cancelled.push_back(txn);
+    m_in_flight.clear();
+    m_queued.clear();
+    m_mutex.unlock();
+
+    // And tell whoever is waiting on them
+    for (auto& txn : cancelled) complete(txn, CANCELLED, "");
+}
+//============================================================================
+
+
+//============================================================================
+// set_unsolicited_callback() - Sets the function to call with lines that
+//                              don't belong to any command
+//============================================================================
+void CSerialTransactor::set_unsolicited_callback(unsolicited_cb_t callback)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_unsolicited_cb = callback;
+}
+//============================================================================
+
+
+//============================================================================
+// set_late_grace() - Sets how long (in MATCH_ORDER mode) a command that has
+//                    timed out keeps its place in line for a late response
+//============================================================================
+void CSerialTransactor::set_late_grace(int ms)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_late_grace_ms = (ms < 0) ? 0 : ms;
+}
+//============================================================================
+
+
+//============================================================================
+// set_max_line() - Sets the longest response line we'll assemble
+//============================================================================
+void CSerialTransactor::set_max_line(size_t max_len)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_max_line = max_len;
+}
+//============================================================================
+
+
+//============================================================================
+// in_flight() - Returns the number of commands awaiting a response
+//============================================================================
+int CSerialTransactor::in_flight()
+{
+    lock_guard<mutex> lock(m_mutex);
+    return live_in_flight();
+}
+//============================================================================
+
+
+//============================================================================
+// queued() - Returns the number of commands waiting for a free slot
+//============================================================================
+int CSerialTransactor::queued()
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_queued.size();
+}
+//============================================================================
+
+
+//============================================================================
+// live_in_flight() - Returns the number of in-flight transactions that
+//                    haven't timed out.  Call with m_mutex held
+//============================================================================
+int CSerialTransactor::live_in_flight()
+{
+    int count = 0;
+    for (auto& txn : m_in_flight) if (!txn->expired) ++count;
+    return count;
+}
+//============================================================================
+
+
+//============================================================================
+// complete() - Hands a transaction's result to its callback
+//============================================================================
+void CSerialTransactor::complete(txn_ptr txn, status_t status, const string& response)
+{
+    result_t result;
+    result.status   = status;
+    result.response = response;
+    if (txn->callback) txn->callback(result);
+}
+//============================================================================
+
+
+//============================================================================
+// submit() - Submits a command, and returns a future for the result
+//============================================================================
+future<CSerialTransactor::result_t> CSerialTransactor::submit(const string& command, int timeout_ms)
+{
+    // std::function must be copyable, so the promise is shared
+    auto p_promise = make_shared<promise<result_t>>();
+    future<result_t> result = p_promise->get_future();
+
+    // The callback fulfils the promise
+    submit(command, [p_promise](const result_t& r) {p_promise->set_value(r);}, timeout_ms);
+
+    return result;
+}
+//============================================================================
+
+
+//============================================================================
+// submit() - Submits a command whose result gets handed to a callback
+//============================================================================
+void CSerialTransactor::submit(const string& command, callback_t callback, int timeout_ms)
+{
+    auto txn = make_shared<txn_t>();
+    txn->command     = command;
+    txn->callback    = callback;
+    txn->deadline_ms = now_ms() + timeout_ms;
+    txn->expired     = false;
+    submit(txn);
+}
+//============================================================================
+
+
+//============================================================================
+// transact() - Submits a command and waits for the result
+//============================================================================
+CSerialTransactor::result_t CSerialTransactor::transact(const string& command, int timeout_ms)
+{
+    return submit(command, timeout_ms).get();
+}
+//============================================================================
+
+
+//============================================================================
+// submit() - Queues a transaction and sends it if there's a free slot
+//============================================================================
+void CSerialTransactor::submit(txn_ptr txn)
+{
+    m_mutex.lock();
+
+    // If we're not running, nobody will ever answer
+    if (!m_running)
+    {
+        m_mutex.unlock();
+        complete(txn, CANCELLED, "");
+        return;
+    }
+
+    // Hand out a tag, and queue the transaction
+    txn->tag = m_next_tag++;
+    m_queued.push_back(txn);
+    m_mutex.unlock();
+
+    // Send it if there's room, and let the reader thread know that there's
+    // a new deadline to watch
+    send_queued();
+    m_wake_event.set();
+}
+//============================================================================
+
+
+//============================================================================
+// send_queued() - Sends queued commands for as long as there are free slots
+//============================================================================
+void CSerialTransactor::send_queued()
+{
+    char   prefix[16];
+    string message;
+
+    // Commands have to go out in the same order they go into m_in_flight
+    lock_guard<mutex> write_lock(m_write_mutex);
+
+    while (true)
+    {
+        // Move the next command from the queue to the in-flight list
+        m_mutex.lock();
+        if (m_queued.empty() || live_in_flight() >= m_max_in_flight)
+        {
+            m_mutex.unlock();
+            return;
+        }
+        txn_ptr txn = m_queued.front();
+        m_queued.pop_front();
+        m_in_flight.push_back(txn);
+        m_mutex.unlock();
+
+        // In tag mode, the command goes out with its tag in front
+        message.clear();
+        if (m_mode == MATCH_TAG)
+        {
+            int length = snprintf(prefix, sizeof prefix, "#%u ", txn->tag);
+            message.append(prefix, length);
+        }
+
+        // Send the command and its line-feed in a single write
+        message += txn->command;
+        message += '\n';
+        m_port->write(message.data(), message.size());
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// on_line() - Matches a line of text from the device to a transaction
+//============================================================================
+void CSerialTransactor::on_line(const string& line)
+{
+    txn_ptr txn;
+    string  response = line;
+
+    m_mutex.lock();
+
+    // In tag mode, find the command whose tag is at the start of the line
+    if (m_mode == MATCH_TAG && line.size() > 1 && line[0] == '#')
+    {
+        char* end;
+        uint32_t tag = strtoul(line.c_str() + 1, &end, 10);
+
+        // Strip the tag (and the space after it) off the response
+        response = end;
+        if (!response.empty() && response[0] == ' ') response.erase(0, 1);
+
+        // Find the transaction it belongs to
+        for (auto it = m_in_flight.begin(); it != m_in_flight.end(); ++it)
+        {
+            if ((*it)->tag != tag) continue;
+            txn = *it;
+            m_in_flight.erase(it);
+            break;
+        }
+    }
+
+    // In order mode, the line belongs to the oldest command in flight
+    else if (m_mode == MATCH_ORDER && !m_in_flight.empty())
+    {
+        txn = m_in_flight.front();
+        m_in_flight.pop_front();
+    }
+
+    // If the line doesn't belong to a command, it's unsolicited
+    unsolicited_cb_t unsolicited = txn ? nullptr : m_unsolicited_cb;
+
+    m_mutex.unlock();
+
+    // Hand the response to whoever is waiting for it.  A response to a
+    // command that already timed out just gets thrown away
+    if (txn && !txn->expired) complete(txn, OK, response);
+    if (unsolicited) unsolicited(line);
+}
+//============================================================================
+
+
+//============================================================================
+// check_deadlines() - Times out every transaction whose deadline has passed
+//
+// Returns: The number of milliseconds until the next deadline, or -1 if
+//          nothing is outstanding
+//============================================================================
+int CSerialTransactor::check_deadlines()
+{
+    vector<txn_ptr> timed_out;
+    uint64_t now  = now_ms();
+    int64_t  wait = -1;
+
+    m_mutex.lock();
+
+    // Commands still waiting for a slot just get thrown away
+    for (auto it = m_queued.begin(); it != m_queued.end();)
+    {
+        if ((*it)->deadline_ms > now) {++it; continue;}
+        timed_out.push_back(*it);
+        it = m_queued.erase(it);
+    }
+
+    // Commands in flight expire.  In order mode they stay in the list to
+    // soak up their late response, but they no longer occupy a slot
+    int expired_count = 0;
+    for (auto it = m_in_flight.begin(); it != m_in_flight.end();)
+    {
+        txn_ptr txn = *it;
+
+        // An expired command whose response still hasn't come after the
+        // grace period was never answered.  Drop it, or every response
+        // after it would be handed to the wrong command
+        if (txn->expired && txn->deadline_ms + m_late_grace_ms <= now)
+        {
+            it = m_in_flight.erase(it);
+            continue;
+        }
+
+        // If this command is still waiting for its late response, count it
+        if (txn->expired)
+        {
+            ++expired_count;
+            ++it;
+            continue;
+        }
+
+        // If this command hasn't timed out, leave it alone
+        if (txn->deadline_ms > now) {++it; continue;}
+
+        txn->expired = true;
+        timed_out.push_back(txn);
+        if (m_mode == MATCH_TAG) {it = m_in_flight.erase(it); continue;}
+        ++expired_count;
+        ++it;
+    }
+
+    // Never keep more expired commands than there are slots.  The oldest
+    // ones are the least likely to still be answered
+    for (auto it = m_in_flight.begin(); expired_count > m_max_in_flight && it != m_in_flight.end();)
+    {
+        if (!(*it)->expired) {++it; continue;}
+        it = m_in_flight.erase(it);
+        --expired_count;
+    }
+
+    // Find the next deadline
+    for (auto& txn : m_queued)
+    {
+        int64_t ms = txn->deadline_ms - now;
+        if (wait < 0 || ms < wait) wait = ms;
+    }
+    for (auto& txn : m_in_flight)
+    {
+        int64_t ms = txn->deadline_ms - now;
+        if (txn->expired) ms += m_late_grace_ms;
+        if (wait < 0 || ms < wait) wait = ms;
+    }
+
+    m_mutex.unlock();
+
+    // Tell everyone whose transaction timed out
+    for (auto& txn : timed_out) complete(txn, TIMEOUT, "");
+
+    return (int)wait;
+}
+//============================================================================
+
+
+//============================================================================
+// main() - The reader thread.  Assembles lines, matches them to commands,
+//          enforces deadlines, and keeps the pipeline full
+//============================================================================
+void CSerialTransactor::main()
+{
+    fd_set  rfds;
+    timeval timeout;
+    char    buffer[1024];
+
+    // We wait on the serial port, the wake event, and the stop event
+    int port_fd = m_port->get_fd();
+    int wake_fd = m_wake_event.fd();
+    int stop_fd = CThread::stop_fd();
+    int max_fd  = port_fd;
+    if (wake_fd > max_fd) max_fd = wake_fd;
+    if (stop_fd > max_fd) max_fd = stop_fd;
+
+    while (true)
+    {
+        // Time out anything that's overdue, and fill any slots that frees up
+        int wait_ms = check_deadlines();
+        send_queued();
+
+        // Wait for data, a new deadline, a stop request, or the next deadline
+        FD_ZERO(&rfds);
+        FD_SET(port_fd, &rfds);
+        FD_SET(wake_fd, &rfds);
+        FD_SET(stop_fd, &rfds);
+        timeout.tv_sec  = wait_ms / 1000;
+        timeout.tv_usec = (wait_ms % 1000) * 1000;
+        if (select(max_fd+1, &rfds, NULL, NULL, (wait_ms < 0) ? NULL : &timeout) < 0) continue;
+
+        // If we've been told to stop, we're done
+        if (FD_ISSET(stop_fd, &rfds)) break;
+
+        // If there's a new deadline, we'll pick it up at the top of the loop
+        if (FD_ISSET(wake_fd, &rfds)) m_wake_event.reset();
+
+        // If there's no data, go back to waiting
+        if (!FD_ISSET(port_fd, &rfds)) continue;
+
+        // Fetch whatever data is waiting
+        errno = 0;
+        int count = m_port->read_chunk(buffer, sizeof buffer, nullptr, 0);
+
+        // If the port is readable but there's nothing to read, it has hung
+        // up (a USB adapter was unplugged, or the other end of a pty
+        // closed).  Nothing we're waiting for is ever going to arrive
+        if (count == 0 && errno != EINTR && errno != EAGAIN)
+        {
+            m_mutex.lock();
+            m_running = false;
+            m_mutex.unlock();
+            cancel_all();
+            break;
+        }
+
+        // Find out how long a line may get
+        m_mutex.lock();
+        size_t max_line = m_max_line;
+        m_mutex.unlock();
+
+        // Assemble it into lines, the same way CSerialPort::get_line() does.
+        // Characters that don't fit are thrown away
+        for (int i = 0; i < count; ++i)
+        {
+            char c = buffer[i];
+            if (c == '\r') continue;
+            if (c != '\n')
+            {
+                if (m_line.size() < max_line) m_line += c;
+                continue;
+            }
+            on_line(m_line);
+            m_line.clear();
+        }
+    }
+}
+//============================================================================
@@ -0,0 +1,180 @@
+//============================================================================
+// serial_transactor.h - Defines a command/response transaction manager that
+//                       keeps several commands in flight on a CSerialPort
+//============================================================================
+#pragma once
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+#include "cthread.h"
+#include "event.h"
+
+class CSerialPort;
+
+
+//============================================================================
+// Class CSerialTransactor - Commands and responses are lines of text.  Up
+//                           to 'max_in_flight' commands are sent before the
+//                           first response comes back, and the rest wait
+//                           their turn.  Responses are matched to commands
+//                           either:
+//
+//   MATCH_ORDER - The device answers commands in the order they were sent.
+//                 A command that times out still "owns" the next response,
+//                 so that a late response doesn't get handed to the wrong
+//                 command.  If no response arrives within a grace period
+//                 (see set_late_grace()), the response is assumed to have
+//                 been dropped and the command gives up its place in line.
+//                 If the device often drops responses, use tags.
+//
+//   MATCH_TAG   - Each command is sent as "#<tag> <command>" and the device
+//                 echoes "#<tag> " at the start of its response.  The tag is
+//                 stripped off before the response is handed back.
+//
+// Lines that don't belong to any command go to the unsolicited callback.
+// The transactor does all reading from the port while it's running, so the
+// port's async reader must not be enabled
+//============================================================================
+class CSerialTransactor : public CThread
+{
+public:
+
+    // How responses are matched to commands
+    enum match_t {MATCH_ORDER, MATCH_TAG};
+
+    // What happened to a transaction
+    enum status_t {OK, TIMEOUT, CANCELLED};
+
+    // The outcome of a transaction
+    struct result_t
+    {
+        status_t    status;
+        std::string response;
+    };
+
+    // Called when a transaction completes, times out, or is cancelled
+    typedef std::function<void(const result_t&)> callback_t;
+
+    // Called with lines that don't belong to any command
+    typedef std::function<void(const std::string&)> unsolicited_cb_t;
+
+    // Constructor and destructor
+    CSerialTransactor();
+    ~CSerialTransactor();
+
+    // Starts the reader thread on an open serial port
+    bool    start(CSerialPort* port, int max_in_flight = 8, match_t mode = MATCH_ORDER);
+
+    // Stops the reader thread.  Outstanding transactions are cancelled.  If
+    // the port hangs up, the reader thread cancels them and stops by itself
+    void    stop();
+
+    // Submits a command.  The result arrives via the returned future
+    std::future<result_t> submit(const std::string& command, int timeout_ms = 1000);
+
+    // Submits a command.  The result arrives via the callback, which is
+    // called from the reader thread (or from stop())
+    void    submit(const std::string& command, callback_t callback, int timeout_ms = 1000);
+
+    // Submits a command and waits for the result
+    result_t transact(const std::string& command, int timeout_ms = 1000);
+
+    // Call this to be handed lines that don't belong to any command
+    void    set_unsolicited_callback(unsolicited_cb_t callback);
+
+    // In MATCH_ORDER mode, this is how long after its deadline a command
+    // keeps waiting for a late response before it's dropped from the line
+    void    set_late_grace(int ms);
+
+    // Sets the longest response line that gets assembled.  Characters past
+    // this are thrown away until the line-feed arrives
+    void    set_max_line(size_t max_len);
+
+    // Returns the number of commands that have been sent but not answered
+    int     in_flight();
+
+    // Returns the number of commands waiting for a free slot
+    int     queued();
+
+protected:
+
+    // A single transaction
+    struct txn_t
+    {
+        uint32_t    tag;
+        std::string command;
+        uint64_t    deadline_ms;
+        callback_t  callback;
+        bool        expired;
+    };
+
+    typedef std::shared_ptr<txn_t> txn_ptr;
+
+    // The reader thread
+    void    main() override;
+
+    // Queues a transaction and sends it if there's a free slot
+    void    submit(txn_ptr txn);
+
+    // Sends queued commands while there are free slots
+    void    send_queued();
+
+    // Matches a line of text to a transaction
+    void    on_line(const std::string& line);
+
+    // Fails every transaction whose deadline has passed.  Returns the number
+    // of milliseconds until the next deadline, or -1 if there isn't one
+    int     check_deadlines();
+
+    // Cancels every transaction that's in flight or queued
+    void    cancel_all();
+
+    // Completes a transaction.  Must be called without m_mutex held
+    static void complete(txn_ptr txn, status_t status, const std::string& response);
+
+    // Returns the number of unexpired transactions in m_in_flight
+    int     live_in_flight();
+
+    // Returns the monotonic clock in milliseconds
+    static uint64_t now_ms();
+
+    // The port we're talking to
+    CSerialPort* m_port;
+
+    // How responses are matched, and the most commands we keep in flight
+    match_t m_mode;
+    int     m_max_in_flight;
+
+    // How long an expired command waits for its late response in MATCH_ORDER
+    int     m_late_grace_ms;
+
+    // The longest line we'll assemble
+    size_t  m_max_line;
+
+    // The next tag to hand out
+    uint32_t m_next_tag;
+
+    // Commands that have been sent, and commands waiting to be sent
+    std::deque<txn_ptr> m_in_flight, m_queued;
+
+    // The unsolicited-line callback
+    unsolicited_cb_t m_unsolicited_cb;
+
+    // The partial line we've received so far
+    std::string m_line;
+
+    // True while the reader thread is running
+    bool    m_running;
+
+    // Protects the queues.  m_write_mutex keeps commands going out on the
+    // wire in the same order they go into m_in_flight
+    std::mutex m_mutex, m_write_mutex;
+
+    // Wakes the reader thread when a deadline changes
+    CEvent  m_wake_event;
+};
+//============================================================================
@@ -0,0 +1,297 @@
+//============================================================================
+// serial_writer.cpp - Implements a background thread that drains a queue of
+//                     outgoing serial data
+//============================================================================
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <chrono>
+#include <thread>
+#include "serial_writer.h"
+using namespace std;
+
+
+//============================================================================
+// Constructor() - The writer starts out stopped
+//============================================================================
+CSerialWriter::CSerialWriter()
+{
+    m_fd               = -1;
+    m_fd_flags         = -1;
+    m_running          = false;
+    m_queued           = 0;
+    m_high_water       = 0;
+    m_low_water        = 0;
+    m_above_high_water = false;
+}
+//============================================================================
+
+
+//============================================================================
+// Destructor() - Stops the writer thread
+//============================================================================
+CSerialWriter::~CSerialWriter()
+{
+    stop();
+}
+//============================================================================
+
+
+//============================================================================
+// start() - Spawns the writer thread
+//
+// Passed:  fd         = The file descriptor of an open serial port
+//          high_water = Queue size (bytes) that triggers back-pressure
+//          low_water  = Queue size (bytes) that releases back-pressure
+//============================================================================
+bool CSerialWriter::start(int fd, size_t high_water, size_t low_water)
+{
+    // Make sure we're not already running
+    stop();
+
+    // The queue starts out empty
+    m_pending.clear();
+    m_writing.clear();
+    m_queued           = 0;
+    m_above_high_water = false;
+    m_high_water       = high_water;
+    m_low_water        = low_water;
+
+    // Make sure the work event isn't left over from a previous run
+    m_work_event.reset();
+
+    // Make the port non-blocking, so the writer thread never gets stuck in
+    // write() and always notices when it's told to stop.  stop() puts the
+    // original file status flags back
+    m_fd_flags = fcntl(fd, F_GETFL, 0);
+    if (m_fd_flags >= 0) fcntl(fd, F_SETFL, m_fd_flags | O_NONBLOCK);
+
+    // Spin up the writer thread
+    m_fd      = fd;
+    m_running = true;
+    spawn();
+
+    // Tell the caller that all is well
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// stop() - Stops the writer thread.  Safe to call if it isn't running
+//============================================================================
+void CSerialWriter::stop()
+{
+    if (!m_running) return;
+    request_stop();
+    join();
+    m_running = false;
+
+    // Put the port back into whatever blocking mode it was in
+    if (m_fd_flags >= 0) fcntl(m_fd, F_SETFL, m_fd_flags);
+
+    // Anything left in the queue is thrown away
+    lock_guard<mutex> lock(m_mutex);
+    m_pending.clear();
+    m_queued = 0;
+    m_empty_cv.notify_all();
+}
+//============================================================================
+
+
+//============================================================================
+// set_backpressure_callback() - Sets the function to call when the queue
+//                               crosses the high or low water mark
+//============================================================================
+void CSerialWriter::set_backpressure_callback(backpressure_cb_t callback)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_callback = callback;
+}
+//============================================================================
+
+
+//============================================================================
+// check_water_marks() - Calls the back-pressure callback if the queue has
+//                       crossed one of the marks.  Call with m_mutex held
+//============================================================================
+void CSerialWriter::check_water_marks()
+{
+    // If the queue just rose above the high-water mark, apply back-pressure
+    if (!m_above_high_water && m_high_water && m_queued > m_high_water)
+    {
+        m_above_high_water = true;
+        if (m_callback) m_callback(true);
+    }
+
+    // If the queue just fell below the low-water mark, release it
+    else if (m_above_high_water && m_queued <= m_low_water)
+    {
+        m_above_high_water = false;
+        if (m_callback) m_callback(false);
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// enqueue() - Appends data to the queue of data waiting to be written
+//============================================================================
+void CSerialWriter::enqueue(const void* data, size_t count)
+{
+    const uint8_t* in = (const uint8_t*)data;
+
+    lock_guard<mutex> lock(m_mutex);
+
+    // If the queue was empty, the writer thread needs a nudge
+    bool was_empty = m_pending.empty();
+
+    // Append the data to the queue
+    m_pending.insert(m_pending.end(), in, in + count);
+    m_queued += count;
+
+    // Tell the caller to back off if the queue is getting too large
+    check_water_marks();
+
+    // If the writer thread was out of work, wake it up
+    if (was_empty) m_work_event.set();
+}
+//============================================================================
+
+
+//============================================================================
+// queued() - Returns the number of bytes not yet handed to the kernel
+//============================================================================
+size_t CSerialWriter::queued()
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_queued;
+}
+//============================================================================
+
+
+//============================================================================
+// flush() - Waits for everything in the queue to be transmitted
+//
+// Passed:  timeout_ms = The maximum time to wait.  -1 = wait forever
+//
+// Returns: 'true' if everything was transmitted, 'false' on timeout
+//============================================================================
+bool CSerialWriter::flush(int timeout_ms)
+{
+    // Find out when we give up
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+
+    // Wait for the writer thread to hand the whole queue to the kernel
+    unique_lock<mutex> lock(m_mutex);
+    if (timeout_ms < 0)
+        m_empty_cv.wait(lock, [this]{return m_queued == 0;});
+    else if (!m_empty_cv.wait_until(lock, deadline, [this]{return m_queued == 0;}))
+        return false;
+    lock.unlock();
+
+    // Now wait for the UART to finish shifting out what the kernel has
+    while (true)
+    {
+        int outq = 0;
+        if (ioctl(m_fd, TIOCOUTQ, &outq) < 0 || outq == 0) return true;
+        if (timeout_ms >= 0 && chrono::steady_clock::now() >= deadline) return false;
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// main() - The writer thread.  Writes out whatever is in the queue
+//============================================================================
+void CSerialWriter::main()
+{
+    fd_set rfds, wfds;
+
+    // We wait on both the work event and the stop event
+    int work_fd = m_work_event.fd();
+    int stop_fd = CThread::stop_fd();
+    int max_fd  = (work_fd > stop_fd) ? work_fd : stop_fd;
+
+    while (true)
+    {
+        // Wait for work to do, or for someone to tell us to stop
+        FD_ZERO(&rfds);
+        FD_SET(work_fd, &rfds);
+        FD_SET(stop_fd, &rfds);
+        if (select(max_fd+1, &rfds, NULL, NULL, NULL) < 0) continue;
+
+        // If we've been told to stop, we're done
+        if (FD_ISSET(stop_fd, &rfds)) break;
+
+        // Clear the work event
+        m_work_event.reset();
+
+        // Keep going until the queue is empty
+        while (true)
+        {
+            // If we've been told to stop, we're done, even if other threads
+            // are keeping the queue full
+            if (stop_requested()) return;
+
+            // Grab everything that's been queued up
+            m_mutex.lock();
+            m_writing.clear();
+            m_writing.swap(m_pending);
+            m_mutex.unlock();
+
+            // If there's nothing to write, go back to sleep
+            if (m_writing.empty()) break;
+
+            // Write it all out
+            const uint8_t* ptr = m_writing.data();
+            size_t remaining   = m_writing.size();
+            while (remaining)
+            {
+                ssize_t written = ::write(m_fd, ptr, remaining);
+                if (written < 0 && errno == EINTR) continue;
+
+                // If the UART is full (or flow control has stopped it), wait
+                // for room or for someone to tell us to stop
+                if (written < 0 && errno == EAGAIN)
+                {
+                    FD_ZERO(&rfds);
+                    FD_ZERO(&wfds);
+                    FD_SET(stop_fd, &rfds);
+                    FD_SET(m_fd, &wfds);
+                    int nfds   = (m_fd > stop_fd) ? m_fd : stop_fd;
+                    int status = select(nfds+1, &rfds, &wfds, NULL, NULL);
+                    if (status < 0 && errno != EINTR) break;
+                    if (status > 0 && FD_ISSET(stop_fd, &rfds)) return;
+                    continue;
+                }
+
+                if (written <= 0) break;
+                ptr       += written;
+                remaining -= written;
+
+                // Account for the data we've handed to the kernel
+                lock_guard<mutex> lock(m_mutex);
+                m_queued -= written;
+                check_water_marks();
+            }
+
+            // If the write failed, throw the rest of this batch away
+            if (remaining)
+            {
+                lock_guard<mutex> lock(m_mutex);
+                m_queued -= remaining;
+                check_water_marks();
+            }
+        }
+
+        // The queue is empty.  Let anyone waiting in flush() know
+        lock_guard<mutex> lock(m_mutex);
+        if (m_queued == 0) m_empty_cv.notify_all();
+    }
+}
+//============================================================================
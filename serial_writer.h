@@ -0,0 +1,92 @@
+//============================================================================
+// serial_writer.h - Defines a background thread that drains a queue of
+//                   outgoing serial data, so writers never block on the UART
+//============================================================================
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "cthread.h"
+#include "event.h"
+
+
+//============================================================================
+// Class CSerialWriter - Any number of threads can call enqueue().  Data that
+//                       is queued while the writer thread is busy gets
+//                       coalesced into a single write()
+//============================================================================
+class CSerialWriter : public CThread
+{
+public:
+
+    // Called with 'true' when the queue rises above the high-water mark, and
+    // with 'false' when it falls back below the low-water mark.  This is
+    // called from whichever thread caused the transition, with the queue
+    // locked, so it must not call back into the writer
+    typedef std::function<void(bool above_high_water)> backpressure_cb_t;
+
+    // Constructor and destructor
+    CSerialWriter();
+    ~CSerialWriter();
+
+    // Call this to start draining the queue into the specified file descriptor
+    bool    start(int fd, size_t high_water, size_t low_water);
+
+    // Call this to stop the writer thread.  Data still in the queue is
+    // thrown away, so call flush() first if it matters
+    void    stop();
+
+    // Call this to set the back-pressure callback
+    void    set_backpressure_callback(backpressure_cb_t callback);
+
+    // Appends data to the queue.  Never blocks on the UART
+    void    enqueue(const void* data, size_t count);
+
+    // Returns the number of bytes that haven't been handed to the kernel yet
+    size_t  queued();
+
+    // Waits for the queue to empty and the UART to finish transmitting.
+    // Returns 'false' if that doesn't happen within the timeout
+    bool    flush(int timeout_ms);
+
+protected:
+
+    // The writer thread
+    void    main() override;
+
+    // Calls the back-pressure callback if the queue has crossed a mark
+    void    check_water_marks();
+
+    // The file descriptor we're writing to, and its file status flags
+    // from before we made it non-blocking
+    int     m_fd, m_fd_flags;
+
+    // True while the writer thread is running
+    bool    m_running;
+
+    // Data waiting to be written, and data that's being written right now
+    std::vector<uint8_t> m_pending, m_writing;
+
+    // The total number of bytes in m_pending and m_writing
+    size_t  m_queued;
+
+    // The back-pressure marks, and whether we're currently above the high one
+    size_t  m_high_water, m_low_water;
+    bool    m_above_high_water;
+
+    // The back-pressure callback
+    backpressure_cb_t m_callback;
+
+    // Protects everything above
+    std::mutex m_mutex;
+
+    // Signalled by the writer thread whenever the queue becomes empty
+    std::condition_variable m_empty_cv;
+
+    // Signals the writer thread that there's work to do
+    CEvent  m_work_event;
+};
+//============================================================================
@@ -0,0 +1,693 @@
+//==========================================================================================================
+// shm_channel.cpp - Implements a shared-memory, single-producer/single-consumer byte channel
+//==========================================================================================================
+#include <unistd.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <new>
+#include "shm_channel.h"
+using namespace std;
+
+//==========================================================================================================
+// This is how many times a reader or writer re-checks the ring before going to sleep on an eventfd
+//==========================================================================================================
+static const int SPIN_COUNT = 2000;
+//==========================================================================================================
+
+
+//==========================================================================================================
+// The ring-buffer starts this many bytes into the mapping, leaving room for the header
+//==========================================================================================================
+static const size_t RING_OFFSET = 4096;
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor
+//==========================================================================================================
+CShmChannel::CShmChannel()
+{
+    m_memfd    = -1;
+    m_map_size = 0;
+    m_hdr      = nullptr;
+    m_ring     = nullptr;
+    m_mask     = 0;
+    m_error    = NOT_CREATED;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create() - Creates the shared mapping and initializes the ring
+//
+// Passed:  capacity = The size of the ring in bytes.  This is rounded up to a power of 2
+//          name     = A name for the memfd.  It only shows up in /proc/<pid>/fd
+//
+// Returns: 'true' if the channel was created succesfully, otherwise 'false'
+//==========================================================================================================
+bool CShmChannel::create(size_t capacity, string name)
+{
+    // Make sure any existing channel is closed
+    close();
+
+    // Round the capacity up to a power of 2
+    uint64_t ring_size = 4096;
+    while (ring_size < capacity) ring_size <<= 1;
+
+    // Create the anonymous shared-memory file
+    m_memfd = memfd_create(name.c_str(), 0);
+
+    // If memfd_create() failed, complain
+    if (m_memfd < 0)
+    {
+        m_error_str = "failure on memfd_create()";
+        m_error     = MEMFD_FAILED;
+        return false;
+    }
+
+    // The mapping is the header page followed by the ring
+    m_map_size = RING_OFFSET + ring_size;
+
+    // Size the shared-memory file
+    if (ftruncate(m_memfd, m_map_size) < 0)
+    {
+        m_error_str = "failure on ftruncate()";
+        m_error     = FTRUNCATE_FAILED;
+        close();
+        return false;
+    }
+
+    // Map it into our address space.  MAP_SHARED is what makes it visible after a fork()
+    void* p = mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memfd, 0);
+
+    // If mmap() failed, complain
+    if (p == MAP_FAILED)
+    {
+        m_error_str = "failure on mmap()";
+        m_error     = MMAP_FAILED;
+        close();
+        return false;
+    }
+
+    // Construct the header at the front of the mapping
+    m_hdr  = new (p) header_t;
+    m_ring = (uint8_t*)p + RING_OFFSET;
+    m_mask = ring_size - 1;
+
+    // The ring starts out empty with nobody asleep
+    m_hdr->head            = 0;
+    m_hdr->tail            = 0;
+    m_hdr->reader_sleeping = 0;
+    m_hdr->writer_sleeping = 0;
+    m_hdr->closed          = 0;
+    m_hdr->capacity        = ring_size;
+
+    // Make sure neither event is left over from a previous channel
+    m_data_ready.reset();
+    m_space_ready.reset();
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_to() - Sends the channel to another process over a connected Unix-domain socket
+//
+// Returns: 'true' if the channel was sent, otherwise 'false'
+//==========================================================================================================
+bool CShmChannel::send_to(int socket_fd)
+{
+    // We can't send a channel that doesn't exist
+    if (m_hdr == nullptr) return false;
+
+    // The other side needs the mapping and both eventfds
+    int fds[3] = {m_memfd, m_data_ready.fd(), m_space_ready.fd()};
+    return CEvent::send_fds(socket_fd, fds, 3);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive_from() - Joins a channel that another process sent with send_to()
+//
+// Returns: 'true' if the channel was received and mapped, otherwise 'false'
+//==========================================================================================================
+bool CShmChannel::receive_from(int socket_fd)
+{
+    int fds[3];
+
+    // Make sure any existing channel is closed
+    close();
+
+    // Fetch the memfd and the two eventfds
+    int count = CEvent::receive_fds(socket_fd, fds, 3);
+
+    // If we didn't get all three, complain
+    if (count != 3)
+    {
+        for (int i = 0; i < count; ++i) ::close(fds[i]);
+        m_error_str = "failure receiving channel";
+        m_error     = RECEIVE_FAILED;
+        return false;
+    }
+
+    // From here on, close() will clean up the memfd
+    m_memfd = fds[0];
+
+    // Find out how big the memfd really is.  Touching a mapping past its end would kill us with SIGBUS
+    struct stat st;
+    if (fstat(m_memfd, &st) < 0 || st.st_size < (off_t)RING_OFFSET)
+    {
+        ::close(fds[1]);
+        ::close(fds[2]);
+        m_error_str = "received channel is too small";
+        m_error     = RECEIVE_FAILED;
+        close();
+        return false;
+    }
+
+    // Map just the header page so we can find out how big the ring is
+    void* p = mmap(nullptr, RING_OFFSET, PROT_READ, MAP_SHARED, m_memfd, 0);
+    if (p == MAP_FAILED)
+    {
+        ::close(fds[1]);
+        ::close(fds[2]);
+        m_error_str = "failure on mmap()";
+        m_error     = MMAP_FAILED;
+        close();
+        return false;
+    }
+    uint64_t ring_size = ((header_t*)p)->capacity;
+    munmap(p, RING_OFFSET);
+
+    // The header comes from the other process, so don't trust it.  The capacity has to be a power of 2
+    // (or m_mask is meaningless), and the ring has to fit inside the memfd
+    bool is_pow2 = ring_size != 0 && (ring_size & (ring_size - 1)) == 0;
+    if (!is_pow2 || ring_size > (uint64_t)st.st_size - RING_OFFSET)
+    {
+        ::close(fds[1]);
+        ::close(fds[2]);
+        m_error_str = "received channel has a bad ring capacity";
+        m_error     = RECEIVE_FAILED;
+        close();
+        return false;
+    }
+
+    // Now map the whole thing.  The header was constructed by the creator, so we don't construct it
+    m_map_size = RING_OFFSET + ring_size;
+    p = mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memfd, 0);
+    if (p == MAP_FAILED)
+    {
+        ::close(fds[1]);
+        ::close(fds[2]);
+        m_error_str = "failure on mmap()";
+        m_error     = MMAP_FAILED;
+        close();
+        return false;
+    }
+
+    // Point at the header and the ring
+    m_hdr  = (header_t*)p;
+    m_ring = (uint8_t*)p + RING_OFFSET;
+    m_mask = ring_size - 1;
+
+    // And use the same eventfds as the other side
+    m_data_ready.adopt(fds[1]);
+    m_space_ready.adopt(fds[2]);
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// close() - Hangs up the channel and releases the mapping.  The other side will see end-of-data
+//==========================================================================================================
+void CShmChannel::close()
+{
+    // If we have a mapping, tell the other side we're gone and wake it up
+    if (m_hdr)
+    {
+        m_hdr->closed = 1;
+        m_data_ready.set();
+        m_space_ready.set();
+        munmap(m_hdr, m_map_size);
+    }
+
+    // Close the memfd
+    if (m_memfd >= 0) ::close(m_memfd);
+
+    // The channel no longer exists
+    m_memfd    = -1;
+    m_hdr      = nullptr;
+    m_ring     = nullptr;
+    m_map_size = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wake_reader() - Signals the consumer, but only if it's asleep waiting for data
+//==========================================================================================================
+void CShmChannel::wake_reader()
+{
+    // Make sure our update to "head" is visible before we check whether the reader is asleep
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // If the reader is asleep, we're the one who gets to wake it
+    if (m_hdr->reader_sleeping.load(memory_order_relaxed) && m_hdr->reader_sleeping.exchange(0))
+    {
+        m_data_ready.set();
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wake_writer() - Signals the producer, but only if it's asleep waiting for space
+//==========================================================================================================
+void CShmChannel::wake_writer()
+{
+    // Make sure our update to "tail" is visible before we check whether the writer is asleep
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // If the writer is asleep, we're the one who gets to wake it
+    if (m_hdr->writer_sleeping.load(memory_order_relaxed) && m_hdr->writer_sleeping.exchange(0))
+    {
+        m_space_ready.set();
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// bytes_available() - Returns the number of bytes available for reading
+//==========================================================================================================
+int CShmChannel::bytes_available()
+{
+    if (m_hdr == nullptr) return 0;
+    return (int)(m_hdr->head.load(memory_order_acquire) - m_hdr->tail.load(memory_order_relaxed));
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wait_for_data() - Waits for the specified amount of time for data to be available for reading
+//
+// Passed: timeout_ms = timeout in milliseconds.  -1 = Wait forever
+//
+// Returns: true if data is available for reading, else false
+//==========================================================================================================
+bool CShmChannel::wait_for_data(int timeout_ms)
+{
+    return wait_for_bytes(1, timeout_ms);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wait_for_bytes() - Waits for the specified amount of time for at least 'count' bytes to be in the ring
+//
+// Passed: count      = The number of bytes we need
+//         timeout_ms = timeout in milliseconds.  -1 = Wait forever
+//
+// Returns: true if that many bytes are available for reading, else false
+//==========================================================================================================
+bool CShmChannel::wait_for_bytes(int count, int timeout_ms)
+{
+    // If there's no channel, there's never going to be any data
+    if (m_hdr == nullptr) return false;
+
+    // If the caller doesn't want to wait, just look once
+    if (timeout_ms == 0) return bytes_available() >= count;
+
+    // Spin for a little while before we commit to going to sleep
+    for (int i=0; i<SPIN_COUNT; ++i)
+    {
+        if (bytes_available() >= count) return true;
+        if (m_hdr->closed.load(memory_order_relaxed)) return false;
+    }
+
+    // This is when we give up waiting
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+
+    while (true)
+    {
+        // Tell the producer we're about to go to sleep.  The fence pairs with the one in wake_reader(): either
+        // the producer sees our flag, or we see its data.  Without it, the load of head below could be
+        // satisfied before our store is visible, and both sides would miss each other
+        m_hdr->reader_sleeping.store(1);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        // If data arrived (or the producer hung up) in the meantime, we don't need to sleep
+        if (bytes_available() >= count || m_hdr->closed)
+        {
+            m_hdr->reader_sleeping.store(0);
+            return bytes_available() >= count;
+        }
+
+        // Assume for the moment that we are going to wait forever
+        uint32_t wait_ms = 0;
+
+        // If the caller wants us to wait for a finite amount of time, figure out how much is left
+        if (timeout_ms != -1)
+        {
+            auto remaining = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+            if (remaining.count() <= 0)
+            {
+                m_hdr->reader_sleeping.store(0);
+                return false;
+            }
+            wait_ms = remaining.count();
+        }
+
+        // Sleep until the producer wakes us up or we time out
+        m_data_ready.wait(wait_ms);
+        m_hdr->reader_sleeping.store(0);
+
+        // If the data has arrived, tell the caller
+        if (bytes_available() >= count) return true;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wait_for_space() - Waits forever for free space in the ring
+//
+// Returns: 'true' if there is space, 'false' if the consumer hung up
+//==========================================================================================================
+bool CShmChannel::wait_for_space()
+{
+    auto has_space = [this]()
+    {
+        return m_hdr->head.load(memory_order_relaxed) - m_hdr->tail.load(memory_order_acquire) < m_hdr->capacity;
+    };
+
+    // Spin for a little while before we commit to going to sleep
+    for (int i=0; i<SPIN_COUNT; ++i)
+    {
+        if (m_hdr->closed.load(memory_order_relaxed)) return false;
+        if (has_space()) return true;
+    }
+
+    while (true)
+    {
+        // Tell the consumer we're about to go to sleep.  The fence pairs with the one in wake_writer()
+        m_hdr->writer_sleeping.store(1);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        // If space freed up (or the consumer hung up) in the meantime, we don't need to sleep
+        if (has_space() || m_hdr->closed)
+        {
+            m_hdr->writer_sleeping.store(0);
+            return !m_hdr->closed;
+        }
+
+        // Sleep until the consumer wakes us up
+        m_space_ready.wait();
+        m_hdr->writer_sleeping.store(0);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive() - Receives data from the channel
+//
+// Passed:  buffer = Pointer to the place to store the received data
+//          length = The number of bytes to read in
+//          peek   = If true, the bytes will be returned but not removed from the ring
+//
+// This waits forever for the data to arrive.  To bound the wait, check bytes_available() first
+//
+// Returns: The number of bytes that were read
+//             -- or -- -1 = The channel isn't open
+//             -- or --  0 = The channel was closed by the other side
+//==========================================================================================================
+int CShmChannel::receive(void* buffer, int length, bool peek)
+{
+    // If there's no channel, tell the caller
+    if (m_hdr == nullptr) return -1;
+
+    // Don't attempt to receive zero bytes
+    if (length == 0) return 0;
+
+    // Get a byte-pointer to the caller's buffer
+    unsigned char* ptr = (unsigned char*)buffer;
+
+    // When peeking, we have to wait for all of the data to be in the ring at the same time
+    if (peek)
+    {
+        // If the ring can never hold that much data, don't even try
+        if ((uint64_t)length > m_hdr->capacity) return -1;
+
+        // Wait for it all to arrive.  If the producer hung up, the rest of the data is never coming
+        if (!wait_for_bytes(length, -1)) return 0;
+    }
+
+    // This is where we start reading from
+    uint64_t tail = m_hdr->tail.load(memory_order_relaxed);
+
+    // Keep track of how many bytes we have left to read
+    int bytes_remaining = length;
+
+    // Loop until there are no more bytes to read...
+    while (bytes_remaining)
+    {
+        // How many bytes are sitting in the ring?
+        uint64_t avail = m_hdr->head.load(memory_order_acquire) - tail;
+
+        // If there aren't any, wait for some.  If the producer hung up, tell the caller
+        if (avail == 0)
+        {
+            if (!wait_for_data(-1)) return 0;
+            continue;
+        }
+
+        // Copy out as many as we can, in up to two pieces if the data wraps around the ring
+        uint64_t count = min<uint64_t>(avail, bytes_remaining);
+        uint64_t index = tail & m_mask;
+        uint64_t first = min<uint64_t>(count, m_hdr->capacity - index);
+        memcpy(ptr, m_ring + index, first);
+        memcpy(ptr + first, m_ring, count - first);
+
+        // Adjust our pointer and the number of bytes remaining to be read
+        ptr             += count;
+        bytes_remaining -= count;
+        tail            += count;
+
+        // If we're consuming the data, give the space back to the producer
+        if (!peek)
+        {
+            m_hdr->tail.store(tail, memory_order_release);
+            wake_writer();
+        }
+    }
+
+    // Tell the caller that we received all of the data they wanted
+    return length;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// getline() - Fetches a line of text from the channel
+//
+// The result buffer doesn't include the terminating carriage-return/linefeed
+//==========================================================================================================
+bool CShmChannel::getline(void* buffer, size_t buff_size)
+{
+    char *ptr, *origin;
+
+    // Don't let the caller pass us a buffer size of zero, or a channel that isn't open
+    if (buff_size == 0 || m_hdr == nullptr) return false;
+
+    // Reduce the buffer size by 1 to allow for appending the nul-byte to the end of it
+    --buff_size;
+
+    // Get a byte pointer to the caller's buffer
+    origin = ptr = (char*) buffer;
+
+    // This is where we start reading from
+    uint64_t tail = m_hdr->tail.load(memory_order_relaxed);
+
+    // Loop until either an error or until we see a linefeed
+    while (true)
+    {
+        // How many bytes are sitting in the ring?
+        uint64_t head = m_hdr->head.load(memory_order_acquire);
+
+        // If there aren't any, give back the space we've consumed and wait for more
+        if (head == tail)
+        {
+            m_hdr->tail.store(tail, memory_order_release);
+            wake_writer();
+            if (!wait_for_data(-1)) return false;
+            continue;
+        }
+
+        // Walk through all of the bytes that are available right now
+        bool eol = false;
+        while (tail != head)
+        {
+            char c = m_ring[tail++ & m_mask];
+
+            // If it's a carriage-return, throw it away
+            if (c == '\r') continue;
+
+            // Handle backspace, in case the producer is echoing a human-being typing
+            if (c == 8)
+            {
+                if (ptr > origin) --ptr;
+                continue;
+            }
+
+            // If it's a line-feed, it's the end of the line
+            if (c == '\n')
+            {
+                eol = true;
+                break;
+            }
+
+            // If this character will fit into the caller's buffer, append it there
+            if ((size_t)(ptr - origin) < buff_size) *ptr++ = c;
+        }
+
+        // If we hit the end of the line, we're done
+        if (eol) break;
+    }
+
+    // Give the space we consumed back to the producer
+    m_hdr->tail.store(tail, memory_order_release);
+    wake_writer();
+
+    // We've encountered the end of the line.  Terminate the output string
+    *ptr = 0;
+
+    // And tell the caller that they have a line of data waiting in their buffer
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send() - Sends a string to the consumer
+//
+// Returns either : -1 = The channel isn't open
+//                  Anything else = the number of bytes actually sent.  The entire string will always be
+//                  sent unless the channel was closed by the other side
+//==========================================================================================================
+int CShmChannel::send(string s)
+{
+    return send(s.c_str(), s.size());
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send() - Sends a buffer to the consumer
+//
+// Returns either : -1 = The channel isn't open
+//                  Anything else = the number of bytes actually sent.  The entire buffer will always be
+//                  sent unless the channel was closed by the other side
+//==========================================================================================================
+int CShmChannel::send(const void* buffer, int length)
+{
+    // If there's no channel, tell the caller
+    if (m_hdr == nullptr) return -1;
+
+    // Don't attempt to send zero bytes
+    if (length == 0) return 0;
+
+    // Get a byte pointer to the caller's buffer
+    const unsigned char* ptr = (const unsigned char*)buffer;
+
+    // This is where we start writing
+    uint64_t head = m_hdr->head.load(memory_order_relaxed);
+
+    // Keep track of how many bytes remain to be sent
+    int bytes_remaining = length;
+
+    // Loop until there are no more bytes to send...
+    while (bytes_remaining)
+    {
+        // If the consumer has hung up, we're done
+        if (m_hdr->closed.load(memory_order_relaxed)) break;
+
+        // How much free space is in the ring?
+        uint64_t space = m_hdr->capacity - (head - m_hdr->tail.load(memory_order_acquire));
+
+        // If there isn't any, wait for some
+        if (space == 0)
+        {
+            if (!wait_for_space()) break;
+            continue;
+        }
+
+        // Copy in as many bytes as we can, in up to two pieces if the data wraps around the ring
+        uint64_t count = min<uint64_t>(space, bytes_remaining);
+        uint64_t index = head & m_mask;
+        uint64_t first = min<uint64_t>(count, m_hdr->capacity - index);
+        memcpy(m_ring + index, ptr, first);
+        memcpy(m_ring, ptr + first, count - first);
+
+        // Publish the new data to the consumer
+        head += count;
+        m_hdr->head.store(head, memory_order_release);
+        wake_reader();
+
+        // Adjust the pointer and the count of bytes remaining to be sent
+        ptr             += count;
+        bytes_remaining -= count;
+    }
+
+    // Tell the caller how many bytes we sent
+    return (length - bytes_remaining);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// sendf() - Sends printf-style formatted data to the consumer
+//
+// Returns either : -1 = The channel isn't open
+//                  Anything else = the number of bytes actually sent
+//==========================================================================================================
+int CShmChannel::sendf(const char* fmt, ...)
+{
+    char buffer[1000];
+
+    // This is a pointer to the variable argument list
+    va_list ap;
+
+    // Point to the first argument after the "fmt" parameter
+    va_start(ap, fmt);
+
+    // Perform a printf of our arguments into a buffer area;
+    vsnprintf(buffer, sizeof buffer, fmt, ap);
+
+    // Tell the system that we're done with the "ap"
+    va_end(ap);
+
+    // And send the buffer
+    return send(buffer, strlen(buffer));
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_error() - Returns information about the most recent failure
+//==========================================================================================================
+int CShmChannel::get_error(string* p_str)
+{
+    if (p_str) *p_str = m_error_str;
+    return m_error;
+}
+//==========================================================================================================
@@ -0,0 +1,118 @@
+//==========================================================================================================
+// shm_channel.h - Defines a shared-memory, single-producer/single-consumer byte channel
+//
+// The channel is a ring-buffer in a memfd mapping.  It's created before fork(), the producer process
+// calls send(), the consumer process calls receive()/getline().  The eventfd's behind the two CEvents
+// are only written when the other side has actually gone to sleep waiting on us.
+//
+// A process that isn't a child of the creator can join the channel by receiving it over a Unix-domain
+// socket: the creator calls send_to() and the other process calls receive_from().
+//==========================================================================================================
+#pragma once
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include "event.h"
+
+class CShmChannel
+{
+public:
+
+    // The are the codes that can be returned by get_error()
+    enum
+    {
+        MEMFD_FAILED,
+        FTRUNCATE_FAILED,
+        MMAP_FAILED,
+        NOT_CREATED,
+        RECEIVE_FAILED
+    };
+
+    // Constructor and Destructor
+    CShmChannel();
+    ~CShmChannel() {close();}
+
+    // Call this to create the channel.  Capacity is rounded up to a power of 2
+    bool    create(size_t capacity = 1 << 20, std::string name = "shm_channel");
+
+    // Sends the channel (the memfd and both eventfds) over a connected Unix-domain socket
+    bool    send_to(int socket_fd);
+
+    // Joins a channel that another process sent with send_to()
+    bool    receive_from(int socket_fd);
+
+    // Waits for data to arrive.  Returns 'true' if data became available before the timeout expires
+    bool    wait_for_data(int milliseconds);
+
+    // Returns the number of bytes available for reading
+    int     bytes_available();
+
+    // Call this to receive data from the channel
+    int     receive(void* buffer, int length, bool peek = false);
+
+    // Call this to fetch a line of text from the channel
+    bool    getline(void* buffer, size_t buff_size);
+
+    // Call these to send a string or buffer full of data
+    int     send(std::string s);
+    int     send(const void* buffer, int length);
+
+    // Call this to send data using print-style formatting
+    int     sendf(const char* fmt, ...);
+
+    // Call this to hang up the channel and release the mapping.  Safe to call if the channel isn't open
+    void    close();
+
+    // When create() fails, this will give information about the error
+    int     get_error(std::string* p_str = nullptr);
+
+    // Returns the memfd that backs the ring
+    int     get_memfd() {return m_memfd;}
+
+protected:
+
+    // Channels own a mapping and a pair of eventfds, so they can't be copied
+    CShmChannel(const CShmChannel&) = delete;
+    CShmChannel& operator=(const CShmChannel&) = delete;
+
+    // This lives at the front of the shared mapping.  head and tail are on separate cache lines
+    struct header_t
+    {
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+        alignas(64) std::atomic<uint32_t> reader_sleeping;
+                    std::atomic<uint32_t> writer_sleeping;
+                    std::atomic<uint32_t> closed;
+                    uint64_t              capacity;
+    };
+
+    // Waits for at least 'count' bytes to be in the ring.  Returns 'false' on timeout or if the producer
+    // has hung up before they arrived
+    bool    wait_for_bytes(int count, int timeout_ms);
+
+    // Waits for free space in the ring.  Returns 'false' if the consumer has hung up
+    bool    wait_for_space();
+
+    // Wakes the other side of the channel, but only if it's asleep
+    void    wake_reader();
+    void    wake_writer();
+
+    // Most recent error
+    std::string m_error_str;
+    int     m_error;
+
+    // The memfd that backs the mapping, and the size of the mapping
+    int     m_memfd;
+    size_t  m_map_size;
+
+    // Pointers to the header and to the ring-buffer within the mapping
+    header_t* m_hdr;
+    uint8_t*  m_ring;
+
+    // Ring capacity is a power of 2, so "position & m_mask" is an index into m_ring
+    uint64_t  m_mask;
+
+    // Signalled by the producer when data arrives, and by the consumer when space frees up
+    CEvent    m_data_ready, m_space_ready;
+};
+//==========================================================================================================
@@ -0,0 +1,531 @@
+//============================================================================
+// timer_service.cpp - Implements a timerfd() based timer service built on a
+//                     hierarchical timing wheel
+//============================================================================
+#include "timer_service.h"
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+using namespace std;
+
+
+//============================================================================
+// Constructor - Creates the timerfd and an empty wheel
+//============================================================================
+CTimerService::CTimerService(int tick_us)
+{
+    m_fd        = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    m_tick_ns   = (tick_us > 0 ? tick_us : 1) * (uint64_t)1000;
+    m_origin_ns = now_ns();
+    m_current   = 0;
+    m_armed     = UINT64_MAX;
+    m_free      = -1;
+    m_pending   = 0;
+    m_fired     = 0;
+
+    // Every list starts out empty
+    for (int i = 0; i <= LISTS; ++i) m_head[i] = -1;
+    memset(m_occupied, 0, sizeof m_occupied);
+}
+//============================================================================
+
+
+//============================================================================
+// Destructor - Closes the timerfd
+//============================================================================
+CTimerService::~CTimerService()
+{
+    if (m_fd >= 0) close(m_fd);
+    m_fd = -1;
+}
+//============================================================================
+
+
+//============================================================================
+// now_ns() - Returns CLOCK_MONOTONIC in nanoseconds
+//============================================================================
+uint64_t CTimerService::now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+//============================================================================
+
+
+//============================================================================
+// ns_to_tick() - Converts a CLOCK_MONOTONIC time to the first tick that
+//                isn't earlier than it
+//============================================================================
+uint64_t CTimerService::ns_to_tick(uint64_t ns)
+{
+    if (ns <= m_origin_ns) return 0;
+    return (ns - m_origin_ns + m_tick_ns - 1) / m_tick_ns;
+}
+//============================================================================
+
+
+//============================================================================
+// link() - Adds a node to the front of a list
+//============================================================================
+void CTimerService::link(int index, int list)
+{
+    node_t& node = m_nodes[index];
+
+    node.list = list;
+    node.prev = -1;
+    node.next = m_head[list];
+    if (node.next >= 0) m_nodes[node.next].prev = index;
+    m_head[list] = index;
+
+    // Keep track of which slots have something in them
+    if (list < L0_SLOTS)
+        m_occupied[0][list / 64] |= 1ULL << (list % 64);
+    else if (list < LISTS)
+        m_occupied[1 + (list - L0_SLOTS) / LN_SLOTS][0] |= 1ULL << ((list - L0_SLOTS) % LN_SLOTS);
+}
+//============================================================================
+
+
+//============================================================================
+// unlink() - Removes a node from whatever list it's in
+//============================================================================
+void CTimerService::unlink(int index)
+{
+    node_t& node = m_nodes[index];
+    int     list = node.list;
+
+    if (list == NO_LIST) return;
+
+    // Remove the node from the list
+    if (node.prev >= 0) m_nodes[node.prev].next = node.next;
+    else                m_head[list] = node.next;
+    if (node.next >= 0) m_nodes[node.next].prev = node.prev;
+    node.list = NO_LIST;
+
+    // If that emptied a slot, say so in the bitmap
+    if (m_head[list] >= 0) return;
+    if (list < L0_SLOTS)
+        m_occupied[0][list / 64] &= ~(1ULL << (list % 64));
+    else if (list < LISTS)
+        m_occupied[1 + (list - L0_SLOTS) / LN_SLOTS][0] &= ~(1ULL << ((list - L0_SLOTS) % LN_SLOTS));
+}
+//============================================================================
+
+
+//============================================================================
+// insert() - Files a node in the slot that matches its expiration tick.
+//            Timers due within 256 ticks go in level 0, the rest go in
+//            the level whose slots are just wide enough
+//============================================================================
+void CTimerService::insert(int index)
+{
+    uint64_t expires = m_nodes[index].expires;
+
+    // A timer that's already due fires on the very next tick
+    if (expires < m_current) expires = m_current;
+
+    uint64_t delta = expires - m_current;
+
+    // If it's due soon, it goes into level 0
+    if (delta < L0_SLOTS)
+    {
+        link(index, expires & (L0_SLOTS - 1));
+        return;
+    }
+
+    // If it's further out than the wheel reaches, park it in the last
+    // level.  It gets re-filed every time that slot comes around
+    if (delta >= (1ULL << (L0_BITS + (LEVELS - 1) * LN_BITS)))
+    {
+        expires = m_current + (1ULL << (L0_BITS + (LEVELS - 1) * LN_BITS)) - 1;
+    }
+
+    // Find the level whose slots are wide enough
+    for (int level = 1; level < LEVELS; ++level)
+    {
+        int shift = L0_BITS + (level - 1) * LN_BITS;
+        if (level < LEVELS - 1 && delta >= (1ULL << (shift + LN_BITS))) continue;
+        int slot = (expires >> shift) & (LN_SLOTS - 1);
+        link(index, L0_SLOTS + (level - 1) * LN_SLOTS + slot);
+        return;
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// cascade() - Moves every timer in a slot of a higher level down into the
+//             lower levels
+//============================================================================
+void CTimerService::cascade(int level, int slot)
+{
+    int list  = L0_SLOTS + (level - 1) * LN_SLOTS + slot;
+    int index = m_head[list];
+
+    while (index >= 0)
+    {
+        int next = m_nodes[index].next;
+        unlink(index);
+        insert(index);
+        index = next;
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// next_event() - Returns the first tick at which a timer either fires or
+//                has to be cascaded down a level.  This is O(1): it's just
+//                a handful of bitmap searches
+//============================================================================
+uint64_t CTimerService::next_event()
+{
+    uint64_t result = UINT64_MAX;
+
+    // Look for the first occupied slot in level 0, starting at the current
+    // slot and wrapping around
+    int cur = m_current & (L0_SLOTS - 1);
+    for (int i = 0; i <= L0_SLOTS / 64; ++i)
+    {
+        int      word = ((cur / 64) + i) % (L0_SLOTS / 64);
+        uint64_t bits = m_occupied[0][word];
+
+        // In the first word, ignore the slots before the current one.  If we
+        // wrap all the way around, only look at those
+        if (i == 0)               bits &= ~0ULL << (cur % 64);
+        if (i == L0_SLOTS / 64)   bits &= (cur % 64) ? ~(~0ULL << (cur % 64)) : 0;
+        if (bits == 0) continue;
+
+        int slot = word * 64 + __builtin_ctzll(bits);
+        result = m_current + ((slot - cur) & (L0_SLOTS - 1));
+        break;
+    }
+
+    // For each higher level, find the next time an occupied slot cascades
+    for (int level = 1; level < LEVELS; ++level)
+    {
+        uint64_t bits = m_occupied[level][0];
+        if (bits == 0) continue;
+
+        // Slots cascade on ticks that are a multiple of the slot width
+        int      shift = L0_BITS + (level - 1) * LN_BITS;
+        uint64_t base  = (m_current + (1ULL << shift) - 1) >> shift;
+        int      rot   = base & (LN_SLOTS - 1);
+
+        // Rotate the bitmap so that bit 0 is the next slot to cascade
+        if (rot) bits = (bits >> rot) | (bits << (LN_SLOTS - rot));
+        uint64_t when = (base + __builtin_ctzll(bits)) << shift;
+        if (when < result) result = when;
+    }
+
+    return result;
+}
+//============================================================================
+
+
+//============================================================================
+// rearm() - Points the timerfd at the next tick where something happens
+//============================================================================
+void CTimerService::rearm()
+{
+    itimerspec its = {};
+
+    m_armed = next_event();
+
+    // If there's nothing to wait for, an all-zero itimerspec disarms it
+    if (m_armed != UINT64_MAX)
+    {
+        uint64_t when = m_origin_ns + m_armed * m_tick_ns;
+        its.it_value.tv_sec  = when / 1000000000;
+        its.it_value.tv_nsec = when % 1000000000;
+
+        // An it_value of zero would disarm the timer instead
+        if (when == 0) its.it_value.tv_nsec = 1;
+    }
+
+    timerfd_settime(m_fd, TFD_TIMER_ABSTIME, &its, nullptr);
+}
+//============================================================================
+
+
+//============================================================================
+// add_timer() - Allocates a node from the pool and starts the timer
+//
+// Passed:  expires  = The tick at which the timer first fires
+//          period   = The period in ticks, or 0 for a one-shot timer
+//          callback = The function to call when it fires
+//
+// Returns: The ID of the new timer
+//============================================================================
+CTimerService::timer_id_t CTimerService::add_timer(uint64_t expires, uint64_t period,
+                                                   callback_t& callback)
+{
+    int index;
+
+    lock_guard<mutex> lock(m_mutex);
+
+    // Grab a free node, or grow the pool if there aren't any
+    if (m_free >= 0)
+    {
+        index  = m_free;
+        m_free = m_nodes[index].next;
+    }
+    else
+    {
+        index = m_nodes.size();
+        m_nodes.emplace_back();
+        m_nodes[index].generation = 1;
+    }
+
+    // Fill in the node and put it in the wheel
+    node_t& node  = m_nodes[index];
+    node.expires  = expires;
+    node.period   = period;
+    node.callback = move(callback);
+    insert(index);
+    ++m_pending;
+
+    // If this timer is due before the timerfd goes off, wake up sooner
+    if (next_event() < m_armed) rearm();
+
+    // The ID is the generation and the index, so a stale ID can't cancel a
+    // timer that has re-used the node
+    return ((uint64_t)node.generation << 32) | (uint32_t)(index + 1);
+}
+//============================================================================
+
+
+//============================================================================
+// add_oneshot() - Starts a timer that fires once, 'delay_ms' from now
+//============================================================================
+CTimerService::timer_id_t CTimerService::add_oneshot(uint32_t delay_ms, callback_t callback)
+{
+    uint64_t expires = ns_to_tick(now_ns() + delay_ms * (uint64_t)1000000);
+    return add_timer(expires, 0, callback);
+}
+//============================================================================
+
+
+//============================================================================
+// add_periodic() - Starts a timer that fires every 'period_ms'
+//
+// Passed:  period_ms = The period in milliseconds
+//          callback  = The function to call each time it fires
+//          first_ms  = How long until it fires the first time.  -1 means
+//                      one period
+//============================================================================
+CTimerService::timer_id_t CTimerService::add_periodic(uint32_t period_ms, callback_t callback,
+                                                      int first_ms)
+{
+    // Convert the period to ticks.  It has to be at least one tick long
+    uint64_t period = (period_ms * (uint64_t)1000000 + m_tick_ns - 1) / m_tick_ns;
+    if (period == 0) period = 1;
+
+    // Find out when it fires the first time
+    if (first_ms < 0) first_ms = period_ms;
+    uint64_t expires = ns_to_tick(now_ns() + first_ms * (uint64_t)1000000);
+
+    return add_timer(expires, period, callback);
+}
+//============================================================================
+
+
+//============================================================================
+// add_deadline() - Starts a timer that fires at an absolute time
+//
+// Passed:  deadline_ns = A CLOCK_MONOTONIC time, as returned by now_ns()
+//          callback    = The function to call when it fires
+//============================================================================
+CTimerService::timer_id_t CTimerService::add_deadline(uint64_t deadline_ns, callback_t callback)
+{
+    return add_timer(ns_to_tick(deadline_ns), 0, callback);
+}
+//============================================================================
+
+
+//============================================================================
+// cancel() - Cancels a timer
+//
+// Returns: 'true' if the timer was cancelled, 'false' if it had already
+//          fired, been cancelled, or never existed
+//============================================================================
+bool CTimerService::cancel(timer_id_t id)
+{
+    int      index      = (int)(uint32_t)id - 1;
+    uint32_t generation = id >> 32;
+
+    lock_guard<mutex> lock(m_mutex);
+
+    // Make sure this ID refers to a live timer
+    if (index < 0 || index >= (int)m_nodes.size()) return false;
+    node_t& node = m_nodes[index];
+    if (node.generation != generation || node.list == NO_LIST) return false;
+
+    // Take it out of the wheel and put the node back in the pool.  We don't
+    // bother re-arming the timerfd; a spurious wake-up is harmless
+    unlink(index);
+    node.callback = nullptr;
+    ++node.generation;
+    node.next = m_free;
+    m_free    = index;
+    --m_pending;
+    return true;
+}
+//============================================================================
+
+
+//============================================================================
+// pending() - Returns the number of timers that haven't fired yet
+//============================================================================
+int CTimerService::pending()
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_pending;
+}
+//============================================================================
+
+
+//============================================================================
+// advance() - Processes every tick up to and including 'target', running
+//             the callbacks of the timers that expire.  Ticks on which
+//             nothing happens are skipped entirely.  Call with m_mutex held;
+//             it's released while each callback runs
+//============================================================================
+void CTimerService::advance(uint64_t target)
+{
+    while (true)
+    {
+        // Find the next tick where something happens.  If it's in the
+        // future, we're done
+        uint64_t tick = next_event();
+        if (tick > target)
+        {
+            if (target >= m_current) m_current = target + 1;
+            return;
+        }
+
+        // If we're on a level-0 boundary, cascade the higher levels down.
+        // Each level only cascades when the level below it wraps around
+        if ((tick & (L0_SLOTS - 1)) == 0)
+        {
+            for (int level = 1; level < LEVELS; ++level)
+            {
+                int shift = L0_BITS + (level - 1) * LN_BITS;
+                int slot  = (tick >> shift) & (LN_SLOTS - 1);
+                m_current = tick;
+                cascade(level, slot);
+                if (slot != 0) break;
+            }
+        }
+
+        // Move this tick's timers onto the expired list
+        int list = tick & (L0_SLOTS - 1);
+        while (m_head[list] >= 0)
+        {
+            int index = m_head[list];
+            unlink(index);
+            link(index, EXPIRED);
+        }
+
+        // Timers added from here on are relative to the next tick
+        m_current = tick + 1;
+
+        // Run each expired timer
+        while (m_head[EXPIRED] >= 0)
+        {
+            int     index = m_head[EXPIRED];
+            node_t& node  = m_nodes[index];
+            unlink(index);
+
+            // A timer that was parked beyond the reach of the wheel isn't
+            // really due yet
+            if (node.expires > tick)
+            {
+                insert(index);
+                continue;
+            }
+
+            timer_id_t id = ((uint64_t)node.generation << 32) | (uint32_t)(index + 1);
+            callback_t callback;
+
+            // A periodic timer goes back into the wheel before its callback
+            // runs, so that the callback can cancel it.  If we've fallen
+            // behind, missed periods are skipped rather than run in a burst
+            if (node.period)
+            {
+                do node.expires += node.period; while (node.expires <= tick);
+                insert(index);
+                callback = node.callback;
+            }
+
+            // A one-shot timer's node goes back into the pool
+            else
+            {
+                callback = move(node.callback);
+                node.callback = nullptr;
+                ++node.generation;
+                node.next = m_free;
+                m_free    = index;
+                --m_pending;
+            }
+
+            // Run the callback without the lock, so it can add or cancel
+            // timers.  'node' may move while we're unlocked
+            m_mutex.unlock();
+            if (callback) callback(id);
+            m_mutex.lock();
+
+            ++m_fired;
+        }
+    }
+}
+//============================================================================
+
+
+//============================================================================
+// dispatch() - Runs the callback of every timer that is due
+//
+// Returns: The number of callbacks that were run
+//============================================================================
+int CTimerService::dispatch()
+{
+    uint64_t expirations;
+
+    // Clear the timerfd's readable state
+    read(m_fd, &expirations, sizeof expirations);
+
+    lock_guard<mutex> lock(m_mutex);
+
+    // Process every tick that has gone by
+    m_fired = 0;
+    uint64_t now = now_ns();
+    if (now >= m_origin_ns) advance((now - m_origin_ns) / m_tick_ns);
+
+    // And point the timerfd at whatever is next
+    rearm();
+    return m_fired;
+}
+//============================================================================
+
+
+//============================================================================
+// wait_and_dispatch() - Waits for timers to become due, then dispatches them
+//
+// Passed:  milliseconds = The maximum time to wait.  0 = forever
+//
+// Returns: The number of callbacks that were run
+//============================================================================
+int CTimerService::wait_and_dispatch(uint32_t milliseconds)
+{
+    pollfd pfd = {m_fd, POLLIN, 0};
+
+    // Wait for the timerfd to go off
+    if (poll(&pfd, 1, milliseconds == 0 ? -1 : (int)milliseconds) < 1) return 0;
+
+    // And run whatever is due
+    return dispatch();
+}
+//============================================================================
@@ -0,0 +1,162 @@
+//============================================================================
+// timer_service.h - Defines a timerfd() based timer service that manages
+//                   any number of one-shot and periodic timers
+//============================================================================
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <functional>
+
+
+//============================================================================
+// CTimerService - All of the timers share a single timerfd, which becomes
+//                 readable when at least one timer is due.  Add fd() to your
+//                 select()/poll()/epoll() set just like CEvent::fd(), and
+//                 call dispatch() when it becomes readable.
+//
+// Timers are kept in a hierarchical timing wheel, so adding, cancelling and
+// expiring a timer are all O(1) no matter how many timers there are.  Times
+// are rounded up to the tick size (1 millisecond by default), so a timer
+// never fires early.  Periodic timers are re-armed relative to when they
+// were due, not when they ran, so they don't drift.
+//
+// Timers may be added and cancelled from any thread, including from inside
+// a callback.  Callbacks run in the thread that calls dispatch().
+//============================================================================
+class CTimerService
+{
+public:
+
+    // Identifies a timer.  Never 0
+    typedef uint64_t timer_id_t;
+
+    // Called when a timer expires
+    typedef std::function<void(timer_id_t)> callback_t;
+
+    // Creates the timerfd.  'tick_us' is the timer resolution
+    CTimerService(int tick_us = 1000);
+
+    // Closes the timerfd
+    ~CTimerService();
+
+    // Starts a timer that fires once, 'delay_ms' from now
+    timer_id_t add_oneshot(uint32_t delay_ms, callback_t callback);
+
+    // Starts a timer that fires every 'period_ms'.  The first time it fires
+    // is 'first_ms' from now, or one period from now if first_ms is -1
+    timer_id_t add_periodic(uint32_t period_ms, callback_t callback, int first_ms = -1);
+
+    // Starts a timer that fires once, at an absolute CLOCK_MONOTONIC time
+    timer_id_t add_deadline(uint64_t deadline_ns, callback_t callback);
+
+    // Cancels a timer.  Returns 'false' if it had already fired (or never
+    // existed).  A cancelled timer's callback is guaranteed not to be
+    // called, unless it's already running
+    bool    cancel(timer_id_t id);
+
+    // Returns the number of timers that haven't fired yet
+    int     pending();
+
+    // Call this when fd() becomes readable.  Runs the callback of every
+    // timer that's due, and returns how many there were
+    int     dispatch();
+
+    // Waits up to 'milliseconds' for timers to become due, and dispatches
+    // them.  0 = wait forever.  Returns the number of callbacks run
+    int     wait_and_dispatch(uint32_t milliseconds = 0);
+
+    // Returns the timerfd for use with select(), poll() or epoll()
+    int     fd() {return m_fd;}
+
+    // Returns the CLOCK_MONOTONIC time in nanoseconds
+    static uint64_t now_ns();
+
+protected:
+
+    // The layout of the wheel.  Level 0 has 256 slots of one tick each, and
+    // each level above it has 64 slots, each as wide as the level below.
+    // Together they cover 2^32 ticks
+    enum
+    {
+        L0_BITS   = 8,
+        LN_BITS   = 6,
+        LEVELS    = 5,
+        L0_SLOTS  = 1 << L0_BITS,
+        LN_SLOTS  = 1 << LN_BITS,
+        LISTS     = L0_SLOTS + (LEVELS - 1) * LN_SLOTS,
+        EXPIRED   = LISTS,      // The list of timers being dispatched
+        NO_LIST   = -1
+    };
+
+    // A single timer.  Timers live in m_nodes and are linked into lists by
+    // index, so nothing is allocated once the pool is big enough
+    struct node_t
+    {
+        uint64_t    expires;
+        uint64_t    period;
+        uint32_t    generation;
+        int         list;
+        int         prev, next;
+        callback_t  callback;
+    };
+
+    // Allocates a node and starts the timer
+    timer_id_t add_timer(uint64_t expires, uint64_t period, callback_t& callback);
+
+    // Puts a node into the right list for its expiration tick
+    void    insert(int index);
+
+    // Takes a node out of whatever list it's in
+    void    unlink(int index);
+
+    // Appends a node to a list
+    void    link(int index, int list);
+
+    // Re-files every timer in a slot of a higher level into lower levels
+    void    cascade(int level, int slot);
+
+    // Processes ticks up to and including 'target'
+    void    advance(uint64_t target);
+
+    // Returns the first tick at which something needs doing, or UINT64_MAX
+    uint64_t next_event();
+
+    // Points the timerfd at the next event
+    void    rearm();
+
+    // Converts a CLOCK_MONOTONIC time to a tick, rounding up
+    uint64_t ns_to_tick(uint64_t ns);
+
+    // The timerfd
+    int     m_fd;
+
+    // The length of a tick, and the time of tick 0
+    uint64_t m_tick_ns, m_origin_ns;
+
+    // The next tick that hasn't been processed yet
+    uint64_t m_current;
+
+    // The tick that the timerfd is set to go off at, or UINT64_MAX if none
+    uint64_t m_armed;
+
+    // The timer pool, and the head of its free list
+    std::vector<node_t> m_nodes;
+    int     m_free;
+
+    // The head of each slot's list, plus the list of expired timers
+    int     m_head[LISTS + 1];
+
+    // A bitmap of non-empty slots for each level
+    uint64_t m_occupied[LEVELS][L0_SLOTS / 64];
+
+    // The number of timers that haven't fired
+    int     m_pending;
+
+    // The number of callbacks run by the current dispatch()
+    int     m_fired;
+
+    // Protects everything above
+    std::mutex m_mutex;
+};
+//============================================================================
@@ -0,0 +1,712 @@
+//==========================================================================================================
+// tls_sock.cpp - Implements a TLS-encrypted network socket built on NetSock and OpenSSL
+//==========================================================================================================
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "tls_sock.h"
+using namespace std;
+
+
+//==========================================================================================================
+// ssl_error_string() - Returns the text of the most recent OpenSSL error
+//==========================================================================================================
+static string ssl_error_string(string prefix)
+{
+    char text[256];
+
+    // Fetch the oldest error in the OpenSSL error queue
+    unsigned long code = ERR_get_error();
+
+    // If there isn't one, just hand back the prefix
+    if (code == 0) return prefix;
+
+    // Convert it to human-readable form
+    ERR_error_string_n(code, text, sizeof text);
+
+    // And throw away any other errors that are queued up
+    ERR_clear_error();
+
+    return prefix + ": " + text;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// sigpipe_guard_t - Keeps SIGPIPE from killing the process while the kernel TLS code writes to a socket
+//
+// When kTLS is active, OpenSSL has to write through its own socket BIO (or sendfile()) so the kernel gets
+// the record types it needs, and those use plain write().  Writing to a connection the peer has reset
+// raises SIGPIPE, and NetSock promises to return -1 in that case instead.  So SIGPIPE is blocked in this
+// thread for the duration of the write, and any SIGPIPE the write generated is consumed before the signal
+// mask is restored.
+//==========================================================================================================
+class sigpipe_guard_t
+{
+public:
+
+    sigpipe_guard_t()
+    {
+        sigset_t pending;
+
+        // Find out if there's already a SIGPIPE pending that isn't ours to consume
+        sigemptyset(&m_sigpipe);
+        sigaddset(&m_sigpipe, SIGPIPE);
+        sigpending(&pending);
+        m_was_pending = sigismember(&pending, SIGPIPE);
+
+        // Block SIGPIPE in this thread, remembering whether it was already blocked
+        pthread_sigmask(SIG_BLOCK, &m_sigpipe, &m_old_mask);
+    }
+
+    ~sigpipe_guard_t()
+    {
+        sigset_t pending;
+
+        // If the write raised SIGPIPE, throw it away
+        if (!m_was_pending)
+        {
+            sigpending(&pending);
+            if (sigismember(&pending, SIGPIPE))
+            {
+                const timespec no_wait = {0, 0};
+                int saved_errno = errno;
+                sigtimedwait(&m_sigpipe, nullptr, &no_wait);
+                errno = saved_errno;
+            }
+        }
+
+        // And restore the signal mask
+        pthread_sigmask(SIG_SETMASK, &m_old_mask, nullptr);
+    }
+
+protected:
+
+    sigset_t m_sigpipe, m_old_mask;
+    bool     m_was_pending;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// nosignal_write() - The write method of our socket BIO
+//
+// This is OpenSSL's socket BIO except for the write, which uses send(MSG_NOSIGNAL) so a reset connection
+// returns EPIPE instead of raising SIGPIPE.  Once kTLS is active on the BIO, the write is handed to
+// OpenSSL's own socket write (which knows how to pass record types to the kernel) with SIGPIPE blocked
+//==========================================================================================================
+static int (*s_socket_write)(BIO*, const char*, int);
+static int nosignal_write(BIO* bio, const char* data, int length)
+{
+    // If the kernel is doing the encryption, let OpenSSL's socket write do the work
+    if (BIO_get_ktls_send(bio))
+    {
+        sigpipe_guard_t guard;
+        return s_socket_write(bio, data, length);
+    }
+
+    // Send the data without raising SIGPIPE
+    errno = 0;
+    int status = ::send(BIO_get_fd(bio, nullptr), data, length, MSG_NOSIGNAL);
+
+    // If the socket just isn't ready, tell OpenSSL to try again later
+    BIO_clear_retry_flags(bio);
+    if (status <= 0 && BIO_sock_should_retry(status)) BIO_set_retry_write(bio);
+
+    return status;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// nosignal_socket_method() - Returns the BIO method that new TLS sessions use to talk to their socket
+//==========================================================================================================
+static BIO_METHOD* nosignal_socket_method()
+{
+    static BIO_METHOD* method = []()
+    {
+        const BIO_METHOD* socket = BIO_s_socket();
+        BIO_METHOD*       result = BIO_meth_new(BIO_TYPE_SOCKET, "NetSock socket");
+
+        // Everything but the write comes straight from OpenSSL's socket BIO
+        s_socket_write = BIO_meth_get_write(socket);
+        BIO_meth_set_write  (result, nosignal_write);
+        BIO_meth_set_read   (result, BIO_meth_get_read   (socket));
+        BIO_meth_set_puts   (result, BIO_meth_get_puts   (socket));
+        BIO_meth_set_ctrl   (result, BIO_meth_get_ctrl   (socket));
+        BIO_meth_set_create (result, BIO_meth_get_create (socket));
+        BIO_meth_set_destroy(result, BIO_meth_get_destroy(socket));
+        return result;
+    }();
+
+    return method;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// nonblock_guard_t - Puts a socket into non-blocking mode for the duration of one OpenSSL call
+//
+// OpenSSL reads and writes the socket itself, so it never sees the MSG_DONTWAIT flag that receive_for(),
+// getline_for() and send_for() rely on.  Instead, when the caller asks for MSG_DONTWAIT, the socket is
+// made non-blocking until the call returns.  A socket that's already non-blocking is left alone.
+//==========================================================================================================
+class nonblock_guard_t
+{
+public:
+
+    nonblock_guard_t(int sd, int flags)
+    {
+        m_sd    = sd;
+        m_flags = -1;
+
+        // If the caller didn't ask for a non-blocking call, there's nothing to do
+        if ((flags & MSG_DONTWAIT) == 0) return;
+
+        // If the socket is blocking, make it non-blocking and remember how to put it back
+        int fl = fcntl(sd, F_GETFL, 0);
+        if (fl >= 0 && (fl & O_NONBLOCK) == 0 && fcntl(sd, F_SETFL, fl | O_NONBLOCK) == 0) m_flags = fl;
+    }
+
+    ~nonblock_guard_t()
+    {
+        if (m_flags < 0) return;
+        int saved_errno = errno;
+        fcntl(m_sd, F_SETFL, m_flags);
+        errno = saved_errno;
+    }
+
+protected:
+
+    int m_sd, m_flags;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// TlsContext Constructor
+//==========================================================================================================
+TlsContext::TlsContext()
+{
+    m_ctx = nullptr;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// TlsContext Destructor - Frees the OpenSSL context and any cached sessions
+//==========================================================================================================
+TlsContext::~TlsContext()
+{
+    clear_sessions();
+    if (m_ctx) SSL_CTX_free(m_ctx);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create_server() - Creates a context for server sockets
+//
+// Passed:  cert_file = PEM file containing the server's certificate chain
+//          key_file  = PEM file containing the server's private key
+//
+// Returns: 'true' on success, otherwise 'false'
+//==========================================================================================================
+bool TlsContext::create_server(string cert_file, string key_file)
+{
+    // Throw away any existing context
+    clear_sessions();
+    if (m_ctx) SSL_CTX_free(m_ctx);
+
+    // Create the new context
+    m_ctx = SSL_CTX_new(TLS_server_method());
+    if (m_ctx == nullptr)
+    {
+        m_error_str = ssl_error_string("failure on SSL_CTX_new()");
+        return false;
+    }
+
+    // We don't support anything older than TLS 1.2
+    SSL_CTX_set_min_proto_version(m_ctx, TLS1_2_VERSION);
+
+    // Load the certificate chain
+    if (SSL_CTX_use_certificate_chain_file(m_ctx, cert_file.c_str()) != 1)
+    {
+        m_error_str = ssl_error_string("can't load certificate from "+cert_file);
+        return false;
+    }
+
+    // Load the private key
+    if (SSL_CTX_use_PrivateKey_file(m_ctx, key_file.c_str(), SSL_FILETYPE_PEM) != 1)
+    {
+        m_error_str = ssl_error_string("can't load private key from "+key_file);
+        return false;
+    }
+
+    // The server-side session cache and session tickets need a session-id context
+    const unsigned char sid_ctx[] = "NetSock";
+    SSL_CTX_set_session_id_context(m_ctx, sid_ctx, sizeof sid_ctx - 1);
+    SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_SERVER);
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create_client() - Creates a context for client sockets
+//
+// Passed:  ca_file     = PEM file of trusted certificate authorities.  Empty = use the system defaults
+//          verify_peer = If false, the server's certificate isn't checked.  Only use this for testing!
+//
+// Returns: 'true' on success, otherwise 'false'
+//==========================================================================================================
+bool TlsContext::create_client(string ca_file, bool verify_peer)
+{
+    // Throw away any existing context
+    clear_sessions();
+    if (m_ctx) SSL_CTX_free(m_ctx);
+
+    // Create the new context
+    m_ctx = SSL_CTX_new(TLS_client_method());
+    if (m_ctx == nullptr)
+    {
+        m_error_str = ssl_error_string("failure on SSL_CTX_new()");
+        return false;
+    }
+
+    // We don't support anything older than TLS 1.2
+    SSL_CTX_set_min_proto_version(m_ctx, TLS1_2_VERSION);
+
+    // Load the certificate authorities we trust
+    int status = ca_file.empty() ? SSL_CTX_set_default_verify_paths(m_ctx)
+                                 : SSL_CTX_load_verify_locations(m_ctx, ca_file.c_str(), nullptr);
+    if (status != 1)
+    {
+        m_error_str = ssl_error_string("can't load certificate authorities");
+        return false;
+    }
+
+    // Decide whether we verify the server's certificate
+    SSL_CTX_set_verify(m_ctx, verify_peer ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, nullptr);
+
+    // We keep our own cache of client sessions.  OpenSSL tells us when a new one arrives
+    SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(m_ctx, TlsSock::on_new_session);
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// enable_ktls() - Asks OpenSSL to hand the symmetric encryption off to the kernel when it can
+//
+// kTLS needs the "tls" kernel module and a cipher the kernel supports (AES-GCM or ChaCha20-Poly1305).
+// When it's not available, everything still works, just with user-space encryption.
+//==========================================================================================================
+void TlsContext::enable_ktls(bool flag)
+{
+    if (m_ctx == nullptr) return;
+
+#ifdef SSL_OP_ENABLE_KTLS
+    if (flag)
+        SSL_CTX_set_options(m_ctx, SSL_OP_ENABLE_KTLS);
+    else
+        SSL_CTX_clear_options(m_ctx, SSL_OP_ENABLE_KTLS);
+#else
+    (void)flag;
+#endif
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// save_session() - Saves a client session so the next connection to the same server can resume it
+//==========================================================================================================
+void TlsContext::save_session(const string& key, SSL_SESSION* session)
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    // If we already have a session for this server, throw the old one away
+    auto it = m_sessions.find(key);
+    if (it != m_sessions.end()) SSL_SESSION_free(it->second);
+
+    // And store the new one
+    m_sessions[key] = session;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// load_session() - Fetches the saved session for a server.  Caller must call SSL_SESSION_free() on it
+//==========================================================================================================
+SSL_SESSION* TlsContext::load_session(const string& key)
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    // If we don't have a session for this server, tell the caller
+    auto it = m_sessions.find(key);
+    if (it == m_sessions.end()) return nullptr;
+
+    // If the session is no longer resumable, throw it away
+    if (!SSL_SESSION_is_resumable(it->second))
+    {
+        SSL_SESSION_free(it->second);
+        m_sessions.erase(it);
+        return nullptr;
+    }
+
+    // Hand the caller a reference to the session
+    SSL_SESSION_up_ref(it->second);
+    return it->second;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// clear_sessions() - Throws away every cached client session
+//==========================================================================================================
+void TlsContext::clear_sessions()
+{
+    lock_guard<mutex> lock(m_mutex);
+    for (auto& entry : m_sessions) SSL_SESSION_free(entry.second);
+    m_sessions.clear();
+}
+//==========================================================================================================
+
+
+
+
+//==========================================================================================================
+// TlsSock Constructor
+//==========================================================================================================
+TlsSock::TlsSock(TlsContext* context)
+{
+    m_context = context;
+    m_ssl     = nullptr;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// close() - Shuts down the TLS session and closes the socket.  Safe to call if the socket isn't open
+//==========================================================================================================
+void TlsSock::close()
+{
+    // If we have a TLS session, tell the other side we're going away and free it
+    if (m_ssl)
+    {
+        SSL_shutdown(m_ssl);
+        SSL_free(m_ssl);
+        m_ssl = nullptr;
+    }
+
+    // And close the underlying socket
+    NetSock::close();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// on_new_session() - Called by OpenSSL when a client receives a resumable session from the server
+//
+// Returns: 1 to tell OpenSSL that we've taken ownership of the session
+//==========================================================================================================
+int TlsSock::on_new_session(SSL* ssl, SSL_SESSION* session)
+{
+    // Find the socket that this session belongs to
+    TlsSock* sock = (TlsSock*)SSL_get_app_data(ssl);
+
+    // If we don't know who it belongs to, let OpenSSL deal with it
+    if (sock == nullptr || sock->m_context == nullptr || sock->m_session_key.empty()) return 0;
+
+    // Save the session for the next connection to this server
+    sock->m_context->save_session(sock->m_session_key, session);
+    return 1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// handshake() - Performs the TLS handshake on a socket that's already connected
+//==========================================================================================================
+bool TlsSock::handshake(bool is_server)
+{
+    // We can't do a handshake without a context
+    if (m_context == nullptr || m_context->get_ctx() == nullptr)
+    {
+        m_error_str = "no TLS context";
+        m_error     = TLS_NO_CONTEXT;
+        NetSock::close();
+        return false;
+    }
+
+    // Create the TLS session and attach it to our socket
+    m_ssl = SSL_new(m_context->get_ctx());
+    SSL_set_app_data(m_ssl, this);
+
+    // OpenSSL talks to the socket through a BIO that won't raise SIGPIPE
+    BIO* bio = BIO_new(nosignal_socket_method());
+    BIO_set_fd(bio, m_sd, BIO_NOCLOSE);
+    SSL_set_bio(m_ssl, bio, bio);
+
+    // A non-blocking SSL_write() that runs out of socket buffer space can be finished by a later call
+    // with a different buffer pointer, and reports each record as it's sent rather than all-or-nothing
+    SSL_set_mode(m_ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE);
+
+    // If we're a client...
+    if (!is_server)
+    {
+        // Tell the server which host we're looking for, and check its certificate against that name
+        string host = m_session_key.substr(0, m_session_key.rfind(':'));
+        SSL_set_tlsext_host_name(m_ssl, host.c_str());
+        SSL_set1_host(m_ssl, host.c_str());
+
+        // If we've talked to this server before, try to resume that session
+        SSL_SESSION* session = m_context->load_session(m_session_key);
+        if (session)
+        {
+            SSL_set_session(m_ssl, session);
+            SSL_SESSION_free(session);
+        }
+    }
+
+    // Perform the handshake
+    int status = is_server ? SSL_accept(m_ssl) : SSL_connect(m_ssl);
+
+    // If the handshake failed, tell the caller
+    if (status != 1)
+    {
+        m_error_str = ssl_error_string("TLS handshake failed");
+        m_error     = TLS_HANDSHAKE_FAILED;
+        SSL_free(m_ssl);
+        m_ssl = nullptr;
+        NetSock::close();
+        return false;
+    }
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// connect() - Connects to a server and performs the TLS handshake
+//==========================================================================================================
+bool TlsSock::connect(string server, int port)
+{
+    // Close this socket if it happens to be open
+    close();
+
+    // Make the TCP connection
+    if (!NetSock::connect(server, port)) return false;
+
+    // Remember who we're talking to, so we can resume this session next time
+    m_session_key = server + ":" + to_string(port);
+
+    // And perform the handshake
+    return handshake(false);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// listen_and_accept() - Waits for a client to connect to our socket and performs the TLS handshake
+//==========================================================================================================
+bool TlsSock::listen_and_accept(TlsSock* new_sock)
+{
+    // If the caller is re-using a socket object from an earlier accept, shut that session down first
+    if (new_sock) new_sock->close();
+
+    // Accept the TCP connection
+    if (!NetSock::listen_and_accept(new_sock)) return false;
+
+    // If the caller passed us a socket object to clone ourselves into, it does the handshake
+    if (new_sock)
+    {
+        new_sock->m_context = m_context;
+        if (new_sock->handshake(true)) return true;
+        new_sock->get_error(&m_error_str);
+        m_error = new_sock->get_error();
+        return false;
+    }
+
+    // Otherwise, we're the one doing the handshake
+    return handshake(true);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// session_reused() - Returns 'true' if the most recent handshake resumed a previous session
+//==========================================================================================================
+bool TlsSock::session_reused()
+{
+    return m_ssl && SSL_session_reused(m_ssl) == 1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// ktls_send_active() - Returns 'true' if the kernel is encrypting the data we send
+//==========================================================================================================
+bool TlsSock::ktls_send_active()
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    return m_ssl && BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+#else
+    return false;
+#endif
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_file() - Sends part of a file over the TLS session
+//
+// If kTLS is active, this is a true sendfile() and the data never enters user-space.  Otherwise, the
+// file is read in chunks and encrypted by OpenSSL
+//
+// Returns either : -1 = An error occured
+//                  Anything else = the number of bytes actually sent
+//==========================================================================================================
+int64_t TlsSock::send_file(int fd, off_t offset, size_t count)
+{
+    char buffer[16384];
+
+    // If there's no TLS session, there's nothing to send on
+    if (m_ssl == nullptr) return -1;
+
+    // Keep track of how many bytes remain to be sent
+    size_t bytes_remaining = count;
+
+    // Loop until there are no more bytes to send...
+    while (bytes_remaining)
+    {
+        ssize_t sent;
+
+#ifdef SSL_OP_ENABLE_KTLS
+        // If the kernel is doing the encryption, let it read the file too
+        if (ktls_send_active())
+        {
+            sigpipe_guard_t guard;
+            sent = SSL_sendfile(m_ssl, fd, offset, bytes_remaining, 0);
+        }
+        else
+#endif
+        {
+            // Read a chunk of the file
+            sent = pread(fd, buffer, min(bytes_remaining, sizeof buffer), offset);
+
+            // If we've hit end-of-file, we're done
+            if (sent == 0) break;
+
+            // Encrypt and send it
+            if (sent > 0 && send(buffer, sent) != sent) return -1;
+        }
+
+        // If an error occured, tell the caller
+        if (sent < 0) return -1;
+
+        // Adjust the file offset and the count of bytes remaining to be sent
+        offset          += sent;
+        bytes_remaining -= sent;
+    }
+
+    // Tell the caller how many bytes we sent
+    return (count - bytes_remaining);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// io_recv() - Reads decrypted data from the TLS session.  Same return values as recv()
+//
+// MSG_PEEK and MSG_DONTWAIT are honoured.  Other flags are ignored
+//==========================================================================================================
+int TlsSock::io_recv(void* buffer, int length, int flags)
+{
+    // If there's no TLS session, there's nothing to read
+    if (m_ssl == nullptr) return -1;
+
+    // If OpenSSL doesn't already have decrypted data buffered, this read is going to hit the socket
+    bool from_socket = SSL_pending(m_ssl) == 0;
+
+    // Read (or peek at) the data.  A read that's served from OpenSSL's buffer can't block, so the socket
+    // only has to be made non-blocking when we're going to the socket for more
+    int status;
+    {
+        nonblock_guard_t nonblock(m_sd, from_socket ? flags : 0);
+        status = (flags & MSG_PEEK) ? SSL_peek(m_ssl, buffer, length) : SSL_read(m_ssl, buffer, length);
+    }
+
+    // If we got some data, hand it to the caller
+    if (status > 0) return status;
+
+    // Otherwise, figure out what went wrong
+    switch (SSL_get_error(m_ssl, status))
+    {
+        // If the other side closed the session, that's end-of-file
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+
+        // On a non-blocking socket, there's just no data available yet
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+    }
+
+    // Anything else is an error
+    return -1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// io_send() - Encrypts and sends data over the TLS session.  Same return values as send()
+//
+// MSG_DONTWAIT is honoured.  Other flags are ignored
+//==========================================================================================================
+int TlsSock::io_send(const void* buffer, int length, int flags)
+{
+    // If there's no TLS session, there's nothing to write to
+    if (m_ssl == nullptr) return -1;
+
+    // Send the data
+    int status;
+    {
+        nonblock_guard_t nonblock(m_sd, flags);
+        status = SSL_write(m_ssl, buffer, length);
+    }
+
+    // If it was sent, tell the caller how much
+    if (status > 0) return status;
+
+    // On a non-blocking socket, the socket buffer is just full right now
+    int error = SSL_get_error(m_ssl, status);
+    if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) errno = EAGAIN;
+
+    // Tell the caller that nothing was sent
+    return -1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// io_pending() - Returns the number of decrypted bytes OpenSSL is holding for us
+//==========================================================================================================
+int TlsSock::io_pending()
+{
+    return m_ssl ? SSL_pending(m_ssl) : 0;
+}
+//==========================================================================================================
@@ -0,0 +1,149 @@
+//==========================================================================================================
+// tls_sock.h - Defines a TLS-encrypted network socket built on NetSock and OpenSSL
+//
+// Link with -lssl -lcrypto
+//==========================================================================================================
+#pragma once
+#include <string>
+#include <map>
+#include <mutex>
+#include "netsock.h"
+
+// Forward declarations of the OpenSSL types we hold pointers to
+typedef struct ssl_ctx_st     SSL_CTX;
+typedef struct ssl_st         SSL;
+typedef struct ssl_session_st SSL_SESSION;
+
+
+//----------------------------------------------------------------------------------------------------------
+// TlsContext - Holds the certificates, settings and session cache shared by many TlsSock objects
+//----------------------------------------------------------------------------------------------------------
+class TlsContext
+{
+public:
+
+    // Constructor and Destructor
+    TlsContext();
+    ~TlsContext();
+
+    // Call this to create a context for server sockets
+    bool    create_server(std::string cert_file, std::string key_file);
+
+    // Call this to create a context for client sockets.  An empty ca_file means "use the system CAs"
+    bool    create_client(std::string ca_file = "", bool verify_peer = true);
+
+    // Call this to ask the kernel to do the encryption (kTLS), if the kernel and cipher support it
+    void    enable_ktls(bool flag);
+
+    // Call this to fetch the OpenSSL context
+    SSL_CTX* get_ctx() {return m_ctx;}
+
+    // When create_server() or create_client() fail, this will give information about the error
+    std::string get_error() {return m_error_str;}
+
+protected:
+
+    // Contexts own OpenSSL resources, so they can't be copied
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    // TlsSock stores and fetches resumable client sessions
+    friend class TlsSock;
+
+    // Saves a session for re-use on the next connection to 'key'.  Takes ownership of 'session'
+    void    save_session(const std::string& key, SSL_SESSION* session);
+
+    // Fetches a session for 'key' (with its reference count bumped), or nullptr if we don't have one
+    SSL_SESSION* load_session(const std::string& key);
+
+    // Throws away every cached session
+    void    clear_sessions();
+
+    // Most recent error
+    std::string m_error_str;
+
+    // The OpenSSL context
+    SSL_CTX* m_ctx;
+
+    // Client sessions, keyed by "host:port"
+    std::map<std::string, SSL_SESSION*> m_sessions;
+
+    // Protects m_sessions
+    std::mutex m_mutex;
+};
+//----------------------------------------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------------------------------------
+// TlsSock - A NetSock that encrypts everything it sends and receives
+//
+// OpenSSL writes to the socket with MSG_NOSIGNAL (or, under kTLS, with SIGPIPE blocked), so just like
+// NetSock, writing to a connection that the peer has reset returns -1 rather than killing the process
+//----------------------------------------------------------------------------------------------------------
+class TlsSock : public NetSock
+{
+public:
+
+    // These are the TLS-specific codes that can be returned by get_error()
+    enum
+    {
+        TLS_NO_CONTEXT = CANT_CONNECT + 1,
+        TLS_HANDSHAKE_FAILED
+    };
+
+    // Constructor and Destructor
+    TlsSock(TlsContext* context = nullptr);
+    ~TlsSock() {close();}
+
+    // Call this to set the context that handshakes will use
+    void    set_context(TlsContext* context) {m_context = context;}
+
+    // Call this to connect to a server and perform the TLS handshake
+    bool    connect(std::string server_name, int port);
+
+    // Call this to listen for a connection, accept it, and perform the TLS handshake
+    bool    listen_and_accept(TlsSock* new_sock = nullptr);
+
+    // Returns 'true' if the most recent handshake resumed a previous session
+    bool    session_reused();
+
+    // Returns 'true' if the kernel is doing the encryption for data we send
+    bool    ktls_send_active();
+
+    // Sends part of a file.  With kTLS active, the file data never passes through user-space
+    int64_t send_file(int fd, off_t offset, size_t count) override;
+
+    // Shuts down the TLS session and closes the socket
+    void    close() override;
+
+protected:
+
+    // TLS sockets own an SSL object, so they can't be copied
+    TlsSock(const TlsSock&) = delete;
+    TlsSock& operator=(const TlsSock&) = delete;
+
+    // TlsContext registers our session callback
+    friend class TlsContext;
+
+    // Called by OpenSSL when the server hands us a session ticket
+    static int on_new_session(SSL* ssl, SSL_SESSION* session);
+
+    // Performs the TLS handshake on an already connected socket
+    bool    handshake(bool is_server);
+
+    // Socket I/O goes through OpenSSL
+    int     io_recv(void* buffer, int length, int flags) override;
+    int     io_send(const void* buffer, int length, int flags) override;
+    int     io_pending() override;
+
+    // The context our handshakes use
+    TlsContext* m_context;
+
+    // The TLS session on this socket
+    SSL*    m_ssl;
+
+    // The "host:port" this client socket is connected to.  Used for session resumption
+    std::string m_session_key;
+};
+//----------------------------------------------------------------------------------------------------------